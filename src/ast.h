@@ -1,7 +1,9 @@
 #pragma once
 
 #include "lexer.h"
+#include "node_pool.h"
 #include <optional>
+#include <string_view>
 #include <variant>
 
 namespace Compiler {
@@ -20,111 +22,216 @@ enum class BinaryOp : int {
     Ne = NOT_EQUAL,
 };
 
+// Folds `left op right` with the semantics of the generated x86-64 code (two's complement wrap-around).
+// Returns nullopt where the hardware would fault instead (division by zero, INT64_MIN / -1).
+inline std::optional<int64_t> EvaluateBinaryOp(BinaryOp op, int64_t left, int64_t right) {
+    const uint64_t l = static_cast<uint64_t>(left);
+    const uint64_t r = static_cast<uint64_t>(right);
+    switch (op) {
+        case BinaryOp::Add: return static_cast<int64_t>(l + r);
+        case BinaryOp::Sub: return static_cast<int64_t>(l - r);
+        case BinaryOp::Mul: return static_cast<int64_t>(l * r);
+        case BinaryOp::Div:
+        case BinaryOp::Mod:
+            if (right == 0 || (left == INT64_MIN && right == -1)) {
+                return std::nullopt;
+            }
+            return op == BinaryOp::Div ? left / right : left % right;
+        case BinaryOp::Gt: return left > right;
+        case BinaryOp::Ge: return left >= right;
+        case BinaryOp::Lt: return left < right;
+        case BinaryOp::Le: return left <= right;
+        case BinaryOp::Eq: return left == right;
+        case BinaryOp::Ne: return left != right;
+    }
+    return std::nullopt;
+}
+
+// Nodes live in the pool of their kind and refer to each other by Ref, a 32-bit index into it; the
+// operands of a chain and the items of a block are a NodeList, side by side in their pool (node_pool.h).
 struct AssignmentExpression;
 struct Expression;
 struct Statement;
 struct Block;
 
+struct Declaration;
+
+// an identifier, its characters interned by the parser in the pool of char
+struct Name {
+    NodeList<char> Chars;
+    operator std::string_view() const { return { Chars.begin(), Chars.size() }; }
+    explicit operator bool() const { return !Chars.empty(); }
+};
+
 struct Primary {
-    explicit Primary(Expression* e) : Value(e) {}
-    explicit Primary(const std::string& s) : Value(s) {}
+    explicit Primary(Expression* e) : Value(Ref<Expression>(e)) {}
+    Primary(Name name, SourceLocation loc) : Value(name), Location(loc) {}
     explicit Primary(int64_t i) : Value(i) {}
-    std::variant<Expression*, std::string, int64_t> Value;
+    std::variant<Ref<Expression>, Name, int64_t> Value;
+    SourceLocation Location;
+    Ref<Declaration> Decl; // bound by SemanticAnalyzer for identifiers
+    Ref<Expression> Index; // element of an array: Value[Index]
 };
 
 struct PostfixExpression {
     explicit PostfixExpression(Primary* p) : Prim(p) {}
-    Primary* Prim;
-    std::vector<std::vector<AssignmentExpression*>> CallList;
+    Ref<Primary> Prim;
+    NodeList<NodeList<Ref<AssignmentExpression>>> CallList;
 };
 
 struct MultiplicativeExpression { // '*' | '/'
     explicit MultiplicativeExpression(PostfixExpression* p) : Left(p) {}
-    PostfixExpression* Left;
-    std::vector<std::pair<BinaryOp, PostfixExpression*>> Right;
+    Ref<PostfixExpression> Left;
+    NodeList<std::pair<BinaryOp, Ref<PostfixExpression>>> Right;
 };
 
 struct AdditiveExpression { // '+' | '-'
     explicit AdditiveExpression(MultiplicativeExpression* e) : Left(e) {}
-    MultiplicativeExpression* Left;
-    std::vector<std::pair<BinaryOp, MultiplicativeExpression*>> Right;
+    Ref<MultiplicativeExpression> Left;
+    NodeList<std::pair<BinaryOp, Ref<MultiplicativeExpression>>> Right;
 };
 
 struct RelationalExpression { // '>' | '>=' | '<' | '<='
     explicit RelationalExpression(AdditiveExpression* e) : Left(e) {}
-    AdditiveExpression* Left;
-    std::vector<std::pair<BinaryOp, AdditiveExpression*>> Right;
+    Ref<AdditiveExpression> Left;
+    NodeList<std::pair<BinaryOp, Ref<AdditiveExpression>>> Right;
 };
 
 struct EqualityExpression { // '==' | '!='
     explicit EqualityExpression(RelationalExpression* e) : Left(e) {}
-    RelationalExpression* Left;
-    std::vector<std::pair<BinaryOp, RelationalExpression*>> Right;
+    Ref<RelationalExpression> Left;
+    NodeList<std::pair<BinaryOp, Ref<RelationalExpression>>> Right;
 };
 
 struct AssignmentExpression { // '='
     AssignmentExpression(EqualityExpression* e) : Expr(e) {}
-    AssignmentExpression(std::string_view name, EqualityExpression* e) : Ident(name), Expr(e) {}
-    std::optional<std::string> Ident = std::nullopt;
-    EqualityExpression* Expr;
+    AssignmentExpression(Name name, SourceLocation loc, EqualityExpression* e)
+        : Ident(name), Expr(e), Location(loc) {}
+    Name Ident; // empty when nothing is assigned
+    Ref<EqualityExpression> Expr;
+    SourceLocation Location;
+    Ref<Declaration> Decl;  // bound by SemanticAnalyzer when Ident is set
+    Ref<Expression> Index;  // store to an array element: Ident[Index] = Expr
+    bool DeadStore = false; // value is still computed and printed, but never written back
+    bool Silent = false;    // a temporary of GlobalValueNumbering: written back, never printed
 };
 
 struct Expression {
     explicit Expression(AssignmentExpression* e) : Expr(e) {}
-    AssignmentExpression* Expr;
+    Ref<AssignmentExpression> Expr;
 };
 
+// Scalars that SuperwordVectorizer loads or stores as one vector. SemanticAnalyzer gives them adjacent
+// frame slots, the first lane at the lowest address, as if they were an array.
+struct PackedSlots {
+    NodeList<Ref<Declaration>> Lanes;
+};
+
+// slots in the stack frame, arrays included: 7 MB, which leaves 1 MB of the default 8 MB stack (ulimit -s)
+// for the environment, the runtime and the operands nested expressions push
+constexpr int64_t MaxFrameSlots = 7 * 1024 * 1024 / 8;
+
 struct Declaration {
-    explicit Declaration(std::string_view ident) : Ident(ident) {}
-    std::string Ident;
+    Declaration(Name ident, SourceLocation loc, int64_t size = 0) : Ident(ident), Location(loc), Size(size) {}
+    Name Ident;
+    SourceLocation Location;
+    int64_t Size = 0;   // element count of an array, 0 for a scalar
+    int64_t Offset = 0; // frame slot at [rbp - Offset] (element 0 of an array), assigned by SemanticAnalyzer
+    Ref<PackedSlots> Packed; // set by SuperwordVectorizer
+};
+
+struct ExpressionStatement;
+
+// Set by SuperwordVectorizer on each of a run of consecutive assignments of the same shape, which the
+// generator computes as the lanes of one vector operation.
+struct SuperwordPack {
+    NodeList<Ref<ExpressionStatement>> Lanes; // in block order
 };
 
 struct ExpressionStatement {
     explicit ExpressionStatement(Expression* e) : Expr(e) {}
-    Expression* Expr;
+    Ref<Expression> Expr;
+    Ref<SuperwordPack> Pack;
 };
 
 struct IfStatement {
     IfStatement(Expression* cond, Statement* then, Statement* e = nullptr)
         : Cond(cond), Then(then), Else(e) {}
-    Expression* Cond;
-    Statement* Then;
-    Statement* Else = nullptr; // optional
+    Ref<Expression> Cond;
+    Ref<Statement> Then;
+    Ref<Statement> Else; // optional
+    // how often the condition held and failed while ProgramEvaluator ran the program: the profile of
+    // the branch, empty when the evaluate pass did not get to it
+    uint64_t Taken = 0;
+    uint64_t NotTaken = 0;
 };
 
 struct ReturnStatement {
     explicit ReturnStatement(Expression* e = nullptr) : Expr(e) {}
-    Expression* Expr;
+    Ref<Expression> Expr;
+};
+
+// Set by LoopVectorizer on a counted loop `while (i < n) { ...; i = i + 1; }` whose body only does
+// element-wise work on arrays indexed by i and sum reductions into scalars. The generator runs whole
+// vectors of iterations first and leaves the remainder to the scalar loop.
+struct VectorLoop {
+    Ref<Declaration> Induction;
+    Ref<Primary> Bound; // literal or loop-invariant scalar
+    bool Inclusive;     // i <= n
+    NodeList<Ref<AssignmentExpression>> Body; // a[i] = ... and s = s + ..., in order, without the increment
 };
 
 struct WhileStatement {
     WhileStatement(Expression* cond, Statement* loop) : Cond(cond), Loop(loop) {}
-    Expression* Cond;
-    Statement* Loop;
+    Ref<Expression> Cond;
+    Ref<Statement> Loop;
+    Ref<VectorLoop> Vector;
+};
+
+// Set by ProgramEvaluator in place of the leading statements of the program, which it ran at compile
+// time: the text they printed, the values they left in the variables still used afterwards and, when
+// they ended the program, its exit code.
+struct PrecomputedStatement {
+    struct Value {
+        Ref<Declaration> Decl;
+        NodeList<int64_t> Elements; // a single one for a scalar
+    };
+    NodeList<char> Output;
+    NodeList<Value> Values;
+    std::optional<int64_t> ExitCode;
 };
 
 struct Statement {
-    explicit Statement(ExpressionStatement* e) : Stmt(e) {}
-    explicit Statement(IfStatement* i) : Stmt(i) {}
-    explicit Statement(ReturnStatement* r) : Stmt(r) {}
-    explicit Statement(WhileStatement* w) : Stmt(w) {}
-    explicit Statement(Block* b) : Stmt(b) {}
-    std::variant<ExpressionStatement*, IfStatement*, ReturnStatement*, WhileStatement*, Block*> Stmt;
+    Statement(ExpressionStatement* e, SourceLocation loc) : Stmt(e), Location(loc) {}
+    Statement(IfStatement* i, SourceLocation loc) : Stmt(i), Location(loc) {}
+    Statement(ReturnStatement* r, SourceLocation loc) : Stmt(r), Location(loc) {}
+    Statement(WhileStatement* w, SourceLocation loc) : Stmt(w), Location(loc) {}
+    Statement(Block* b, SourceLocation loc) : Stmt(b), Location(loc) {}
+    Statement(PrecomputedStatement* p, SourceLocation loc) : Stmt(p), Location(loc) {}
+    std::variant<Ref<ExpressionStatement>, Ref<IfStatement>, Ref<ReturnStatement>, Ref<WhileStatement>,
+        Ref<Block>, Ref<PrecomputedStatement>>
+        Stmt;
+    SourceLocation Location;
 };
 
 struct BlockItem {
-    explicit BlockItem(Statement* s) : Item(s) {}
-    explicit BlockItem(Declaration* d) : Item(d) {}
-    std::variant<Statement*, Declaration*> Item;
+    explicit BlockItem(Statement* s) : Item(Ref<Statement>(s)) {}
+    explicit BlockItem(Declaration* d) : Item(Ref<Declaration>(d)) {}
+    std::variant<Ref<Statement>, Ref<Declaration>> Item;
 };
 
 struct Block {
-    std::vector<BlockItem*> Items;
+    NodeList<Ref<BlockItem>> Items;
+    // the braces, which tell IncrementalCompiler whether an edit is inside the block
+    SourceLocation Location;
+    SourceLocation End;
 };
 
 struct Program {
     explicit Program(Block* b) : GlobalBlock(b) {}
-    Block* GlobalBlock;
+    Ref<Block> GlobalBlock;
+    int64_t FrameSize = 0;   // bytes reserved below rbp for all locals
+    size_t NestingDepth = 0; // deepest nesting of blocks, statements and parentheses
 };
 
 } // namespace Compiler
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "ast.h"
+#include "utils.h"
+#include <type_traits>
+
+namespace Compiler {
+
+// Calls visitor(Primary*) and visitor(AssignmentExpression*) for every node of that kind under expr,
+// in evaluation order (array index, then operands, then the assignment that consumes them).
+template <typename Expr, typename Visitor>
+void VisitExpression(Expr* expr, Visitor&& visitor) {
+    if constexpr (std::is_same_v<std::remove_const_t<Expr>, Expression>) {
+        if (expr->Expr->Index) {
+            VisitExpression(expr->Expr->Index.Get(), visitor);
+        }
+        VisitExpression(expr->Expr->Expr.Get(), visitor);
+        if (expr->Expr->Ident) {
+            visitor(expr->Expr.Get());
+        }
+    } else if constexpr (std::is_same_v<std::remove_const_t<Expr>, PostfixExpression>) {
+        VisitExpression(expr->Prim.Get(), visitor);
+    } else if constexpr (std::is_same_v<std::remove_const_t<Expr>, Primary>) {
+        if (auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            VisitExpression(inner->Get(), visitor);
+        } else {
+            if (expr->Index) {
+                VisitExpression(expr->Index.Get(), visitor);
+            }
+            visitor(expr);
+        }
+    } else {
+        VisitExpression(expr->Left.Get(), visitor);
+        for (const auto& [op, right] : expr->Right) {
+            VisitExpression(right.Get(), visitor);
+        }
+    }
+}
+
+// Calls visitor(Expression*) for every top-level expression (conditions, expression statements and
+// return values) of the statements nested in block, in source order.
+template <typename Visitor>
+void VisitStatementExpressions(Block* block, Visitor&& visitor);
+
+template <typename Visitor>
+void VisitStatementExpressions(Statement* stmt, Visitor&& visitor) {
+    std::visit(overloaded{ [&](ExpressionStatement* exprStmt) { visitor(exprStmt->Expr); },
+                   [&](ReturnStatement* retStmt) {
+                       if (retStmt->Expr) {
+                           visitor(retStmt->Expr);
+                       }
+                   },
+                   [&](IfStatement* ifStmt) {
+                       visitor(ifStmt->Cond);
+                       VisitStatementExpressions(ifStmt->Then, visitor);
+                       if (ifStmt->Else) {
+                           VisitStatementExpressions(ifStmt->Else, visitor);
+                       }
+                   },
+                   [&](WhileStatement* whileStmt) {
+                       visitor(whileStmt->Cond);
+                       VisitStatementExpressions(whileStmt->Loop, visitor);
+                   },
+                   [&](Block* inner) { VisitStatementExpressions(inner, visitor); },
+                   [](PrecomputedStatement*) {} },
+        stmt->Stmt);
+}
+
+template <typename Visitor>
+void VisitStatementExpressions(Block* block, Visitor&& visitor) {
+    for (const auto& item : block->Items) {
+        if (auto* stmt = std::get_if<Ref<Statement>>(&item->Item)) {
+            VisitStatementExpressions(stmt->Get(), visitor);
+        }
+    }
+}
+
+// Value of expr when it is built from literals only, nullopt otherwise (or when evaluating it would fault).
+template <typename Expr>
+std::optional<int64_t> FoldConstant(const Expr* expr) {
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        if (expr->Expr->Ident) {
+            return std::nullopt;
+        }
+        return FoldConstant(expr->Expr->Expr.Get());
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        if (!expr->CallList.empty()) {
+            return std::nullopt;
+        }
+        return FoldConstant(expr->Prim.Get());
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        if (const auto* i = std::get_if<int64_t>(&expr->Value)) {
+            return *i;
+        } else if (const auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            return FoldConstant(inner->Get());
+        }
+        return std::nullopt;
+    } else {
+        std::optional<int64_t> value = FoldConstant(expr->Left.Get());
+        for (const auto& [op, right] : expr->Right) {
+            const std::optional<int64_t> rhs = FoldConstant(right.Get());
+            if (!value || !rhs) {
+                return std::nullopt;
+            }
+            value = EvaluateBinaryOp(op, *value, *rhs);
+        }
+        return value;
+    }
+}
+
+} // namespace Compiler
@@ -0,0 +1,260 @@
+#include "block_layout.h"
+#include "utils.h"
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+
+namespace Compiler {
+
+// headers bigger than this are not duplicated; their loops keep the jump back to the top
+static constexpr size_t MaxDuplicatedHeaderLines = 64;
+
+std::string InvertCondition(const std::string& cc) {
+    static const std::unordered_map<std::string, std::string> inverse{ { "z", "nz" }, { "nz", "z" },
+        { "e", "ne" }, { "ne", "e" }, { "g", "le" }, { "le", "g" }, { "l", "ge" }, { "ge", "l" } };
+    auto it = inverse.find(cc);
+    if (it == inverse.end()) {
+        Error("Unknown condition code: " + cc);
+    }
+    return it->second;
+}
+
+BlockLayout::BlockLayout(std::vector<MachineBlock>& blocks) : m_Blocks(blocks) {}
+
+int BlockLayout::Optimize() {
+    const int rotated = RotateLoops();
+    FindColdBlocks();
+    Order();
+    return rotated;
+}
+
+std::string BlockLayout::Emit() {
+    if (m_Layout.empty()) {
+        const std::vector<bool> reachable = FindReachable();
+        for (int b = 0; b < static_cast<int>(m_Blocks.size()); ++b) {
+            if (reachable[b]) {
+                m_Layout.push_back(b);
+            }
+        }
+    }
+
+    // terminators first, so that only blocks something jumps to get a label
+    std::vector<std::string> exits(m_Layout.size());
+    std::vector<bool> targeted(m_Blocks.size(), false);
+    auto jump = [&](const std::string& cc, int target) {
+        targeted[target] = true;
+        return "j" + cc + " " + m_Blocks[target].Label + "\n";
+    };
+    for (size_t i = 0; i < m_Layout.size(); ++i) {
+        const MachineBlock& block = m_Blocks[m_Layout[i]];
+        const int next = i + 1 < m_Layout.size() ? m_Layout[i + 1] : -1;
+
+        if (block.Exit == BlockExit::Jump && block.Next != next) {
+            exits[i] = jump("mp", block.Next);
+        } else if (block.Exit == BlockExit::Branch) {
+            if (block.Next == next) {
+                exits[i] = jump(block.Condition, block.Taken);
+            } else if (block.Taken == next) {
+                exits[i] = jump(InvertCondition(block.Condition), block.Next);
+            } else {
+                exits[i] = jump(block.Condition, block.Taken) + jump("mp", block.Next);
+            }
+        }
+    }
+
+    std::string output;
+    for (size_t i = 0; i < m_Layout.size(); ++i) {
+        const MachineBlock& block = m_Blocks[m_Layout[i]];
+        if (block.Alignment != 0) {
+            output += "align " + std::to_string(block.Alignment) + "\n";
+        }
+        if (targeted[m_Layout[i]]) {
+            output += block.Label + ":\n";
+        }
+        output += block.Code;
+        output += exits[i];
+    }
+    return output;
+}
+
+bool BlockLayout::IsBackEdge(int from, int to) const {
+    // the generator creates a loop's blocks after its header, and rotation appends the new tests
+    return m_Blocks[to].LoopHeader && to <= from;
+}
+
+std::vector<int> BlockLayout::Successors(int block) const {
+    const MachineBlock& b = m_Blocks[block];
+    if (b.Exit == BlockExit::Jump) {
+        return { b.Next };
+    } else if (b.Exit == BlockExit::Branch) {
+        return { b.Next, b.Taken };
+    }
+    return {};
+}
+
+int BlockLayout::RotateLoops() {
+    const int count = static_cast<int>(m_Blocks.size());
+    std::vector<std::pair<int, int>> loops; // (top of the body, latch)
+
+    for (int latch = 0; latch < count; ++latch) {
+        const int header = m_Blocks[latch].Next;
+        if (m_Blocks[latch].Exit != BlockExit::Jump || !IsBackEdge(latch, header) ||
+            m_Blocks[header].Exit != BlockExit::Branch ||
+            static_cast<size_t>(std::count(m_Blocks[header].Code.begin(), m_Blocks[header].Code.end(), '\n')) >
+                MaxDuplicatedHeaderLines) {
+            continue;
+        }
+
+        // the latch now repeats the test and branches back to the top of the body while it holds
+        MachineBlock test;
+        test.Label = m_Blocks[header].Label + "_test";
+        test.Code = m_Blocks[header].Code;
+        test.Exit = BlockExit::Branch;
+        test.Condition = InvertCondition(m_Blocks[header].Condition);
+        test.Taken = m_Blocks[header].Next;
+        test.Next = m_Blocks[header].Taken;
+        test.LoopDepth = m_Blocks[header].LoopDepth;
+
+        const int body = m_Blocks[header].Next;
+        m_Blocks[latch].Next = static_cast<int>(m_Blocks.size());
+        m_Blocks.push_back(std::move(test));
+        m_Blocks[header].LoopHeader = false;
+        m_Blocks[body].LoopHeader = true;
+        loops.emplace_back(body, latch);
+    }
+
+    for (const auto& [body, latch] : loops) {
+        bool innermost = true;
+        for (int b = body + 1; b <= latch; ++b) {
+            innermost &= !(m_Blocks[b].LoopHeader && m_Blocks[b].LoopDepth > m_Blocks[body].LoopDepth);
+        }
+        m_Blocks[body].Alignment = innermost ? 32 : 16;
+    }
+    return static_cast<int>(loops.size());
+}
+
+// a block is cold when every path from it runs into the program exit without going around a loop;
+// coldness spreads back along the edges from the blocks that exit, once all of a block's successors are
+// cold, so a join that comes before the blocks running into it takes no extra pass
+void BlockLayout::FindColdBlocks() {
+    const int count = static_cast<int>(m_Blocks.size());
+    m_Cold.assign(count, false);
+
+    std::vector<std::vector<int>> predecessors(count);
+    std::vector<int> warm(count, 0); // successors not known cold, back edges never
+    std::vector<int> worklist;
+    for (int b = 0; b < count; ++b) {
+        for (int s : Successors(b)) {
+            predecessors[s].push_back(b);
+            ++warm[b];
+        }
+        if (warm[b] == 0) {
+            m_Cold[b] = true;
+            worklist.push_back(b);
+        }
+    }
+    while (!worklist.empty()) {
+        const int s = worklist.back();
+        worklist.pop_back();
+        for (int b : predecessors[s]) {
+            if (!IsBackEdge(b, s) && --warm[b] == 0) {
+                m_Cold[b] = true;
+                worklist.push_back(b);
+            }
+        }
+    }
+}
+
+int BlockLayout::Weight(int block) const {
+    return m_Cold[block] ? 0 : 1 << (3 * std::min(m_Blocks[block].LoopDepth, 8));
+}
+
+std::vector<bool> BlockLayout::FindReachable() const {
+    std::vector<bool> reachable(m_Blocks.size(), false);
+    std::vector<int> worklist{ 0 };
+    reachable[0] = true;
+    while (!worklist.empty()) {
+        const int b = worklist.back();
+        worklist.pop_back();
+        for (int s : Successors(b)) {
+            if (!reachable[s]) {
+                reachable[s] = true;
+                worklist.push_back(s);
+            }
+        }
+    }
+    return reachable;
+}
+
+void BlockLayout::Order() {
+    const int count = static_cast<int>(m_Blocks.size());
+    const std::vector<bool> reachable = FindReachable();
+
+    // a block is ready once every forward edge into it comes from a block already placed
+    std::vector<int> pending(count, 0);
+    for (int b = 0; b < count; ++b) {
+        for (int s : reachable[b] ? Successors(b) : std::vector<int>{}) {
+            pending[s] += !IsBackEdge(b, s);
+        }
+    }
+
+    std::vector<bool> placed(count, false);
+    m_Layout.clear();
+
+    // a chain starts at the first ready block, hot before cold, or else at the first block not placed;
+    // the ready blocks wait in a heap per temperature and the others are found by a cursor that only
+    // moves forward, so a deep nest of short chains does not rescan the blocks for each
+    std::priority_queue<int, std::vector<int>, std::greater<int>> ready[2];
+    int first[2] = { 0, 0 };
+    for (int b = 0; b < count; ++b) {
+        if (reachable[b] && pending[b] == 0) {
+            ready[m_Cold[b]].push(b);
+        }
+    }
+
+    auto seed = [&]() {
+        for (bool cold : { false, true }) {
+            while (!ready[cold].empty() && placed[ready[cold].top()]) {
+                ready[cold].pop();
+            }
+            if (!ready[cold].empty()) {
+                return ready[cold].top();
+            }
+            int& b = first[cold];
+            while (b < count && (!reachable[b] || placed[b] || m_Cold[b] != cold)) {
+                ++b;
+            }
+            if (b < count) {
+                return b;
+            }
+        }
+        return -1;
+    };
+
+    for (int current = 0; current != -1; current = seed()) {
+        while (current != -1) {
+            placed[current] = true;
+            m_Layout.push_back(current);
+
+            std::vector<int> successors = Successors(current);
+            for (int s : successors) {
+                if (!IsBackEdge(current, s) && --pending[s] == 0) {
+                    ready[m_Cold[s]].push(s);
+                }
+            }
+            // the likelier successor first; on a tie the fall-through of the source order wins
+            std::stable_sort(successors.begin(), successors.end(),
+                [&](int a, int b) { return Weight(a) > Weight(b); });
+
+            current = -1;
+            for (int s : successors) {
+                if (!placed[s] && pending[s] == 0) {
+                    current = s;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+} // namespace Compiler
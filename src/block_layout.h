@@ -0,0 +1,57 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Compiler {
+
+enum class BlockExit { Jump, Branch, Return };
+
+// Straight-line code plus how control leaves it. Blocks refer to each other by index, and block 0 is
+// the program entry. A loop header tests the loop condition and ends with a Branch whose Taken edge
+// leaves the loop; the loop's latch ends with a Jump back to it.
+struct MachineBlock {
+    std::string Label;
+    std::string Code;
+    BlockExit Exit = BlockExit::Jump;
+    std::string Condition; // Branch: condition code of the Taken edge, e.g. "z" for jz
+    int Taken = -1;
+    int Next = -1;         // Jump target, or the Branch successor when Condition fails
+    int LoopDepth = 0;
+    bool LoopHeader = false;
+    int Alignment = 0;     // set by BlockLayout on hot loop tops
+};
+
+// the condition code that holds when cc does not, e.g. "nz" for "z"
+std::string InvertCondition(const std::string& cc);
+
+// Turns the generator's control-flow graph into assembly. Emit() alone keeps the blocks in the order the
+// generator created them; Optimize() first improves that order:
+//  - loops are rotated to test at the bottom by duplicating the header test at the latch, so each
+//    iteration takes a single branch; the original header stays in front as the entry guard
+//  - blocks are chained greedily along the likely successor: deeper loop nesting is likelier, and
+//    code that can only run into the program exit is cold and moves to the end
+//  - jumps to the next block disappear and branches are inverted to fall through where possible
+//  - loop tops are aligned (32 bytes for innermost loops, 16 otherwise) with multi-byte NOPs
+class BlockLayout {
+  public:
+    explicit BlockLayout(std::vector<MachineBlock>& blocks);
+    int Optimize(); // returns the number of loops rotated
+    std::string Emit();
+
+  private:
+    int RotateLoops();
+    void FindColdBlocks();
+    void Order();
+    std::vector<bool> FindReachable() const;
+
+    bool IsBackEdge(int from, int to) const;
+    int Weight(int block) const;
+    std::vector<int> Successors(int block) const;
+
+    std::vector<MachineBlock>& m_Blocks;
+    std::vector<bool> m_Cold;
+    std::vector<int> m_Layout;
+};
+
+} // namespace Compiler
@@ -0,0 +1,230 @@
+#include "bytecode.h"
+#include "utils.h"
+#include <cstring>
+#include <format>
+
+namespace Compiler {
+
+static constexpr std::string_view Signature = "CBC\x01";
+
+static bool IsComparison(Opcode op) {
+    return op >= Opcode::Lt && op <= Opcode::Ne;
+}
+
+static bool IsJump(Opcode op) {
+    return op >= Opcode::Jump && op <= Opcode::DecrementJumpIfNotZero;
+}
+
+// the branch taken when `B cmp C` of the comparison op holds, or when it does not
+static Opcode BranchOn(Opcode comparison, bool holds) {
+    static constexpr Opcode Negated[] = { Opcode::JumpIfGe, Opcode::JumpIfGt, Opcode::JumpIfLe, Opcode::JumpIfLt,
+        Opcode::JumpIfNe, Opcode::JumpIfEq };
+    const int index = static_cast<int>(comparison) - static_cast<int>(Opcode::Lt);
+    return holds ? static_cast<Opcode>(static_cast<int>(Opcode::JumpIfLt) + index) : Negated[index];
+}
+
+int Bytecode::Fuse() {
+    std::vector<bool> targeted(Code.size() + 1, false);
+    for (const Instruction& ins : Code) {
+        if (IsJump(ins.Op)) {
+            targeted[ins.C] = true;
+        }
+    }
+
+    // a pair is only fused when nothing jumps between its two halves
+    std::vector<Instruction> fused;
+    std::vector<uint32_t> moved(Code.size() + 1);
+    int count = 0;
+    for (size_t i = 0; i < Code.size(); ++i) {
+        moved[i] = static_cast<uint32_t>(fused.size());
+        const Instruction& ins = Code[i];
+        const Instruction* next = i + 1 < Code.size() && !targeted[i + 1] ? &Code[i + 1] : nullptr;
+        const bool branchOnA =
+            next && (next->Op == Opcode::JumpIfZero || next->Op == Opcode::JumpIfNotZero) && next->A == ins.A;
+
+        if (branchOnA && IsComparison(ins.Op) && ins.A >= FrameSlots && ins.A < ConstantBase) {
+            // the comparison result is a temporary that only the branch reads
+            fused.push_back({ BranchOn(ins.Op, next->Op == Opcode::JumpIfNotZero), ins.B, ins.C, next->C });
+        } else if (branchOnA && next->Op == Opcode::JumpIfNotZero && (ins.Op == Opcode::Add || ins.Op == Opcode::Sub) &&
+                   ins.A == ins.B) {
+            fused.push_back({ ins.Op == Opcode::Add ? Opcode::IncrementJumpIfNotZero : Opcode::DecrementJumpIfNotZero,
+                ins.A, ins.C, next->C });
+        } else {
+            fused.push_back(ins);
+            continue;
+        }
+        moved[++i] = static_cast<uint32_t>(fused.size() - 1);
+        count++;
+    }
+    moved[Code.size()] = static_cast<uint32_t>(fused.size());
+
+    for (Instruction& ins : fused) {
+        if (IsJump(ins.Op)) {
+            ins.C = moved[ins.C];
+        }
+    }
+    Code = std::move(fused);
+    return count;
+}
+
+template <typename T>
+static void Put(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+std::string Bytecode::Serialize() const {
+    std::string out(Signature);
+    for (uint32_t value : { FrameSlots, ConstantBase, static_cast<uint32_t>(Constants.size()),
+             static_cast<uint32_t>(Arrays.size()), static_cast<uint32_t>(Strings.size()),
+             static_cast<uint32_t>(Code.size()) }) {
+        Put(out, value);
+    }
+    for (int64_t constant : Constants) {
+        Put(out, constant);
+    }
+    for (const BytecodeArray& array : Arrays) {
+        Put(out, array.Base);
+        Put(out, array.Size);
+    }
+    for (const std::string& string : Strings) {
+        Put(out, static_cast<uint32_t>(string.size()));
+        out += string;
+    }
+    for (const Instruction& ins : Code) {
+        Put(out, static_cast<uint8_t>(ins.Op));
+        Put(out, ins.A);
+        Put(out, ins.B);
+        Put(out, ins.C);
+    }
+    return out;
+}
+
+bool Bytecode::IsSerialized(std::string_view data) {
+    return data.starts_with(Signature);
+}
+
+namespace {
+
+class Reader {
+  public:
+    explicit Reader(std::string_view data) : m_Data(data) {}
+
+    template <typename T>
+    T Get() {
+        T value;
+        std::memcpy(&value, Take(sizeof(T)).data(), sizeof(T));
+        return value;
+    }
+
+    std::string_view Take(size_t size) {
+        if (size > m_Data.size()) {
+            Error("Invalid bytecode file: truncated");
+        }
+        const std::string_view bytes = m_Data.substr(0, size);
+        m_Data.remove_prefix(size);
+        return bytes;
+    }
+
+    bool AtEnd() const { return m_Data.empty(); }
+
+  private:
+    std::string_view m_Data;
+};
+
+} // namespace
+
+Bytecode Bytecode::Deserialize(std::string_view data) {
+    if (!IsSerialized(data)) {
+        Error("Invalid bytecode file: bad signature");
+    }
+    Reader reader(data.substr(Signature.size()));
+    Bytecode code;
+    code.FrameSlots = reader.Get<uint32_t>();
+    code.ConstantBase = reader.Get<uint32_t>();
+    const uint32_t constants = reader.Get<uint32_t>();
+    const uint32_t arrays = reader.Get<uint32_t>();
+    const uint32_t strings = reader.Get<uint32_t>();
+    const uint32_t instructions = reader.Get<uint32_t>();
+
+    for (uint32_t i = 0; i < constants; ++i) {
+        code.Constants.push_back(reader.Get<int64_t>());
+    }
+    for (uint32_t i = 0; i < arrays; ++i) {
+        const uint32_t base = reader.Get<uint32_t>();
+        code.Arrays.push_back({ base, reader.Get<uint32_t>() });
+    }
+    for (uint32_t i = 0; i < strings; ++i) {
+        code.Strings.emplace_back(reader.Take(reader.Get<uint32_t>()));
+    }
+    for (uint32_t i = 0; i < instructions; ++i) {
+        Instruction ins{ static_cast<Opcode>(reader.Get<uint8_t>()) };
+        ins.A = reader.Get<uint32_t>();
+        ins.B = reader.Get<uint32_t>();
+        ins.C = reader.Get<uint32_t>();
+        code.Code.push_back(ins);
+    }
+    if (!reader.AtEnd()) {
+        Error("Invalid bytecode file: trailing data");
+    }
+
+    const uint64_t registers = code.RegisterCount();
+    if (registers > MaxRegisters) {
+        Error(std::format("Invalid bytecode file: {} registers, more than the {} of the VM", registers,
+            MaxRegisters));
+    }
+    bool valid = code.FrameSlots >= 1 && code.ConstantBase >= code.FrameSlots &&
+        !code.Code.empty() && (code.Code.back().Op == Opcode::Exit || code.Code.back().Op == Opcode::Jump);
+    for (const BytecodeArray& array : code.Arrays) {
+        valid &= array.Size >= 1 && array.Base < code.FrameSlots && array.Base >= array.Size;
+    }
+    if (!valid) {
+        Error("Invalid bytecode file: bad header");
+    }
+
+    auto read = [&](uint32_t reg) { return reg < registers; };
+    auto written = [&](uint32_t reg) { return reg < code.ConstantBase; };
+    auto target = [&](uint32_t index) { return index < code.Code.size(); };
+    auto array = [&](uint32_t index) { return index < code.Arrays.size(); };
+    for (const Instruction& ins : code.Code) {
+        switch (ins.Op) {
+            case Opcode::Move: valid &= written(ins.A) && read(ins.B); break;
+            case Opcode::Add:
+            case Opcode::Sub:
+            case Opcode::Mul:
+            case Opcode::Div:
+            case Opcode::Mod:
+            case Opcode::Lt:
+            case Opcode::Le:
+            case Opcode::Gt:
+            case Opcode::Ge:
+            case Opcode::Eq:
+            case Opcode::Ne: valid &= written(ins.A) && read(ins.B) && read(ins.C); break;
+            case Opcode::LoadElement: valid &= written(ins.A) && array(ins.B) && read(ins.C); break;
+            case Opcode::StoreElement: valid &= array(ins.A) && read(ins.B) && read(ins.C); break;
+            case Opcode::StoreConstants:
+                valid &= array(ins.A) && uint64_t{ ins.B } + code.Arrays[ins.A].Size <= registers;
+                break;
+            case Opcode::Print:
+            case Opcode::Exit: valid &= read(ins.A); break;
+            case Opcode::PrintText: valid &= ins.A < code.Strings.size(); break;
+            case Opcode::Jump: valid &= target(ins.C); break;
+            case Opcode::JumpIfZero:
+            case Opcode::JumpIfNotZero: valid &= read(ins.A) && target(ins.C); break;
+            case Opcode::JumpIfLt:
+            case Opcode::JumpIfLe:
+            case Opcode::JumpIfGt:
+            case Opcode::JumpIfGe:
+            case Opcode::JumpIfEq:
+            case Opcode::JumpIfNe: valid &= read(ins.A) && read(ins.B) && target(ins.C); break;
+            case Opcode::IncrementJumpIfNotZero:
+            case Opcode::DecrementJumpIfNotZero: valid &= written(ins.A) && read(ins.B) && target(ins.C); break;
+            default: valid = false;
+        }
+        if (!valid) {
+            Error("Invalid bytecode file: bad instruction");
+        }
+    }
+    return code;
+}
+
+} // namespace Compiler
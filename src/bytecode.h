@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Compiler {
+
+// Register machine code for the VirtualMachine. Every operand is a register, so the register file is
+// laid out as
+//     [0, FrameSlots)                   the stack frame: register n is the slot at [rbp - 8 * n]
+//     [FrameSlots, ConstantBase)        temporaries of expressions
+//     [ConstantBase, RegisterCount)     Constants, copied in before the program starts
+// Variables live in the frame registers exactly like in the generated code, element i of an array
+// in register Offset / 8 - i.
+enum class Opcode : uint8_t {
+    Move,     // A = B
+    Add,      // A = B op C, with the wrap-around and faults of the x86-64 instructions
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    Lt,       // A = B cmp C ? 1 : 0
+    Le,
+    Gt,
+    Ge,
+    Eq,
+    Ne,
+    LoadElement,    // A = Arrays[B][C]
+    StoreElement,   // Arrays[A][B] = C
+    StoreConstants, // Arrays[A] = the Arrays[A].Size constant registers starting at B
+    Print,          // prints A
+    PrintText,      // prints Strings[A]
+    Exit,           // ends the program with status A
+    Jump,           // to instruction C
+    JumpIfZero,     // to C if A == 0
+    JumpIfNotZero,  // to C if A != 0
+    // superinstructions, formed by Bytecode::Fuse
+    JumpIfLt, // to C if A cmp B: a comparison and the branch on its result
+    JumpIfLe,
+    JumpIfGt,
+    JumpIfGe,
+    JumpIfEq,
+    JumpIfNe,
+    IncrementJumpIfNotZero, // A += B, then to C if A != 0: the update and test at the bottom of a loop
+    DecrementJumpIfNotZero, // A -= B, then to C if A != 0
+    Count
+};
+
+struct Instruction {
+    Opcode Op;
+    uint32_t A = 0;
+    uint32_t B = 0;
+    uint32_t C = 0;
+};
+
+struct BytecodeArray {
+    uint32_t Base; // register of element 0
+    uint32_t Size;
+};
+
+struct Bytecode {
+    uint32_t FrameSlots = 1; // register 0 is never a slot
+    uint32_t ConstantBase = 1;
+    std::vector<int64_t> Constants;
+    std::vector<BytecodeArray> Arrays;
+    std::vector<std::string> Strings;
+    std::vector<Instruction> Code;
+
+    // 256 MB of registers: a frame of at most MaxFrameSlots, and the rest for temporaries and constants
+    static constexpr uint64_t MaxRegisters = uint64_t(1) << 25;
+
+    uint64_t RegisterCount() const { return uint64_t{ ConstantBase } + Constants.size(); }
+
+    // Replaces common instruction pairs with superinstructions; returns how many were formed.
+    int Fuse();
+
+    // A compact binary format in host byte order, for running a compiled program again later.
+    // Deserialize checks every register, array, string and jump target, so the VM needs no checks of
+    // its own; it throws CompileError on a malformed file.
+    std::string Serialize() const;
+    static Bytecode Deserialize(std::string_view data);
+    static bool IsSerialized(std::string_view data); // starts with the file signature
+};
+
+} // namespace Compiler
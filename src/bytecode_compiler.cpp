@@ -0,0 +1,246 @@
+#include "bytecode_compiler.h"
+#include "ast_visitor.h"
+#include <format>
+
+namespace Compiler {
+
+static Opcode ToOpcode(BinaryOp op) {
+    switch (op) {
+        case BinaryOp::Add: return Opcode::Add;
+        case BinaryOp::Sub: return Opcode::Sub;
+        case BinaryOp::Mul: return Opcode::Mul;
+        case BinaryOp::Div: return Opcode::Div;
+        case BinaryOp::Mod: return Opcode::Mod;
+        case BinaryOp::Gt: return Opcode::Gt;
+        case BinaryOp::Ge: return Opcode::Ge;
+        case BinaryOp::Lt: return Opcode::Lt;
+        case BinaryOp::Le: return Opcode::Le;
+        case BinaryOp::Eq: return Opcode::Eq;
+        case BinaryOp::Ne: return Opcode::Ne;
+    }
+    return Opcode::Count;
+}
+
+BytecodeCompiler::BytecodeCompiler(Program* program, const Options& options)
+    : m_Program(program), m_Options(options) {}
+
+Bytecode BytecodeCompiler::Compile() {
+    m_Code = Bytecode{};
+    m_Constants.clear();
+    m_Arrays.clear();
+    m_Assigning.clear();
+    m_Code.FrameSlots = static_cast<uint32_t>(m_Program->FrameSize / 8) + 1;
+    m_NextTemporary = m_MaxTemporary = m_Code.FrameSlots;
+
+    VisitStatementExpressions(m_Program->GlobalBlock, [&](Expression* expr) { FindAssignments(expr); });
+
+    Statement program(m_Program->GlobalBlock, SourceLocation{});
+    CompileStatement(&program);
+    Emit(Opcode::Exit, Constant(0));
+
+    m_Code.ConstantBase = m_MaxTemporary;
+    if (m_Code.RegisterCount() > Bytecode::MaxRegisters) {
+        Error(std::format("The program needs more than the {} registers of the VM", Bytecode::MaxRegisters));
+    }
+    for (Instruction& ins : m_Code.Code) {
+        for (uint32_t* operand : { &ins.A, &ins.B, &ins.C }) {
+            if (*operand & ConstantFlag) {
+                *operand = m_Code.ConstantBase + (*operand & ~ConstantFlag);
+            }
+        }
+    }
+    m_Code.Fuse();
+    return std::move(m_Code);
+}
+
+template <typename Expr>
+bool BytecodeCompiler::FindAssignments(const Expr* expr) {
+    bool assigns = false;
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        const AssignmentExpression* assign = expr->Expr;
+        assigns = static_cast<bool>(assign->Ident);
+        assigns |= assign->Index && FindAssignments(assign->Index.Get());
+        assigns |= FindAssignments(assign->Expr.Get());
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        assigns = FindAssignments(expr->Prim.Get());
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        if (const auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            assigns = FindAssignments<Expression>(*inner);
+        } else if (expr->Index) {
+            assigns = FindAssignments<Expression>(expr->Index);
+        }
+    } else {
+        assigns = FindAssignments(expr->Left.Get());
+        for (const auto& [op, right] : expr->Right) {
+            assigns |= FindAssignments(right.Get());
+        }
+    }
+    if (assigns) {
+        m_Assigning.insert(expr);
+    }
+    return assigns;
+}
+
+// Returns the register holding the value. With a target, the last operation writes it there directly.
+template <typename Expr>
+uint32_t BytecodeCompiler::CompileExpression(const Expr* expr, std::optional<uint32_t> target) {
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        const AssignmentExpression* assign = expr->Expr;
+        if (!assign->Ident) {
+            return CompileExpression(assign->Expr.Get(), target);
+        }
+        if (!assign->Index) {
+            const uint32_t variable = Register(assign->Decl);
+            const uint32_t value = CompileExpression(assign->Expr.Get(), variable);
+            if (value != variable) {
+                Emit(Opcode::Move, variable, value);
+            }
+            if (m_Options.Trace && !assign->Silent) {
+                Emit(Opcode::Print, variable);
+            }
+            return variable;
+        }
+
+        // the generated code takes the index before it computes the value
+        uint32_t index = CompileExpression(assign->Index.Get());
+        if (index < m_Code.FrameSlots && m_Assigning.contains(assign->Expr)) {
+            const uint32_t copy = NewTemporary();
+            Emit(Opcode::Move, copy, index);
+            index = copy;
+        }
+        const uint32_t value = CompileExpression(assign->Expr.Get());
+        Emit(Opcode::StoreElement, Array(assign->Decl), index, value);
+        if (m_Options.Trace) {
+            Emit(Opcode::Print, value);
+        }
+        return value;
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        return CompileExpression(expr->Prim.Get(), target); // like the generator, ignores call arguments
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        if (const auto* i = std::get_if<int64_t>(&expr->Value)) {
+            return Constant(*i);
+        } else if (const auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            return CompileExpression<Expression>(*inner, target);
+        } else if (!expr->Index) {
+            return Register(expr->Decl);
+        }
+        const uint32_t index = CompileExpression<Expression>(expr->Index);
+        const uint32_t result = target ? *target : NewTemporary();
+        Emit(Opcode::LoadElement, result, Array(expr->Decl), index);
+        return result;
+    } else {
+        if (expr->Right.empty()) {
+            return CompileExpression(expr->Left.Get(), target);
+        }
+        const uint32_t result = NewTemporary();
+        uint32_t left = CompileExpression(expr->Left.Get());
+        for (size_t i = 0; i < expr->Right.size(); ++i) {
+            const auto& [op, right] = expr->Right[i];
+            // the generated code has the left value on its stack already, whatever the right side assigns
+            if (left < m_Code.FrameSlots && m_Assigning.contains(right)) {
+                Emit(Opcode::Move, result, left);
+                left = result;
+            }
+            const uint32_t rhs = CompileExpression(right.Get());
+            const uint32_t into = i + 1 == expr->Right.size() ? target.value_or(result) : result;
+            Emit(ToOpcode(op), into, left, rhs);
+            left = into;
+            m_NextTemporary = result + 1;
+        }
+        return left;
+    }
+}
+
+void BytecodeCompiler::CompileStatement(const Statement* stmt) {
+    m_NextTemporary = m_Code.FrameSlots; // temporaries never outlive a statement's own expressions
+    std::visit(overloaded{ [&](const ExpressionStatement* exprStmt) {
+                              CompileExpression(exprStmt->Expr.Get());
+                          },
+                   [&](const ReturnStatement* retStmt) {
+                       Emit(Opcode::Exit, retStmt->Expr ? CompileExpression(retStmt->Expr.Get()) : Constant(0));
+                   },
+                   [&](const IfStatement* ifStmt) {
+                       const size_t skipThen = Emit(Opcode::JumpIfZero, CompileExpression(ifStmt->Cond.Get()));
+                       CompileStatement(ifStmt->Then);
+                       if (ifStmt->Else) {
+                           const size_t skipElse = Emit(Opcode::Jump);
+                           PatchJump(skipThen);
+                           CompileStatement(ifStmt->Else);
+                           PatchJump(skipElse);
+                       } else {
+                           PatchJump(skipThen);
+                       }
+                   },
+                   [&](const WhileStatement* whileStmt) {
+                       const size_t skipLoop =
+                           Emit(Opcode::JumpIfZero, CompileExpression(whileStmt->Cond.Get()));
+                       const size_t body = m_Code.Code.size();
+                       CompileStatement(whileStmt->Loop);
+                       m_NextTemporary = m_Code.FrameSlots;
+                       Emit(Opcode::JumpIfNotZero, CompileExpression(whileStmt->Cond.Get()), 0,
+                           static_cast<uint32_t>(body));
+                       PatchJump(skipLoop);
+                   },
+                   [&](const Block* block) {
+                       for (const BlockItem* item : block->Items) {
+                           if (auto* inner = std::get_if<Ref<Statement>>(&item->Item)) {
+                               CompileStatement(*inner);
+                           }
+                       }
+                   },
+                   [&](const PrecomputedStatement* precomputed) { CompilePrecomputed(precomputed); } },
+        stmt->Stmt);
+}
+
+void BytecodeCompiler::CompilePrecomputed(const PrecomputedStatement* precomputed) {
+    if (!precomputed->Output.empty()) {
+        m_Code.Strings.emplace_back(precomputed->Output.begin(), precomputed->Output.end());
+        Emit(Opcode::PrintText, static_cast<uint32_t>(m_Code.Strings.size() - 1));
+    }
+    for (const PrecomputedStatement::Value& value : precomputed->Values) {
+        if (value.Decl->Size == 0) {
+            Emit(Opcode::Move, Register(value.Decl), Constant(value.Elements[0]));
+            continue;
+        }
+        // the elements as consecutive constants, without sharing any of them
+        const uint32_t first = static_cast<uint32_t>(m_Code.Constants.size()) | ConstantFlag;
+        m_Code.Constants.insert(m_Code.Constants.end(), value.Elements.begin(), value.Elements.end());
+        Emit(Opcode::StoreConstants, Array(value.Decl), first);
+    }
+    if (precomputed->ExitCode) {
+        Emit(Opcode::Exit, Constant(*precomputed->ExitCode));
+    }
+}
+
+size_t BytecodeCompiler::Emit(Opcode op, uint32_t a, uint32_t b, uint32_t c) {
+    m_Code.Code.push_back({ op, a, b, c });
+    return m_Code.Code.size() - 1;
+}
+
+void BytecodeCompiler::PatchJump(size_t jump) {
+    m_Code.Code[jump].C = static_cast<uint32_t>(m_Code.Code.size());
+}
+
+uint32_t BytecodeCompiler::NewTemporary() {
+    m_MaxTemporary = std::max(m_MaxTemporary, m_NextTemporary + 1);
+    return m_NextTemporary++;
+}
+
+uint32_t BytecodeCompiler::Constant(int64_t value) {
+    auto [it, added] = m_Constants.try_emplace(value, static_cast<uint32_t>(m_Code.Constants.size()));
+    if (added) {
+        m_Code.Constants.push_back(value);
+    }
+    return it->second | ConstantFlag;
+}
+
+uint32_t BytecodeCompiler::Array(const Declaration* decl) {
+    const std::pair<uint32_t, uint32_t> key{ Register(decl), static_cast<uint32_t>(decl->Size) };
+    auto [it, added] = m_Arrays.try_emplace(key, static_cast<uint32_t>(m_Code.Arrays.size()));
+    if (added) {
+        m_Code.Arrays.push_back({ key.first, key.second });
+    }
+    return it->second;
+}
+
+} // namespace Compiler
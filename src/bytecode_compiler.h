@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ast.h"
+#include "bytecode.h"
+#include "options.h"
+#include <map>
+#include <optional>
+#include <unordered_set>
+
+namespace Compiler {
+
+// The second backend next to Generator: compiles the program into Bytecode for the VirtualMachine.
+// Variables keep their frame slots as registers, and every subexpression gets a temporary register
+// unless it already is one. Loops test at the top once and at the bottom on every iteration, so the
+// bottom test can fuse with the loop's last instruction (see Bytecode::Fuse).
+class BytecodeCompiler {
+  public:
+    BytecodeCompiler(Program* program, const Options& options);
+    Bytecode Compile(); // needs the frame layout
+
+  private:
+    template <typename Expr>
+    bool FindAssignments(const Expr* expr);
+
+    template <typename Expr>
+    uint32_t CompileExpression(const Expr* expr, std::optional<uint32_t> target = std::nullopt);
+    void CompileStatement(const Statement* stmt);
+    void CompilePrecomputed(const PrecomputedStatement* precomputed);
+
+    size_t Emit(Opcode op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0); // returns the instruction index
+    void PatchJump(size_t jump);                                              // to the next instruction
+    uint32_t NewTemporary();
+    uint32_t Constant(int64_t value);
+    uint32_t Array(const Declaration* decl);
+    static uint32_t Register(const Declaration* decl) { return static_cast<uint32_t>(decl->Offset / 8); }
+
+    Program* m_Program;
+    const Options& m_Options;
+    Bytecode m_Code;
+
+    // constants are numbered with ConstantFlag until the number of temporaries is known
+    static constexpr uint32_t ConstantFlag = 1u << 31;
+    std::map<int64_t, uint32_t> m_Constants;
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> m_Arrays; // (base, size) -> index
+    uint32_t m_NextTemporary = 0;
+    uint32_t m_MaxTemporary = 0;
+
+    // expressions with an assignment inside: a variable read before them has to be copied first
+    std::unordered_set<const void*> m_Assigning;
+};
+
+} // namespace Compiler
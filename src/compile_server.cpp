@@ -0,0 +1,249 @@
+#include "compile_server.h"
+#include "driver.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace Compiler {
+
+CompileServer::CompileServer(std::string socketPath, unsigned workers)
+    : m_SocketPath(std::move(socketPath)), m_Workers(std::max(workers, MinWorkers)) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (m_SocketPath.size() >= sizeof(address.sun_path)) {
+        Error("Socket path too long: " + m_SocketPath);
+    }
+    std::memcpy(address.sun_path, m_SocketPath.c_str(), m_SocketPath.size() + 1);
+
+    m_Listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_Listener < 0) {
+        Error(std::format("Failed to create socket: {}", std::strerror(errno)));
+    }
+    unlink(m_SocketPath.c_str()); // left behind by a server that did not shut down cleanly
+    if (bind(m_Listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(m_Listener, SOMAXCONN) < 0) {
+        Error(std::format("Failed to listen on {}: {}", m_SocketPath, std::strerror(errno)));
+    }
+}
+
+CompileServer::~CompileServer() {
+    if (m_Listener >= 0) {
+        close(m_Listener);
+        unlink(m_SocketPath.c_str());
+    }
+}
+
+void CompileServer::Run() {
+    std::cout << std::format("Listening on {} with {} workers\n", m_SocketPath, m_Workers) << std::flush;
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < m_Workers; ++i) {
+        threads.emplace_back([this] { Serve(); });
+    }
+    Serve();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    Error(std::format("Failed to accept connections on {}: {}", m_SocketPath, std::strerror(m_AcceptError)));
+}
+
+// false when reading fails or the client has not shut down its side by the deadline (errno ETIMEDOUT)
+static bool ReadAll(int fd, std::string& out, std::chrono::steady_clock::time_point deadline) {
+    char buffer[64 * 1024];
+    while (true) {
+        const auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd ready{ fd, POLLIN, 0 };
+        const int polled = poll(&ready, 1, static_cast<int>(std::max<int64_t>(left.count(), 0)));
+        if (polled == 0) {
+            errno = ETIMEDOUT;
+            return false;
+        } else if (polled < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        const ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n == 0) {
+            return true;
+        } else if (n < 0 && errno != EINTR) {
+            return false;
+        } else if (n > 0) {
+            out.append(buffer, static_cast<size_t>(n));
+        }
+    }
+}
+
+static void WriteAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        const ssize_t n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno != EINTR) {
+            return; // the client went away, or stopped reading for longer than SO_SNDTIMEO
+        } else if (n > 0) {
+            data.remove_prefix(static_cast<size_t>(n));
+        }
+    }
+}
+
+void CompileServer::Serve() {
+    ArenaAllocator arena(ArenaChunkSize);
+    std::string request;
+    std::string source;
+    std::string response;
+
+    while (true) {
+        const int client = accept4(m_Listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue; // a connection that was reset before it was accepted
+            }
+            // anything else fails again right away: stop every worker rather than spin
+            int none = 0;
+            m_AcceptError.compare_exchange_strong(none, errno);
+            shutdown(m_Listener, SHUT_RDWR); // wakes the workers blocked in accept
+            return;
+        }
+        const timeval timeout{ RequestTimeout.count(), 0 };
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        request.clear();
+        if (!ReadAll(client, request, std::chrono::steady_clock::now() + RequestTimeout)) {
+            if (errno == ETIMEDOUT) {
+                CompileResult failed;
+                failed.Diagnostics = std::format("The request was not complete within {}\n", RequestTimeout);
+                Respond(failed, response);
+                WriteAll(client, response);
+            }
+        } else {
+            try {
+                Handle(request, arena, source, response);
+            } catch (const CompileError& e) { // an invalid flag value
+                CompileResult failed;
+                failed.Diagnostics = std::string(e.what()) + "\n";
+                Respond(failed, response);
+            } catch (const std::exception& e) { // out of memory: only this request fails
+                CompileResult failed;
+                failed.Diagnostics = std::format("Internal error: {}\n", e.what());
+                Respond(failed, response);
+            }
+            WriteAll(client, response);
+        }
+        close(client);
+    }
+}
+
+void CompileServer::Handle(const std::string& request, ArenaAllocator& arena, std::string& source,
+                           std::string& response) {
+    const size_t lineEnd = std::min(request.find('\n'), request.size());
+    const std::string_view arguments(request.data(), lineEnd);
+
+    Options options;
+    options.LexThreads = 1; // the workers already keep every core busy
+    std::string path;
+    CompileResult result;
+    bool incremental = false;
+    std::optional<std::pair<size_t, size_t>> edit; // offset and length
+    for (size_t start = 0; start < arguments.size();) {
+        const size_t end = std::min(arguments.find(' ', start), arguments.size());
+        const std::string_view arg = arguments.substr(start, end - start);
+        start = end + 1;
+        if (arg.empty()) {
+            continue;
+        } else if (!arg.starts_with('-') && path.empty()) {
+            path = arg;
+        } else if (arg == "--incremental") {
+            incremental = true;
+        } else if (arg.starts_with("--edit=")) {
+            const std::string_view value = arg.substr(arg.find('=') + 1);
+            const char* last = value.data() + value.size();
+            size_t offset = 0;
+            size_t length = 0;
+            std::from_chars_result parsed = std::from_chars(value.data(), last, offset);
+            if (parsed.ec == std::errc() && parsed.ptr != last && *parsed.ptr == ',') {
+                parsed = std::from_chars(parsed.ptr + 1, last, length);
+            }
+            if (parsed.ec != std::errc() || parsed.ptr != last) {
+                result.Diagnostics += std::format("Invalid edit: {}\n", value);
+            }
+            edit.emplace(offset, length);
+        } else if (!ParseOption(arg, options)) {
+            result.Diagnostics += std::format("Unknown option: {}\n", arg);
+        }
+    }
+
+    if (edit) {
+        std::shared_ptr<Session> session;
+        {
+            std::lock_guard lock(m_SessionsMutex);
+            auto found = m_Sessions.find(path);
+            if (found != m_Sessions.end()) {
+                session = found->second;
+                session->LastUse = ++m_Uses;
+            }
+        }
+        if (!session) {
+            result.Diagnostics += "No incremental compilation of '" + path + "' to edit\n";
+        }
+        if (result.Diagnostics.empty()) {
+            const std::string_view text = std::string_view(request).substr(std::min(lineEnd + 1, request.size()));
+            std::lock_guard lock(session->Mutex);
+            result = session->Compiler.Edit(edit->first, edit->second, text);
+        }
+        Respond(result, response);
+        return;
+    }
+
+    source.clear();
+    if (!path.empty()) {
+        std::ifstream inputFile(path, std::ios::in);
+        if (!inputFile) {
+            result.Diagnostics += "Failed to open file: " + path + "\n";
+        }
+        source.assign(std::istreambuf_iterator<char>(inputFile), std::istreambuf_iterator<char>());
+    } else if (lineEnd < request.size()) {
+        source.assign(request, lineEnd + 1);
+    }
+    source += '\n';
+
+    if (result.Diagnostics.empty() && incremental && !path.empty()) {
+        auto session = std::make_shared<Session>(options); // throws before replacing a session if rejected
+        std::lock_guard lock(session->Mutex);
+        {
+            std::lock_guard sessionsLock(m_SessionsMutex);
+            if (m_Sessions.size() >= MaxSessions && !m_Sessions.contains(path)) {
+                // the session edited least recently goes
+                m_Sessions.erase(std::min_element(m_Sessions.begin(), m_Sessions.end(),
+                    [](const auto& a, const auto& b) { return a.second->LastUse < b.second->LastUse; }));
+            }
+            session->LastUse = ++m_Uses;
+            m_Sessions[path] = session;
+        }
+        result = session->Compiler.Compile(source);
+    } else if (result.Diagnostics.empty()) {
+        if (!path.empty()) {
+            std::lock_guard lock(m_SessionsMutex);
+            m_Sessions.erase(path); // the client compiles the file as a whole again
+        }
+        result = Compile(source, options, arena);
+    }
+    Respond(result, response);
+}
+
+void CompileServer::Respond(const CompileResult& result, std::string& response) {
+    response = std::format("{} {} {}\n", result.Success ? "ok" : "error", result.Output.size(),
+        result.Diagnostics.size());
+    response += result.Output;
+    response += result.Diagnostics;
+}
+
+} // namespace Compiler
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "incremental_compiler.h"
+#include "options.h"
+#include "utils.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace Compiler {
+
+// Serves compilations over a Unix domain socket, one request per connection. The client sends a line
+// of compiler flags, optionally ending in the path of the source file; without a path, the source is
+// the rest of the request. After the client shuts down its side, the server answers
+//     ok|error <assembly bytes> <diagnostic bytes>\n<assembly><diagnostics>
+// where --emit-bytecode gets serialized bytecode in place of the assembly.
+// With --incremental, the server keeps what it compiled from the path for later edits to it: a request
+// of `--edit=OFFSET,LENGTH <path>` followed by text replaces LENGTH bytes at OFFSET of that source and
+// compiles again, with the flags of the --incremental request, reparsing and regenerating only what the
+// edit touched (IncrementalCompiler, which takes -O0 only). Compiling the path without --incremental
+// drops what was kept for it; past MaxSessions paths, the one edited least recently is dropped.
+// Every worker thread accepts connections on its own and keeps its arena and buffers between requests.
+// There are at least MinWorkers of them, however few the cores, since a worker waits for its client to
+// finish the request: for up to RequestTimeout, after which the client gets an error.
+class CompileServer {
+  public:
+    CompileServer(std::string socketPath, unsigned workers);
+    ~CompileServer();
+
+    CompileServer(const CompileServer&) = delete;
+    CompileServer& operator=(const CompileServer&) = delete;
+
+    [[noreturn]] void Run(); // serves until accepting connections fails, then throws CompileError
+
+  private:
+    static constexpr unsigned MinWorkers = 8;
+    static constexpr std::chrono::seconds RequestTimeout{ 10 };
+
+    void Serve(); // returns once accepting fails for good
+    void Handle(const std::string& request, ArenaAllocator& arena, std::string& source,
+                std::string& response);
+    static void Respond(const CompileResult& result, std::string& response);
+
+    // edits to one source are compiled one at a time
+    struct Session {
+        explicit Session(const Options& options) : Compiler(options) {}
+        std::mutex Mutex;
+        IncrementalCompiler Compiler;
+        uint64_t LastUse = 0; // under m_SessionsMutex
+    };
+    static constexpr size_t MaxSessions = 64;
+
+    const std::string m_SocketPath;
+    const unsigned m_Workers;
+    int m_Listener = -1;
+    std::atomic<int> m_AcceptError = 0; // errno of the first accept that failed for good
+
+    std::mutex m_SessionsMutex;
+    std::unordered_map<std::string, std::shared_ptr<Session>> m_Sessions; // by path
+    uint64_t m_Uses = 0;
+};
+
+} // namespace Compiler
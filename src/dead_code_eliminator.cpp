@@ -0,0 +1,358 @@
+#include "dead_code_eliminator.h"
+#include "ast_visitor.h"
+#include <algorithm>
+
+namespace Compiler {
+
+// `x = x` with nothing else on the right-hand side
+static bool IsSelfAssignment(const AssignmentExpression* assign) {
+    const EqualityExpression* eq = assign->Expr;
+    if (assign->Index || !eq->Right.empty() || !eq->Left->Right.empty() || !eq->Left->Left->Right.empty() ||
+        !eq->Left->Left->Left->Right.empty()) {
+        return false;
+    }
+    const Primary* primary = eq->Left->Left->Left->Left->Prim;
+    return std::holds_alternative<Name>(primary->Value) && !primary->Index && primary->Decl == assign->Decl;
+}
+
+// Assignments, and what may fault, which the program dies of: an element read at an index that is not
+// constant (constant ones are checked to be in bounds), and a division or remainder unless the divisor is a
+// constant other than 0 and -1 (INT64_MIN / -1 faults as well)
+template <typename Expr>
+static bool HasSideEffects(const Expr* expr) {
+    if (!expr) {
+        return false;
+    }
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        const AssignmentExpression* assign = expr->Expr;
+        return assign->Ident || HasSideEffects(assign->Index.Get()) || HasSideEffects(assign->Expr.Get());
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        return HasSideEffects(expr->Prim.Get());
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        if (const auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            return HasSideEffects(inner->Get());
+        }
+        return expr->Index && (!FoldConstant(expr->Index.Get()) || HasSideEffects(expr->Index.Get()));
+    } else {
+        if (HasSideEffects(expr->Left.Get())) {
+            return true;
+        }
+        for (const auto& [op, right] : expr->Right) {
+            if (op == BinaryOp::Div || op == BinaryOp::Mod) {
+                const std::optional<int64_t> divisor = FoldConstant(right.Get());
+                if (!divisor || *divisor == 0 || *divisor == -1) {
+                    return true;
+                }
+            }
+            if (HasSideEffects(right.Get())) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+DeadCodeEliminator::DeadCodeEliminator(Program* program, ArenaAllocator& allocator, const Options& options)
+    : m_Program(program), m_Allocator(allocator), m_Options(options) {}
+
+int DeadCodeEliminator::PruneUnreachable() {
+    m_Removed = 0;
+    do {
+        m_Changed = false;
+        PruneBlock(m_Program->GlobalBlock);
+    } while (m_Changed);
+    return m_Removed;
+}
+
+int DeadCodeEliminator::EliminateDeadStores() {
+    m_Removed = 0;
+    do {
+        m_Changed = false;
+        LiveSet live; // nothing is observed after the program exits
+        LiveBlock(m_Program->GlobalBlock, live);
+
+        PruneBlock(m_Program->GlobalBlock);
+    } while (m_Changed);
+
+    // stores that stay because their value is still printed
+    VisitStatementExpressions(m_Program->GlobalBlock, [&](Expression* expr) {
+        VisitExpression(expr, overloaded{ [&](AssignmentExpression* assign) {
+                                             if (assign->DeadStore) {
+                                                 Report(assign->Location,
+                                                     "removed dead store to '" + std::string(assign->Ident) + "'");
+                                             }
+                                         },
+                                  [](Primary*) {} });
+    });
+    return m_Removed;
+}
+
+int DeadCodeEliminator::RemoveUnusedVariables() {
+    m_Removed = 0;
+    LiveSet read;
+    VisitStatementExpressions(m_Program->GlobalBlock, [&](Expression* expr) {
+        VisitExpression(expr, overloaded{ [&](Primary* primary) {
+                                             if (primary->Decl) {
+                                                 read.insert(primary->Decl);
+                                             }
+                                         },
+                                  [&](AssignmentExpression* assign) {
+                                      if (assign->Index) {
+                                          read.insert(assign->Decl); // an element store needs the slots
+                                      }
+                                  } });
+    });
+
+    if (RemoveUnusedDeclarations(m_Program->GlobalBlock, read)) {
+        // the assignments left compute a value that is printed or may fault, but store nothing
+        VisitStatementExpressions(m_Program->GlobalBlock, [&](Expression* expr) {
+            VisitExpression(expr, overloaded{ [&](AssignmentExpression* assign) {
+                                                 assign->DeadStore |= !read.contains(assign->Decl);
+                                             },
+                                      [](Primary*) {} });
+        });
+    }
+    return m_Removed;
+}
+
+void DeadCodeEliminator::Report(SourceLocation loc, const std::string& msg) {
+    m_Removed++;
+    if (m_Options.Verbose) {
+        Note(loc, "dce: " + msg);
+    }
+}
+
+// Returns true when control never reaches the end of the block.
+bool DeadCodeEliminator::PruneBlock(Block* block) {
+    bool exits = false;
+
+    auto it = block->Items.begin();
+    while (it != block->Items.end()) {
+        if (exits) {
+            std::visit(overloaded{ [&](Statement* stmt) { Report(stmt->Location, "removed unreachable statement"); },
+                           [&](Declaration* decl) {
+                               Report(decl->Location,
+                                   "removed unreachable declaration '" + std::string(decl->Ident) + "'");
+                           } },
+                (*it)->Item);
+            it = block->Items.erase(it);
+            m_Changed = true;
+            continue;
+        }
+
+        if (auto* stmt = std::get_if<Ref<Statement>>(&(*it)->Item)) {
+            exits = PruneStatement(*stmt);
+
+            auto* inner = std::get_if<Ref<Block>>(&(*stmt)->Stmt);
+            if (inner && (*inner)->Items.empty()) {
+                it = block->Items.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+
+    return exits;
+}
+
+void DeadCodeEliminator::RemoveStatement(Statement* stmt) {
+    stmt->Stmt = m_Allocator.alloc<Block>();
+    m_Changed = true;
+}
+
+// Returns true when control never reaches the statement that follows stmt.
+bool DeadCodeEliminator::PruneStatement(Statement* stmt) {
+    return std::visit(
+        overloaded{ [&](ExpressionStatement* exprStmt) {
+                       const AssignmentExpression* assign = exprStmt->Expr->Expr;
+                       if (!HasSideEffects(exprStmt->Expr.Get())) {
+                           Report(stmt->Location, "removed expression statement without effect");
+                           RemoveStatement(stmt);
+                       } else if (!m_Options.Trace && assign->DeadStore && !HasSideEffects(assign->Index.Get()) &&
+                                  !HasSideEffects(assign->Expr.Get())) {
+                           Report(stmt->Location, "removed dead store to '" + std::string(assign->Ident) + "'");
+                           RemoveStatement(stmt);
+                       }
+                       return false;
+                   },
+            [&](ReturnStatement*) { return true; },
+            [&](IfStatement* ifStmt) {
+                if (const auto cond = FoldConstant(ifStmt->Cond.Get())) {
+                    Statement* taken = *cond ? ifStmt->Then : ifStmt->Else;
+                    Report(stmt->Location, std::string("removed never taken ") + (*cond ? "else" : "then") + " branch");
+                    if (taken) {
+                        stmt->Stmt = taken->Stmt;
+                        return PruneStatement(stmt);
+                    }
+                    RemoveStatement(stmt);
+                    return false;
+                }
+
+                const bool thenExits = PruneStatement(ifStmt->Then);
+                const bool elseExits = ifStmt->Else && PruneStatement(ifStmt->Else);
+
+                auto isEmpty = [](const Statement* s) {
+                    const auto* block = std::get_if<Ref<Block>>(&s->Stmt);
+                    return block && (*block)->Items.empty();
+                };
+                if (ifStmt->Else && isEmpty(ifStmt->Else)) {
+                    ifStmt->Else = nullptr;
+                }
+                if (!ifStmt->Else && isEmpty(ifStmt->Then) && !HasSideEffects(ifStmt->Cond.Get())) {
+                    Report(stmt->Location, "removed empty if statement");
+                    RemoveStatement(stmt);
+                    return false;
+                }
+                return thenExits && elseExits;
+            },
+            [&](WhileStatement* whileStmt) {
+                const auto cond = FoldConstant(whileStmt->Cond.Get());
+                if (cond && *cond == 0) {
+                    Report(stmt->Location, "removed loop that never runs");
+                    RemoveStatement(stmt);
+                    return false;
+                }
+                PruneStatement(whileStmt->Loop);
+                return cond.has_value(); // a constant non-zero condition never falls through
+            },
+            [&](Block* block) { return PruneBlock(block); },
+            [&](PrecomputedStatement* precomputed) { return precomputed->ExitCode.has_value(); } },
+        stmt->Stmt);
+}
+
+template <typename Expr>
+void DeadCodeEliminator::LiveExpression(Expr* expr, LiveSet& live) {
+    // walks the evaluation order backwards: an assignment is evaluated after its right-hand side
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        AssignmentExpression* assign = expr->Expr;
+        if (assign->Ident) {
+            assign->DeadStore = !live.contains(assign->Decl) || IsSelfAssignment(assign);
+            if (!assign->Index) { // an element store leaves the rest of the array live
+                live.erase(assign->Decl);
+            }
+        }
+        LiveExpression(assign->Expr.Get(), live);
+        if (assign->Index) {
+            LiveExpression(assign->Index.Get(), live);
+        }
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        LiveExpression(expr->Prim.Get(), live);
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        if (auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            LiveExpression(inner->Get(), live);
+        } else if (expr->Decl) {
+            live.insert(expr->Decl);
+            if (expr->Index) {
+                LiveExpression(expr->Index.Get(), live);
+            }
+        }
+    } else {
+        for (auto it = expr->Right.rbegin(); it != expr->Right.rend(); ++it) {
+            LiveExpression(it->second.Get(), live);
+        }
+        LiveExpression(expr->Left.Get(), live);
+    }
+}
+
+void DeadCodeEliminator::LiveStatement(Statement* stmt, LiveSet& live) {
+    std::visit(overloaded{ [&](ExpressionStatement* exprStmt) { LiveExpression(exprStmt->Expr.Get(), live); },
+                   [&](ReturnStatement* retStmt) {
+                       live.clear(); // the program exits here
+                       if (retStmt->Expr) {
+                           LiveExpression(retStmt->Expr.Get(), live);
+                       }
+                   },
+                   [&](IfStatement* ifStmt) {
+                       LiveSet elseLive = live;
+                       LiveStatement(ifStmt->Then, live);
+                       if (ifStmt->Else) {
+                           LiveStatement(ifStmt->Else, elseLive);
+                       }
+                       live.insert(elseLive.begin(), elseLive.end());
+                       LiveExpression(ifStmt->Cond.Get(), live);
+                   },
+                   [&](WhileStatement* whileStmt) {
+                       // iterate to the fixed point of head = cond(out + body(head)); the body is walked
+                       // last with the final head set, so its dead store marks are the right ones
+                       LiveSet head = live;
+                       LiveExpression(whileStmt->Cond.Get(), head);
+                       while (true) {
+                           LiveSet next = head;
+                           LiveStatement(whileStmt->Loop, next);
+                           next.insert(live.begin(), live.end());
+                           LiveExpression(whileStmt->Cond.Get(), next);
+                           if (next == head) {
+                               break;
+                           }
+                           head = std::move(next);
+                       }
+                       live = std::move(head);
+                   },
+                   [&](Block* block) { LiveBlock(block, live); },
+                   [&](PrecomputedStatement* precomputed) {
+                       if (precomputed->ExitCode) {
+                           live.clear();
+                       }
+                       // the values overwrite whole variables, arrays included
+                       erase_if(precomputed->Values, [&](const PrecomputedStatement::Value& value) {
+                           if (live.erase(value.Decl) != 0) {
+                               return false;
+                           }
+                           Report(stmt->Location,
+                               "removed dead store to '" + std::string(value.Decl->Ident) + "'");
+                           return true;
+                       });
+                   } },
+        stmt->Stmt);
+}
+
+void DeadCodeEliminator::LiveBlock(Block* block, LiveSet& live) {
+    for (auto it = block->Items.rbegin(); it != block->Items.rend(); ++it) {
+        std::visit(overloaded{ [&](Statement* stmt) { LiveStatement(stmt, live); },
+                       [&](Declaration* decl) { live.erase(decl); } },
+            (*it)->Item);
+    }
+}
+
+bool DeadCodeEliminator::RemoveUnusedDeclarations(Block* block, const LiveSet& read) {
+    bool removed = false;
+
+    erase_if(block->Items, [&](BlockItem* item) {
+        if (auto* stmt = std::get_if<Ref<Statement>>(&item->Item)) {
+            removed |= RemoveUnusedDeclarations(*stmt, read);
+            return false;
+        }
+
+        Declaration* decl = std::get<Ref<Declaration>>(item->Item);
+        if (read.contains(decl)) {
+            return false;
+        }
+        Report(decl->Location, "removed unused variable '" + std::string(decl->Ident) + "'");
+        decl->Offset = 0; // no slot: what is still assigned to it is a dead store, which stores nothing
+        removed = true;
+        return true;
+    });
+
+    return removed;
+}
+
+bool DeadCodeEliminator::RemoveUnusedDeclarations(Statement* stmt, const LiveSet& read) {
+    return std::visit(overloaded{ [&](IfStatement* ifStmt) {
+                                     const bool thenRemoved = RemoveUnusedDeclarations(ifStmt->Then, read);
+                                     const bool elseRemoved =
+                                         ifStmt->Else && RemoveUnusedDeclarations(ifStmt->Else, read);
+                                     return thenRemoved || elseRemoved;
+                                 },
+                          [&](WhileStatement* whileStmt) { return RemoveUnusedDeclarations(whileStmt->Loop, read); },
+                          [&](Block* inner) { return RemoveUnusedDeclarations(inner, read); },
+                          [&](PrecomputedStatement* precomputed) {
+                              erase_if(precomputed->Values, [&](const PrecomputedStatement::Value& value) {
+                                  return !read.contains(value.Decl);
+                              });
+                              return false;
+                          },
+                          [](ExpressionStatement*) { return false; }, [](ReturnStatement*) { return false; } },
+        stmt->Stmt);
+}
+
+} // namespace Compiler
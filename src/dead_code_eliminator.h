@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+#include "utils.h"
+#include <unordered_set>
+
+namespace Compiler {
+
+// Removes code whose effect can never be observed. Observable effects are the value printed after
+// every assignment, the exit code and the faults that end a program early (a division by zero, an
+// element read out of bounds), so while tracing is on a dead store keeps computing and printing its
+// value and only drops the write to its frame slot, and a computation that may fault stays.
+//  - PruneUnreachable: unreachable statements (after a return or an endless loop), constant-condition
+//    branches and expression statements without any effect
+//  - EliminateDeadStores: stores whose value is never read again (backward liveness over the structured
+//    tree); without tracing the whole statement goes, which can make more stores dead, so this runs
+//    to a fixed point
+//  - RemoveUnusedVariables: scalars that are never read, together with their frame slot; the assignments
+//    to them that stay become dead stores
+// Each returns the number of things it removed. Nodes that replace removed statements are taken from
+// allocator, which must own the program.
+class DeadCodeEliminator {
+  public:
+    DeadCodeEliminator(Program* program, ArenaAllocator& allocator, const Options& options);
+    int PruneUnreachable();
+    int EliminateDeadStores();
+    int RemoveUnusedVariables();
+
+  private:
+    using LiveSet = std::unordered_set<const Declaration*>;
+
+    bool PruneBlock(Block* block);
+    bool PruneStatement(Statement* stmt);
+    void RemoveStatement(Statement* stmt);
+
+    template <typename Expr>
+    void LiveExpression(Expr* expr, LiveSet& live);
+    void LiveStatement(Statement* stmt, LiveSet& live);
+    void LiveBlock(Block* block, LiveSet& live);
+
+    bool RemoveUnusedDeclarations(Block* block, const LiveSet& read);
+    bool RemoveUnusedDeclarations(Statement* stmt, const LiveSet& read);
+
+    void Report(SourceLocation loc, const std::string& msg);
+
+    Program* m_Program;
+    ArenaAllocator& m_Allocator;
+    const Options& m_Options;
+    bool m_Changed = false;
+    int m_Removed = 0;
+};
+
+} // namespace Compiler
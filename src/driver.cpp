@@ -0,0 +1,156 @@
+#include "driver.h"
+#include "lexer.h"
+#include "parser.h"
+#include "pass_manager.h"
+#include <charconv>
+#include <exception>
+#include <format>
+#include <pthread.h>
+#include <sstream>
+
+namespace Compiler {
+
+// The parser and the generator keep their nesting on the heap, but the passes in between still recurse
+// once per level. Programs nested deeper than what takes 4 MB of the calling thread's stack run those
+// passes on a thread whose stack is sized for the depth, so that memory is the only limit; everything
+// else stays on the calling thread. test/nesting.sh measures a level at up to 1 KB in a release build
+// and 5.5 KB in a debug build, whose sanitizers pad every frame (gvn rewriting nested parentheses takes
+// the most), and these leave room for three to four times that.
+#ifdef DEBUG
+constexpr size_t StackPerNestingLevel = 16 * 1024;
+#else
+constexpr size_t StackPerNestingLevel = 4 * 1024;
+#endif
+constexpr size_t RecursionSafeDepth = 4 * 1024 * 1024 / StackPerNestingLevel;
+constexpr size_t MinimumStack = 8 * 1024 * 1024;
+
+static void RunWithStack(size_t stackSize, const std::function<void()>& work) {
+    std::exception_ptr error;
+    auto run = [&] {
+        try {
+            work();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    };
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, stackSize);
+    pthread_t thread;
+    const int status = pthread_create(
+        &thread, &attributes,
+        [](void* arg) -> void* {
+            (*static_cast<decltype(run)*>(arg))();
+            return nullptr;
+        },
+        &run);
+    pthread_attr_destroy(&attributes);
+    if (status != 0) {
+        Error(std::format("Failed to reserve a {} MB stack for the nesting depth", stackSize >> 20));
+    }
+    pthread_join(thread, nullptr);
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+CompileResult Compile(std::string_view source, const Options& options, ArenaAllocator& arena) {
+    CompileResult result;
+    std::ostringstream diagnostics;
+    arena.Reset();
+
+    try {
+        DiagnosticScope scope(source, diagnostics, &result.Messages);
+        Lexer lexer(source, options.LexThreads);
+        Parser parser(lexer.Lex(), arena, options);
+        auto program = parser.ParseProgram();
+
+        auto passes = [&] {
+            DiagnosticScope threadScope(source, diagnostics, &result.Messages); // diagnostics are per thread
+            PassManager manager(program, arena, options);
+            const std::string_view pipeline =
+                options.Passes.empty() ? PassManager::Pipeline(options.OptimizationLevel) : options.Passes;
+            result.Output =
+                options.Bytecode ? manager.RunBytecode(pipeline).Serialize() : manager.Run(pipeline);
+            if (options.Statistics) {
+                diagnostics << manager.FormatStatistics();
+            }
+        };
+        RunAtDepth(program->NestingDepth, passes);
+        result.Success = true;
+    } catch (const CompileError& e) {
+        diagnostics << e.what() << "\n";
+        result.Messages.push_back(e.Details());
+    } catch (const std::exception& e) { // out of memory, or a bug: fails this compilation only
+        const std::string message = std::format("Internal error: {}", e.what());
+        diagnostics << message << "\n";
+        result.Messages.push_back(Diagnostic{ Diagnostic::Severity::Error, message });
+    }
+
+    result.Diagnostics = diagnostics.str();
+    return result;
+}
+
+CompileResult Compile(std::string_view source, const Options& options) {
+    ArenaAllocator arena(ArenaChunkSize);
+    return Compile(source, options, arena);
+}
+
+void RunAtDepth(size_t nestingDepth, const std::function<void()>& work) {
+    if (nestingDepth <= RecursionSafeDepth) {
+        work();
+    } else {
+        RunWithStack(std::max(MinimumStack, nestingDepth * StackPerNestingLevel), work);
+    }
+}
+
+bool ParseOption(std::string_view arg, Options& options) {
+    if (arg == "-v" || arg == "--verbose") {
+        options.Verbose = true;
+    } else if (arg == "--no-trace") {
+        options.Trace = false;
+    } else if (arg == "-mavx2") {
+        options.Avx2 = true;
+    } else if (arg == "--no-if-conversion") {
+        options.IfConversion = false;
+    } else if (arg.size() == 3 && arg.starts_with("-O") && arg[2] >= '0' && arg[2] <= '3') {
+        options.OptimizationLevel = arg[2] - '0';
+    } else if (arg.starts_with("--passes=")) {
+        options.Passes = arg.substr(arg.find('=') + 1);
+    } else if (arg == "--emit-bytecode") {
+        options.Bytecode = true;
+    } else if (arg == "--stats") {
+        options.Statistics = true;
+    } else if (arg.starts_with("--max-nesting=")) {
+        const std::string_view value = arg.substr(arg.find('=') + 1);
+        size_t depth = 0;
+        const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), depth);
+        if (error != std::errc() || end != value.data() + value.size() || depth == 0) {
+            Error(std::format("Invalid nesting limit: {}", value));
+        }
+        options.MaxNestingDepth = depth;
+    } else if (arg.starts_with("--eval-budget=")) {
+        const std::string_view value = arg.substr(arg.find('=') + 1);
+        uint64_t steps = 0;
+        const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), steps);
+        if (error != std::errc() || end != value.data() + value.size()) {
+            Error(std::format("Invalid evaluation budget: {}", value));
+        }
+        options.EvaluationBudget = steps;
+    } else if (arg.starts_with("--lex-threads=")) {
+        const std::string_view value = arg.substr(arg.find('=') + 1);
+        unsigned threads = 0;
+        const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), threads);
+        if (error != std::errc() || end != value.data() + value.size()) {
+            Error(std::format("Invalid lexer thread count: {}", value));
+        }
+        options.LexThreads = threads;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+} // namespace Compiler
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "options.h"
+#include "utils.h"
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Compiler {
+
+constexpr size_t ArenaChunkSize = 4 * 1024 * 1024; // 4 MB
+
+struct CompileResult {
+    bool Success = false;
+    std::string Output;      // assembly, or serialized Bytecode with Options::Bytecode
+    std::string Diagnostics; // notes and, on failure, the error, as printed; --stats adds its table
+    std::vector<Diagnostic> Messages; // the same notes and error, one by one
+};
+
+// Runs the whole pipeline over `source`. The program is built in `arena`, which is reset first, so one
+// arena can serve any number of compilations.
+// Compiling neither exits nor touches stdin, stdout or stderr: everything it reports ends up in the
+// result. Any number of threads may compile at once, each with its own arena.
+CompileResult Compile(std::string_view source, const Options& options, ArenaAllocator& arena);
+
+// The same with an arena of its own, for callers that compile now and then; a caller that compiles file
+// after file on a thread saves the setup by keeping an arena for it.
+CompileResult Compile(std::string_view source, const Options& options);
+
+// Runs `work`, which recurses once per nesting level of a program that deep, on a thread with a stack
+// sized for the depth when the calling thread's may not do.
+void RunAtDepth(size_t nestingDepth, const std::function<void()>& work);
+
+// Applies a command line flag to `options`; false if it is not one.
+bool ParseOption(std::string_view arg, Options& options);
+
+} // namespace Compiler
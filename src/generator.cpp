@@ -1,257 +1,690 @@
 #include "generator.h"
-#include "symbol_table.h"
+#include "ast_visitor.h"
+#include "runtime.h"
+#include "superword_vectorizer.h"
 #include "utils.h"
+#include <algorithm>
 #include <format>
+#include <set>
 
 namespace Compiler {
 
-Generator::Generator(Program* prog, ScopeStack& scopes) : m_Program(prog), m_Scopes(scopes) {}
+Generator::Generator(Program* prog, const Options& options)
+    : m_Program(prog), m_Options(options), m_Selector(options) {}
 
-std::string Generator::GenerateAsm() {
-    m_StackSize = 0;
-
-    m_Output += "global _start\nsection .text\nextern print\n_start:\n";
+std::vector<MachineBlock> Generator::GenerateBlocks() {
+    Begin();
+    EmitPrologue();
     GenerateBlock(m_Program->GlobalBlock);
-    m_Output += "mov rax, 60\nxor rdi, rdi\nsyscall\n";
-
-    return m_Output;
+    EmitEpilogue();
+    return std::move(m_Blocks);
 }
 
-void Generator::Push(const std::string& reg) {
-    m_Output += "push " + reg + "\n";
-    m_StackSize++;
+Generator::CodePiece Generator::GeneratePrologue() {
+    Begin();
+    EmitPrologue();
+    return { std::move(m_Blocks), m_Current };
 }
 
-void Generator::Pop(const std::string& reg) {
-    if (m_StackSize <= 0) {
-        Error("Stack underflow");
-    }
-    m_Output += "pop " + reg + "\n";
-    m_StackSize--;
+Generator::CodePiece Generator::GenerateStatementBlocks(const Statement* stmt) {
+    Begin();
+    const size_t outer = m_StatementTasks.size();
+    m_StatementTasks.emplace_back(stmt);
+    RunStatementTasks(outer);
+    return { std::move(m_Blocks), m_Current };
 }
 
-std::string Generator::CreateLabel() {
-    return "label" + std::to_string(m_LabelCount++);
+Generator::CodePiece Generator::GenerateEpilogue() {
+    Begin();
+    EmitEpilogue();
+    return { std::move(m_Blocks), m_Current };
 }
 
-void Generator::DebugPrint(const std::string& reg) {
-    m_Output += "mov rdi, " + reg + "\n";
-    m_Output += "call print\n";
+// Pieces are emitted apart, so the first block of one is not joined to the open block of the piece
+// before: that block runs into a block at the end of its piece instead, which only holds the label of
+// what follows.
+std::string Generator::EmitPiece(CodePiece piece, const std::string& name) {
+    const int next = static_cast<int>(piece.Blocks.size());
+    piece.Blocks.emplace_back().Exit = BlockExit::Return; // no code, so it has no exit either
+    MachineBlock& open = piece.Blocks[piece.Open];
+    if (open.Exit == BlockExit::Jump && open.Next < 0) {
+        open.Next = next;
+    }
+    for (size_t i = 0; i < piece.Blocks.size(); ++i) {
+        piece.Blocks[i].Label = name + "_" + std::to_string(i);
+    }
+    return BlockLayout(piece.Blocks).Emit();
 }
 
-void Generator::GeneratePrimary(const Primary* primary) {
-    std::visit(overloaded{ [&](int64_t i) {
-                              m_Output += "mov rax, " + std::to_string(i) + "\n";
-                              Push("rax");
-                          },
-                   [&](const std::string& s) {
-                       auto& v = m_Scopes.Lookup(s);
-                       Push("QWORD [rsp + " + std::to_string((m_StackSize - v.StackOffset - 1) * 8) + "]");
-                   },
-                   [&](const Expression* expr) { GenerateExpression(expr); } },
-        primary->Value);
+void Generator::Begin() {
+    m_LoopDepth = 0;
+    m_LabelCount = 0;
+    m_Blocks.clear();
+    m_Current = NewBlock();
 }
 
-void Generator::GeneratePostfixExpression(const PostfixExpression* expr) {
-    GeneratePrimary(expr->Prim);
+void Generator::EmitPrologue() {
+    Emit("push rbp\nmov rbp, rsp\n");
+    if (m_Program->FrameSize != 0) {
+        Emit("sub rsp, " + std::to_string(m_Program->FrameSize) + "\n");
+    }
 }
 
-void Generator::GenerateMultiplicativeExpression(const MultiplicativeExpression* expr) {
-    GeneratePostfixExpression(expr->Left);
-    for (const auto& [op, right] : expr->Right) {
-        GeneratePostfixExpression(right);
-        Pop("rcx");
-        Pop("rax");
+void Generator::EmitEpilogue() {
+    Emit("xor rdi, rdi\n");
+    Exit();
+}
 
-        if (op == BinaryOp::Mul) {
-            m_Output += "imul rax, rcx\n";
-            Push("rax");
-        } else if (op == BinaryOp::Div || op == BinaryOp::Mod) {
-            m_Output += "cqo\n";
-            m_Output += "idiv rcx\n";
-            if (op == BinaryOp::Div) {
-                Push("rax");
-            } else {
-                Push("rdx");
-            }
-        } else {
-            Error("Unknown operator");
-        }
+std::string Generator::Assemble(std::string_view code, const Options& options) {
+    // smartalign pads with long NOPs instead of runs of single-byte ones
+    std::string output = "%use smartalign\nalignmode p6\n";
+    output += "global _start\nsection .text\n_start:\n";
+    output += code;
+    if (options.Trace) {
+        output += "\n";
+        output += RuntimeSource;
     }
+    return output;
 }
 
-void Generator::GenerateAdditiveExpression(const AdditiveExpression* expr) {
-    GenerateMultiplicativeExpression(expr->Left);
-    for (const auto& [op, right] : expr->Right) {
-        GenerateMultiplicativeExpression(right);
-        Pop("rax");
-        Pop("rbx");
+void Generator::Emit(const std::string& code) {
+    m_Blocks[m_Current].Code += code;
+}
 
-        if (op == BinaryOp::Add) {
-            m_Output += "add rbx, rax\n";
-            Push("rbx");
-        } else if (op == BinaryOp::Sub) {
-            m_Output += "sub rbx, rax\n";
-            Push("rbx");
-        } else {
-            Error("Unknown operator");
-        }
-    }
+int Generator::NewBlock() {
+    MachineBlock& block = m_Blocks.emplace_back();
+    block.Label = CreateLabel();
+    block.LoopDepth = m_LoopDepth;
+    return static_cast<int>(m_Blocks.size()) - 1;
 }
 
-void Generator::GenerateRelationalExpression(const RelationalExpression* expr) {
-    GenerateAdditiveExpression(expr->Left);
-    for (const auto& [op, right] : expr->Right) {
-        GenerateAdditiveExpression(right);
-        Pop("rax");
-        Pop("rbx");
+void Generator::EndWithJump(int target) {
+    m_Blocks[m_Current].Exit = BlockExit::Jump;
+    m_Blocks[m_Current].Next = target;
+}
 
-        m_Output += "cmp rbx, rax\n";
-        if (op == BinaryOp::Gt) {
-            m_Output += "setg al\n";
-        } else if (op == BinaryOp::Ge) {
-            m_Output += "setge al\n";
-        } else if (op == BinaryOp::Lt) {
-            m_Output += "setl al\n";
-        } else if (op == BinaryOp::Le) {
-            m_Output += "setle al\n";
-        } else {
-            Error("Unknown operator");
-        }
-        m_Output += "movzx rax, al\n";
-        Push("rax");
-    }
+void Generator::EndWithBranch(const std::string& cc, int taken, int next) {
+    m_Blocks[m_Current].Exit = BlockExit::Branch;
+    m_Blocks[m_Current].Condition = cc;
+    m_Blocks[m_Current].Taken = taken;
+    m_Blocks[m_Current].Next = next;
 }
 
-void Generator::GenerateEqualityExpression(const EqualityExpression* expr) {
-    GenerateRelationalExpression(expr->Left);
-    for (const auto& [op, right] : expr->Right) {
-        GenerateRelationalExpression(right);
-        Pop("rax");
-        Pop("rbx");
+void Generator::EndWithReturn() {
+    m_Blocks[m_Current].Exit = BlockExit::Return;
+    // anything generated after this is unreachable and BlockLayout drops it; the block only gets another
+    // exit if more code follows
+    m_Current = NewBlock();
+    m_Blocks[m_Current].Exit = BlockExit::Return;
+}
 
-        m_Output += "cmp rbx, rax\n";
-        if (op == BinaryOp::Eq) {
-            m_Output += "sete al\n";
-        } else if (op == BinaryOp::Ne) {
-            m_Output += "setne al\n";
-        } else {
-            Error("Unknown operator");
-        }
-        m_Output += "movzx rax, al\n";
-        Push("rax");
-    }
+std::string Generator::FrameSlot(const Declaration* decl) {
+    return "QWORD [rbp - " + std::to_string(decl->Offset) + "]";
 }
 
-void Generator::GenerateExpression(const Expression* expr) {
-    if (expr->Expr->Ident) { // assignment
-        auto& v = m_Scopes.Lookup(*expr->Expr->Ident);
+std::string Generator::ElementAddress(const Declaration* decl, const std::string& indexReg) {
+    return "[rbp + " + indexReg + "*8 - " + std::to_string(decl->Offset) + "]";
+}
 
-        GenerateEqualityExpression(expr->Expr->Expr);
-        Pop("rax");
+std::string Generator::CreateLabel() {
+    return "label" + std::to_string(m_LabelCount++);
+}
 
-        m_Output += "mov [rsp + " + std::to_string((m_StackSize - v.StackOffset - 1) * 8) + "], rax\n";
-        DebugPrint("rax");
+// Exits with the status in rdi. Printed output is buffered, so with tracing on the runtime flushes it first.
+void Generator::Exit() {
+    if (m_Options.Trace) {
+        Emit("jmp exit\n");
     } else {
-        GenerateEqualityExpression(expr->Expr->Expr);
-        Pop("rax");
+        Emit("mov rax, 60\nsyscall\n");
     }
+    EndWithReturn();
+}
+
+std::string Generator::GenerateExpression(const Expression* expr, InstructionSelector::Goal goal) {
+    return m_Selector.Select(expr, goal, m_Blocks[m_Current].Code);
 }
 
 void Generator::GenerateBlock(const Block* scope) {
-    m_Scopes.EnterScope();
+    const size_t outer = m_StatementTasks.size();
+    m_StatementTasks.emplace_back(scope);
+    RunStatementTasks(outer);
+}
 
-    for (const auto& item : scope->Items) {
-        std::visit(overloaded{ [&](const Statement* stmt) { GenerateStatement(stmt); },
-                       [&](const Declaration* decl) {
-                           m_Scopes.Insert(decl->Ident, { VARIABLE, m_StackSize - 1 });
+// the pack whose lanes are the items of the block from i on, if a pass has not split them up since
+static const SuperwordPack* PackAt(const Block* block, size_t i) {
+    const auto lane = [&](size_t item) -> const ExpressionStatement* {
+        const auto* stmt = std::get_if<Ref<Statement>>(&block->Items[item]->Item);
+        const auto* exprStmt = stmt ? std::get_if<Ref<ExpressionStatement>>(&(*stmt)->Stmt) : nullptr;
+        return exprStmt ? exprStmt->Get() : nullptr;
+    };
+    const ExpressionStatement* first = lane(i);
+    const SuperwordPack* pack = first ? first->Pack.Get() : nullptr;
+    if (!pack || i + pack->Lanes.size() > block->Items.size()) {
+        return nullptr;
+    }
+    for (size_t k = 0; k < pack->Lanes.size(); k++) {
+        if (lane(i + k) != pack->Lanes[k].Get()) {
+            return nullptr;
+        }
+    }
+    return pack;
+}
 
-                           m_Output += "sub rsp, 8\n";
-                           m_StackSize++;
+void Generator::RunStatementTasks(size_t outer) {
+    while (m_StatementTasks.size() > outer) {
+        const StatementTask task = m_StatementTasks.back();
+        m_StatementTasks.pop_back();
+
+        std::visit(overloaded{ [&](const Block* block) {
+                                  // declarations own a fixed frame slot (see SemanticAnalyzer), nothing to emit
+                                  std::vector<StatementTask> items;
+                                  for (size_t i = 0; i < block->Items.size(); i++) {
+                                      const auto* stmt = std::get_if<Ref<Statement>>(&block->Items[i]->Item);
+                                      if (const SuperwordPack* pack = stmt ? PackAt(block, i) : nullptr) {
+                                          items.emplace_back(pack);
+                                          i += pack->Lanes.size() - 1;
+                                      } else if (stmt) {
+                                          items.emplace_back(stmt->Get());
+                                      }
+                                  }
+                                  m_StatementTasks.insert(m_StatementTasks.end(), items.rbegin(),
+                                      items.rend());
+                              },
+                       [&](const Statement* stmt) { GenerateStatement(stmt); },
+                       [&](const SuperwordPack* pack) { GeneratePack(pack); },
+                       [&](const IfBranchEnd& branch) { EndIfBranch(branch); },
+                       [&](const LoopBodyEnd& loop) {
+                           EndWithJump(loop.Header);
+                           m_LoopDepth--;
+                           m_Current = loop.End;
                        } },
-            item->Item);
+            task);
     }
+}
 
-    size_t popCount = m_Scopes.ExitScope();
-    if (popCount != 0) {
-        m_Output += "add rsp, " + std::to_string(popCount * 8) + "\n";
+// The output goes out in one piece from a copy in .rodata, arrays are copied from there as well.
+void Generator::GeneratePrecomputed(const PrecomputedStatement* precomputed) {
+    const std::string output(precomputed->Output.begin(), precomputed->Output.end());
+    if (!output.empty()) {
+        const std::string text = CreateLabel();
+        Emit("section .rodata\n" + text + ":\n");
+        for (size_t start = 0; start < output.size();) {
+            const size_t end = output.find('\n', start);
+            Emit("db \"" + output.substr(start, end - start) + "\", 10\n");
+            start = end + 1;
+        }
+        Emit("section .text\n");
+        Emit("lea rsi, [rel " + text + "]\n");
+        Emit("mov rdx, " + std::to_string(output.size()) + "\n");
+        Emit("call print_text\n");
+    }
+
+    for (const PrecomputedStatement::Value& value : precomputed->Values) {
+        if (value.Decl->Size == 0) {
+            if (FitsImmediate(value.Elements[0])) {
+                Emit("mov " + FrameSlot(value.Decl) + ", " + std::to_string(value.Elements[0]) + "\n");
+                continue;
+            }
+            Emit("mov rax, " + std::to_string(value.Elements[0]) + "\n");
+            Emit("mov " + FrameSlot(value.Decl) + ", rax\n");
+            continue;
+        }
+        const std::string elements = CreateLabel();
+        Emit("section .rodata\n" + elements + ":\n");
+        for (int64_t element : value.Elements) {
+            Emit("dq " + std::to_string(element) + "\n");
+        }
+        Emit("section .text\n");
+        Emit("lea rsi, [rel " + elements + "]\n");
+        Emit("lea rdi, [rbp - " + std::to_string(value.Decl->Offset) + "]\n");
+        Emit("mov rcx, " + std::to_string(value.Elements.size()) + "\n");
+        Emit("rep movsq\n");
+    }
+
+    if (precomputed->ExitCode) {
+        Emit("mov rdi, " + std::to_string(*precomputed->ExitCode) + "\n");
+        Exit();
     }
-    m_StackSize -= popCount;
 }
 
+// Starts the statement; nested statements are left on m_StatementTasks, followed by what closes them.
 void Generator::GenerateStatement(const Statement* stmt) {
-    std::visit(overloaded{ [&](const ExpressionStatement* exprStmt) { GenerateExpression(exprStmt->Expr); },
+    using Goal = InstructionSelector::Goal;
+    std::visit(overloaded{ [&](const ExpressionStatement* exprStmt) { GenerateExpression(exprStmt->Expr, Goal::Effect); },
                    [&](const ReturnStatement* retStmt) {
                        if (retStmt->Expr) {
-                           GenerateExpression(retStmt->Expr);
-                           Pop("rdi");
+                           GenerateExpression(retStmt->Expr, Goal::Value);
+                           Emit("mov rdi, rax\n");
                        } else {
-                           m_Output += "xor rdi, rdi\n";
+                           Emit("xor rdi, rdi\n");
                        }
-                       m_Output += "mov rax, 60\n";
-                       m_Output += "syscall\n";
+                       Exit();
                    },
                    [&](const IfStatement* ifStmt) {
-                       GenerateExpression(ifStmt->Cond);
-                       Pop("rax");
+                       if (GenerateConditionalMove(ifStmt)) {
+                           if (m_Options.Verbose) {
+                               Note(stmt->Location, "if-conversion: selected with cmov");
+                           }
+                           return;
+                       }
+                       const std::string cc = GenerateExpression(ifStmt->Cond, Goal::Condition);
 
-                       const std::string elseLabel = CreateLabel();
-                       const std::string endLabel = CreateLabel();
+                       IfBranchEnd branch;
+                       branch.Else = ifStmt->Else;
+                       const int thenBlock = NewBlock();
+                       branch.ElseBlock = ifStmt->Else ? NewBlock() : -1;
+                       branch.EndBlock = NewBlock();
+                       EndWithBranch(InvertCondition(cc), ifStmt->Else ? branch.ElseBlock : branch.EndBlock, thenBlock);
 
-                       m_Output += "test rax, rax\n";
-                       m_Output += "jz " + elseLabel + "\n";
+                       // then-branch
+                       m_Current = thenBlock;
+                       m_StatementTasks.emplace_back(branch);
+                       m_StatementTasks.emplace_back(ifStmt->Then);
+                   },
+                   [&](const WhileStatement* whilStmt) {
+                       if (whilStmt->Vector) {
+                           GenerateVectorLoop(whilStmt->Vector);
+                       }
 
-                       const int64_t stackBefore = m_StackSize;
+                       // header: condition, leaves the loop on the taken edge (see MachineBlock)
+                       m_LoopDepth++;
+                       const int headerBlock = NewBlock();
+                       m_Blocks[headerBlock].LoopHeader = true;
+                       EndWithJump(headerBlock);
 
-                       // then-branch
-                       GenerateStatement(ifStmt->Then);
-                       const int64_t thenStack = m_StackSize;
+                       m_Current = headerBlock;
+                       const std::string cc = GenerateExpression(whilStmt->Cond, Goal::Condition);
 
-                       m_Output += "jmp " + endLabel + "\n";
+                       const int bodyBlock = NewBlock();
+                       m_LoopDepth--;
+                       const int endBlock = NewBlock();
+                       EndWithBranch(InvertCondition(cc), endBlock, bodyBlock);
 
-                       // else-branch
-                       m_Output += elseLabel + ":\n";
-                       m_StackSize = stackBefore;
-                       if (ifStmt->Else) {
-                           GenerateStatement(ifStmt->Else);
-                       }
+                       m_LoopDepth++;
+                       m_Current = bodyBlock;
+                       m_StatementTasks.emplace_back(LoopBodyEnd{ headerBlock, endBlock });
+                       m_StatementTasks.emplace_back(whilStmt->Loop);
+                   },
+                   [&](const Block* scope) { m_StatementTasks.emplace_back(scope); },
+                   [&](const PrecomputedStatement* precomputed) { GeneratePrecomputed(precomputed); } },
+        stmt->Stmt);
+}
 
-                       const int64_t elseStack = m_StackSize;
+// the assignment to a variable that is all a branch does, if that is so
+static const AssignmentExpression* SoleAssignment(const Statement* stmt) {
+    while (const auto* block = std::get_if<Ref<Block>>(&stmt->Stmt)) {
+        const NodeList<Ref<BlockItem>>& items = (*block)->Items;
+        if (items.size() != 1 || !std::holds_alternative<Ref<Statement>>(items[0]->Item)) {
+            return nullptr;
+        }
+        stmt = std::get<Ref<Statement>>(items[0]->Item);
+    }
+    const auto* exprStmt = std::get_if<Ref<ExpressionStatement>>(&stmt->Stmt);
+    if (!exprStmt) {
+        return nullptr;
+    }
+    const AssignmentExpression* assign = (*exprStmt)->Expr->Expr;
+    return assign->Ident && !assign->Index ? assign : nullptr;
+}
 
-                       // enforce stack agreement
-                       if (thenStack != elseStack) {
-                           Error("Stack height mismatch between if branches");
-                       }
+// An if whose branches each assign the same variable and do nothing else may become a conditional
+// move, which InstructionSelector decides on.
+bool Generator::GenerateConditionalMove(const IfStatement* ifStmt) {
+    if (!m_Options.IfConversion) {
+        return false;
+    }
+    const AssignmentExpression* value = SoleAssignment(ifStmt->Then);
+    const AssignmentExpression* other = ifStmt->Else ? SoleAssignment(ifStmt->Else) : nullptr;
+    if (!value || (ifStmt->Else && (!other || other->Decl.Get() != value->Decl.Get()))) {
+        return false;
+    }
+    return m_Selector.SelectConditionalMove(ifStmt, value, other, m_Blocks[m_Current].Code);
+}
 
-                       // merged stack height
-                       m_StackSize = thenStack;
+// Runs after each branch of an if: the then-branch hands over to the else-branch, if there is one, and
+// the last branch goes on at the end of the if.
+void Generator::EndIfBranch(IfBranchEnd branch) {
+    EndWithJump(branch.EndBlock);
+
+    if (!branch.InElse && branch.Else) {
+        // else-branch
+        branch.InElse = true;
+        m_Current = branch.ElseBlock;
+        m_StatementTasks.emplace_back(branch);
+        m_StatementTasks.emplace_back(branch.Else);
+        return;
+    }
+    m_Current = branch.EndBlock;
+}
 
-                       // end
-                       m_Output += endLabel + ":\n";
-                   },
-                   [&](const WhileStatement* whilStmt) {
-                       const std::string startLabel = CreateLabel();
-                       const std::string endLabel = CreateLabel();
 
-                       m_Output += startLabel + ":\n";
+std::string Generator::VectorReg(int reg) const {
+    return (m_Lanes == 4 ? "ymm" : "xmm") + std::to_string(reg);
+}
 
-                       GenerateExpression(whilStmt->Cond);
-                       Pop("rax");
+// `op dst, src` with SSE2, `vop dst, dst, src` with AVX2
+void Generator::VectorOp(const std::string& op, int dst, int src) {
+    if (m_Options.Avx2) {
+        Emit("v" + op + " " + VectorReg(dst) + ", " + VectorReg(dst) + ", " + VectorReg(src) + "\n");
+    } else {
+        Emit(op + " " + VectorReg(dst) + ", " + VectorReg(src) + "\n");
+    }
+}
 
-                       m_Output += "test rax, rax\n";
-                       m_Output += "jz " + endLabel + "\n";
+// the address of a slot SuperwordVectorizer::Steps accepted
+static int64_t Displacement(const Declaration* decl, const Expression* index) {
+    return decl->Offset - (index ? *FoldConstant(index) * 8 : 0);
+}
 
-                       const int64_t stackBefore = m_StackSize;
+static std::string SlotAt(int64_t displacement) {
+    return "[rbp - " + std::to_string(displacement) + "]";
+}
+
+// Loads the slots at the displacements into the lanes of vector register reg: at once where they are in
+// order in memory, broadcast where they are the same slot and lane by lane otherwise, with reg + 1 as
+// scratch space.
+void Generator::LoadLanes(const std::vector<int64_t>& slots, int reg) {
+    const std::string xmm = "xmm" + std::to_string(reg);
+    bool inOrder = true;
+    bool same = true;
+    for (size_t lane = 1; lane < slots.size(); lane++) {
+        inOrder &= slots[lane] == slots[0] - static_cast<int64_t>(lane) * 8;
+        same &= slots[lane] == slots[0];
+    }
+    if (inOrder) {
+        Emit((m_Options.Avx2 ? "vmovdqu " : "movdqu ") + VectorReg(reg) + ", " + SlotAt(slots[0]) + "\n");
+    } else if (same && m_Options.Avx2) {
+        Emit("vpbroadcastq " + VectorReg(reg) + ", QWORD " + SlotAt(slots[0]) + "\n");
+    } else if (same) {
+        Emit("movq " + xmm + ", QWORD " + SlotAt(slots[0]) + "\n");
+        Emit("punpcklqdq " + xmm + ", " + xmm + "\n");
+    } else if (!m_Options.Avx2) {
+        Emit("movq " + xmm + ", QWORD " + SlotAt(slots[0]) + "\n");
+        Emit("movhps " + xmm + ", QWORD " + SlotAt(slots[1]) + "\n");
+    } else {
+        for (size_t half = 0; half < slots.size(); half += 2) {
+            const std::string part = "xmm" + std::to_string(reg + static_cast<int>(half) / 2);
+            Emit("vmovq " + part + ", QWORD " + SlotAt(slots[half]) + "\n");
+            Emit("vpinsrq " + part + ", " + part + ", QWORD " + SlotAt(slots[half + 1]) + ", 1\n");
+        }
+        if (slots.size() == 4) {
+            Emit("vinserti128 " + VectorReg(reg) + ", " + VectorReg(reg) + ", xmm" + std::to_string(reg + 1) +
+                ", 1\n");
+        }
+    }
+}
+
+// Stores the lanes of vector register 0 to the slots at the displacements, using register 1 as scratch
+// space when they are not in order in memory.
+void Generator::StoreLanes(const std::vector<int64_t>& slots) {
+    bool inOrder = true;
+    for (size_t lane = 1; lane < slots.size(); lane++) {
+        inOrder &= slots[lane] == slots[0] - static_cast<int64_t>(lane) * 8;
+    }
+    if (inOrder) {
+        Emit((m_Options.Avx2 ? "vmovdqu " : "movdqu ") + SlotAt(slots[0]) + ", " + VectorReg(0) + "\n");
+    } else if (!m_Options.Avx2) {
+        Emit("movq QWORD " + SlotAt(slots[0]) + ", xmm0\n");
+        Emit("movhps QWORD " + SlotAt(slots[1]) + ", xmm0\n");
+    } else {
+        for (size_t half = 0; half < slots.size(); half += 2) {
+            if (half != 0) {
+                Emit("vextracti128 xmm1, ymm0, 1\n");
+            }
+            const std::string part = half == 0 ? "xmm0" : "xmm1";
+            Emit("vmovq QWORD " + SlotAt(slots[half]) + ", " + part + "\n");
+            Emit("vpextrq QWORD " + SlotAt(slots[half + 1]) + ", " + part + ", 1\n");
+        }
+    }
+}
 
-                       GenerateStatement(whilStmt->Loop);
+// Computes the lanes on a stack of vector registers from 0 up, following SuperwordVectorizer::Steps, then
+// stores and, when tracing, prints them in block order, which is what the scalar code would print.
+void Generator::GeneratePack(const SuperwordPack* pack) {
+    std::vector<const AssignmentExpression*> assigns;
+    for (const Ref<ExpressionStatement>& lane : pack->Lanes) {
+        assigns.push_back(lane->Expr->Expr);
+    }
+    std::vector<int64_t> slots;
+    for (const AssignmentExpression* assign : assigns) {
+        slots.push_back(Displacement(assign->Decl, assign->Index));
+    }
+    // a pass may have changed a lane since, or removed the variable of one, which leaves it no slot (0)
+    const auto steps = SuperwordVectorizer::Steps(assigns, m_Options);
+    if (!steps || std::find(slots.begin(), slots.end(), 0) != slots.end() ||
+        std::set<int64_t>(slots.begin(), slots.end()).size() != slots.size()) {
+        for (const Ref<ExpressionStatement>& lane : pack->Lanes) {
+            GenerateExpression(lane->Expr, InstructionSelector::Goal::Effect);
+        }
+        return;
+    }
+    m_Lanes = static_cast<int>(assigns.size());
+
+    int top = -1;
+    for (const SuperwordVectorizer::Step& step : *steps) {
+        if (!step.Op && std::holds_alternative<int64_t>(step.Leaves[0]->Value)) {
+            const std::string constants = CreateLabel();
+            Emit("section .rodata\n" + constants + ":\n");
+            for (size_t lane = 0; lane < assigns.size(); lane++) {
+                Emit("dq " + std::to_string(std::get<int64_t>(step.Leaves[lane]->Value)) + "\n");
+            }
+            Emit("section .text\n");
+            const std::string move = m_Options.Avx2 ? "vmovdqu " : "movdqu ";
+            Emit(move + VectorReg(++top) + ", [rel " + constants + "]\n");
+            continue;
+        } else if (!step.Op) {
+            std::vector<int64_t> leaves;
+            for (size_t lane = 0; lane < assigns.size(); lane++) {
+                leaves.push_back(Displacement(step.Leaves[lane]->Decl, step.Leaves[lane]->Index));
+            }
+            LoadLanes(leaves, ++top);
+            continue;
+        }
 
-                       m_Output += "jmp " + startLabel + "\n";
-                       m_Output += endLabel + ":\n";
+        // comparisons, which only AVX2 has, leave a mask of all ones where they hold, and 0/1 is the
+        // negated mask; <=, >= and != are the masks of >, < and == inverted, plus one
+        top--;
+        const std::string dst = VectorReg(top);
+        const std::string src = VectorReg(top + 1);
+        bool inverted = false;
+        switch (*step.Op) {
+            case BinaryOp::Add: VectorOp("paddq", top, top + 1); continue;
+            case BinaryOp::Sub: VectorOp("psubq", top, top + 1); continue;
+            case BinaryOp::Le: inverted = true; [[fallthrough]];
+            case BinaryOp::Gt: Emit("vpcmpgtq " + dst + ", " + dst + ", " + src + "\n"); break;
+            case BinaryOp::Ge: inverted = true; [[fallthrough]];
+            case BinaryOp::Lt: Emit("vpcmpgtq " + dst + ", " + src + ", " + dst + "\n"); break;
+            case BinaryOp::Ne: inverted = true; [[fallthrough]];
+            default: Emit("vpcmpeqq " + dst + ", " + dst + ", " + src + "\n"); break;
+        }
+        if (inverted) {
+            Emit("vpcmpeqq " + src + ", " + src + ", " + src + "\n");
+            Emit("vpsubq " + dst + ", " + dst + ", " + src + "\n");
+        } else {
+            Emit("vpxor " + src + ", " + src + ", " + src + "\n");
+            Emit("vpsubq " + dst + ", " + src + ", " + dst + "\n");
+        }
+    }
 
-                       m_StackSize = stackBefore;
-                   },
-                   [&](const Block* scope) { GenerateBlock(scope); } },
-        stmt->Stmt);
+    StoreLanes(slots);
+    if (m_Lanes == 4) {
+        Emit("vzeroupper\n");
+    }
+    for (size_t lane = 0; lane < assigns.size(); lane++) {
+        if (m_Options.Trace && (assigns[lane]->Index || !assigns[lane]->Silent)) {
+            Emit("mov rdi, QWORD " + SlotAt(slots[lane]) + "\ncall print\n");
+        }
+    }
+}
+
+// Runs as many whole vectors of iterations as fit below the bound, then stores the induction variable
+// and the partial sums back so the scalar loop that follows finishes the remainder.
+void Generator::GenerateVectorLoop(const VectorLoop* loop) {
+    const int lanes = m_Options.Avx2 ? 4 : 2;
+    m_Lanes = lanes;
+
+    // registers are handed out from the top: accumulators first, then broadcast invariants
+    int nextFixed = 15;
+    std::vector<std::pair<const AssignmentExpression*, int>> accumulators;
+    m_VectorInvariants.clear();
+    m_VectorConstants.clear();
+
+    auto broadcast = [&](int reg, const std::string& source) {
+        if (m_Options.Avx2) {
+            Emit("vmovq " + ("xmm" + std::to_string(reg)) + ", " + source + "\n");
+            Emit("vpbroadcastq " + VectorReg(reg) + ", " + ("xmm" + std::to_string(reg)) + "\n");
+        } else {
+            Emit("movq " + VectorReg(reg) + ", " + source + "\n");
+            Emit("punpcklqdq " + VectorReg(reg) + ", " + VectorReg(reg) + "\n");
+        }
+    };
+
+    auto hoist = [&](const Primary* primary, const AssignmentExpression* assign) {
+        if (const auto* i = std::get_if<int64_t>(&primary->Value)) {
+            if (!m_VectorConstants.contains(*i)) {
+                Emit("mov rax, " + std::to_string(*i) + "\n");
+                broadcast(nextFixed, "rax");
+                m_VectorConstants[*i] = nextFixed--;
+            }
+        } else if (!primary->Index && primary->Decl != assign->Decl && primary->Decl != loop->Induction &&
+                   !m_VectorInvariants.contains(primary->Decl)) {
+            Emit("mov rax, " + FrameSlot(primary->Decl) + "\n");
+            broadcast(nextFixed, "rax");
+            m_VectorInvariants[primary->Decl] = nextFixed--;
+        }
+    };
+
+    for (const AssignmentExpression* assign : loop->Body) {
+        if (!assign->Index) {
+            accumulators.emplace_back(assign, nextFixed);
+            VectorOp("pxor", nextFixed, nextFixed);
+            nextFixed--;
+        }
+        VisitExpression(assign->Expr.Get(), overloaded{ [&](const Primary* primary) { hoist(primary, assign); },
+                                          [](const AssignmentExpression*) {} });
+    }
+
+    Emit("mov rcx, " + FrameSlot(loop->Induction) + "\n");
+    if (const auto* bound = std::get_if<int64_t>(&loop->Bound->Value)) {
+        Emit("mov rdx, " + std::to_string(*bound) + "\n");
+    } else {
+        Emit("mov rdx, " + FrameSlot(loop->Bound->Decl) + "\n");
+    }
+
+    m_LoopDepth++;
+    const int headerBlock = NewBlock();
+    m_Blocks[headerBlock].LoopHeader = true;
+    EndWithJump(headerBlock);
+
+    // the last lane of this vector must still satisfy the loop condition
+    m_Current = headerBlock;
+    Emit("lea rax, [rcx + " + std::to_string(loop->Inclusive ? lanes - 1 : lanes) + "]\n");
+    Emit("cmp rax, rdx\n");
+
+    const int bodyBlock = NewBlock();
+    m_LoopDepth--;
+    const int endBlock = NewBlock();
+    EndWithBranch("g", endBlock, bodyBlock);
+
+    m_Current = bodyBlock;
+
+    for (const AssignmentExpression* assign : loop->Body) {
+        if (assign->Index) {
+            GenerateVectorExpression(assign->Expr.Get(), 0);
+            Emit((m_Options.Avx2 ? "vmovdqu " : "movdqu ") + ElementAddress(assign->Decl, "rcx") + ", " +
+                VectorReg(0) + "\n");
+            continue;
+        }
+
+        // s = s + a - b ...: the accumulator collects the terms, s itself is added in after the loop
+        const int acc = std::find_if(accumulators.begin(), accumulators.end(), [&](const auto& a) {
+            return a.first == assign;
+        })->second;
+        for (const auto& [op, term] : assign->Expr->Left->Left->Right) {
+            GenerateVectorExpression(term.Get(), 0);
+            VectorOp(op == BinaryOp::Add ? "paddq" : "psubq", acc, 0);
+        }
+    }
+
+    Emit("add rcx, " + std::to_string(lanes) + "\n");
+    EndWithJump(headerBlock);
+
+    m_Current = endBlock;
+    Emit("mov " + FrameSlot(loop->Induction) + ", rcx\n");
+
+    for (const auto& [assign, acc] : accumulators) {
+        if (m_Options.Avx2) {
+            Emit("vextracti128 xmm0, " + VectorReg(acc) + ", 1\n");
+            Emit("vpaddq xmm0, xmm0, xmm" + std::to_string(acc) + "\n");
+        } else {
+            Emit("movdqa xmm0, xmm" + std::to_string(acc) + "\n");
+        }
+        Emit("pshufd xmm1, xmm0, 0x4E\n");
+        Emit("paddq xmm0, xmm1\n");
+        Emit("movq rax, xmm0\n");
+        Emit("add " + FrameSlot(assign->Decl) + ", rax\n");
+    }
+    if (m_Options.Avx2) {
+        Emit("vzeroupper\n");
+    }
+}
+
+// Leaves the lanes of expr in vector register reg, using the registers above it as scratch space.
+template <typename Expr>
+void Generator::GenerateVectorExpression(const Expr* expr, int reg) {
+    const std::string move = m_Options.Avx2 ? "vmovdqa " : "movdqa ";
+
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        GenerateVectorExpression(expr->Expr->Expr.Get(), reg);
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        GenerateVectorExpression(expr->Prim.Get(), reg);
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        if (const auto* i = std::get_if<int64_t>(&expr->Value)) {
+            Emit(move + VectorReg(reg) + ", " + VectorReg(m_VectorConstants.at(*i)) + "\n");
+        } else if (const auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            GenerateVectorExpression(inner->Get(), reg);
+        } else if (expr->Index) {
+            Emit((m_Options.Avx2 ? "vmovdqu " : "movdqu ") + VectorReg(reg) + ", " +
+                ElementAddress(expr->Decl, "rcx") + "\n");
+        } else {
+            Emit(move + VectorReg(reg) + ", " + VectorReg(m_VectorInvariants.at(expr->Decl)) + "\n");
+        }
+    } else {
+        GenerateVectorExpression(expr->Left.Get(), reg);
+        for (const auto& [op, right] : expr->Right) {
+            GenerateVectorExpression(right.Get(), reg + 1);
+            if (op == BinaryOp::Add) {
+                VectorOp("paddq", reg, reg + 1);
+            } else if (op == BinaryOp::Sub) {
+                VectorOp("psubq", reg, reg + 1);
+            } else if (op == BinaryOp::Mul) {
+                // no 64-bit lane multiply before AVX-512: combine three 32x32->64 products,
+                // lo(a)*lo(b) + ((hi(a)*lo(b) + lo(a)*hi(b)) << 32)
+                const int a = reg, b = reg + 1, t = reg + 2, u = reg + 3;
+                if (m_Options.Avx2) {
+                    Emit("vpsrlq " + VectorReg(t) + ", " + VectorReg(a) + ", 32\n");
+                    Emit("vpsrlq " + VectorReg(u) + ", " + VectorReg(b) + ", 32\n");
+                } else {
+                    Emit(move + VectorReg(t) + ", " + VectorReg(a) + "\n");
+                    Emit("psrlq " + VectorReg(t) + ", 32\n");
+                    Emit(move + VectorReg(u) + ", " + VectorReg(b) + "\n");
+                    Emit("psrlq " + VectorReg(u) + ", 32\n");
+                }
+                VectorOp("pmuludq", t, b);
+                VectorOp("pmuludq", u, a);
+                VectorOp("paddq", t, u);
+                if (m_Options.Avx2) {
+                    Emit("vpsllq " + VectorReg(t) + ", " + VectorReg(t) + ", 32\n");
+                } else {
+                    Emit("psllq " + VectorReg(t) + ", 32\n");
+                }
+                VectorOp("pmuludq", a, b);
+                VectorOp("paddq", a, t);
+            } else {
+                Error("Unsupported operator in vector loop");
+            }
+        }
+    }
 }
 
-} // namespace Compiler
\ No newline at end of file
+} // namespace Compiler
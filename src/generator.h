@@ -1,44 +1,107 @@
 #pragma once
 
 #include "ast.h"
+#include "block_layout.h"
+#include "instruction_selector.h"
+#include "options.h"
 #include "utils.h"
 #include <unordered_map>
 
 namespace Compiler {
 
-class ScopeStack;
-
 class Generator {
   public:
-    explicit Generator(Program* prog, ScopeStack& scopes);
-    std::string GenerateAsm();
+    Generator(Program* prog, const Options& options);
+    std::vector<MachineBlock> GenerateBlocks();
+
+    // GenerateBlocks() in pieces, for IncrementalCompiler to keep the code of each statement of the global
+    // block: the prologue, the statements and the epilogue, emitted in that order, make up the program
+    struct CodePiece {
+        std::vector<MachineBlock> Blocks;
+        int Open = 0; // the block that the code after the piece goes on in
+    };
+    CodePiece GeneratePrologue();
+    CodePiece GenerateStatementBlocks(const Statement* stmt);
+    CodePiece GenerateEpilogue();
+    // the blocks of a piece in the order they were created, with labels of their own that start with
+    // `name`; the code after it goes on where its open block ends
+    static std::string EmitPiece(CodePiece piece, const std::string& name);
+
+    // the code of the blocks in their final order (BlockLayout::Emit()) as a program, along with the
+    // runtime when it prints
+    static std::string Assemble(std::string_view code, const Options& options);
 
   private:
 
-    void Push(const std::string& reg);
-    void Pop(const std::string& reg);
+    void Begin();
+    void EmitPrologue();
+    void EmitEpilogue();
+
+    // code goes into the current block; control flow between blocks is left to BlockLayout
+    void Emit(const std::string& code);
+    int NewBlock();
+    void EndWithJump(int target);
+    void EndWithBranch(const std::string& cc, int taken, int next);
+    void EndWithReturn();
+    void Exit();
 
     std::string CreateLabel();
 
-    void DebugPrint(const std::string& reg);
+    void GeneratePrecomputed(const PrecomputedStatement* precomputed);
+
+    static std::string FrameSlot(const Declaration* decl);
+    static std::string ElementAddress(const Declaration* decl, const std::string& indexReg);
+    static std::string ElementSlot(const Declaration* decl, const std::string& indexReg);
 
-    void GeneratePrimary(const Primary* primary);
-    void GeneratePostfixExpression(const PostfixExpression* expr);
-    void GenerateMultiplicativeExpression(const MultiplicativeExpression* expr);
-    void GenerateAdditiveExpression(const AdditiveExpression* expr);
-    void GenerateRelationalExpression(const RelationalExpression* expr);
-    void GenerateEqualityExpression(const EqualityExpression* expr);
-    void GenerateExpression(const Expression* expr);
-    void GenerateBlock(const Block* expr);
+    // Nested statements are generated from an explicit task stack rather than by recursion, so deeply
+    // nested sources cannot overflow the native stack; so are expressions (InstructionSelector).
+    struct IfBranchEnd {
+        const Statement* Else = nullptr;
+        int ElseBlock = -1;
+        int EndBlock = -1;
+        bool InElse = false;
+    };
+    struct LoopBodyEnd {
+        int Header;
+        int End;
+    };
+    using StatementTask =
+        std::variant<const Block*, const Statement*, const SuperwordPack*, IfBranchEnd, LoopBodyEnd>;
+
+    // the code of expr into the current block; returns the condition code for Goal::Condition
+    std::string GenerateExpression(const Expression* expr, InstructionSelector::Goal goal);
+    void GenerateBlock(const Block* scope);
+    void RunStatementTasks(size_t outer); // until the stack is back to `outer` tasks
     void GenerateStatement(const Statement* stmt);
+    bool GenerateConditionalMove(const IfStatement* ifStmt);
+    void EndIfBranch(IfBranchEnd branch);
+
+    // vector code for loops marked by LoopVectorizer; lanes are 64-bit, the element index lives in rcx
+    void GenerateVectorLoop(const VectorLoop* loop);
+    template <typename Expr>
+    void GenerateVectorExpression(const Expr* expr, int reg);
+    void VectorOp(const std::string& op, int dst, int src);
+    std::string VectorReg(int reg) const; // of m_Lanes lanes
+
+    // the assignments of a pack marked by SuperwordVectorizer, each lane of vector register 0 one of them
+    void GeneratePack(const SuperwordPack* pack);
+    void LoadLanes(const std::vector<int64_t>& slots, int reg); // frame slots by displacement below rbp
+    void StoreLanes(const std::vector<int64_t>& slots);
 
     const Program* m_Program;
-    std::string m_Output;
-    int64_t m_StackSize = 0;
+    const Options& m_Options;
+    std::vector<MachineBlock> m_Blocks;
+    int m_Current = 0;
+    int m_LoopDepth = 0;
+    int m_Lanes = 2; // of the vector code being generated
 
     int m_LabelCount = 0;
 
-    ScopeStack& m_Scopes;
+    InstructionSelector m_Selector;
+    std::vector<StatementTask> m_StatementTasks;
+
+    std::unordered_map<const Declaration*, int> m_VectorInvariants; // broadcast copies of scalars
+    std::unordered_map<int64_t, int> m_VectorConstants;
 };
 
 } // namespace Compiler
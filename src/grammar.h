@@ -0,0 +1,305 @@
+#pragma once
+
+#include "grammar_source.h" // grammar.bnf, embedded by CMake
+#include "lexer.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Compiler {
+
+// tokens as the bits of a word, so that testing for any of a set is a shift
+using TokenSet = uint64_t;
+static_assert(TOKEN_TYPE_NB <= 64);
+
+constexpr TokenSet TokenBit(TokenType type) {
+    return TokenSet{ 1 } << type;
+}
+
+constexpr bool InSet(TokenSet set, TokenType type) {
+    return (set >> type) & 1;
+}
+
+// grammar.bnf, read at compile time. The parser dispatches on tables computed from it below, and a
+// grammar that the tables cannot be built from stops the build: the `throw` of a constant expression
+// is a compile error that quotes its message.
+class Grammar {
+  public:
+    constexpr explicit Grammar(std::string_view source);
+
+    // the tokens that can start what the rule matches
+    constexpr TokenSet First(std::string_view rule) const { return Find(rule).First.Tokens; }
+
+    // the operators of a rule of the form `rule : operand (('op' | ...) operand)*`
+    constexpr TokenSet Operators(std::string_view rule, std::string_view operand) const;
+
+  private:
+    struct Symbol {
+        enum class Kind : uint8_t {
+            Rule, Terminal, Colon, Bar, Semicolon, Open, Close, Optional, Repeat, RepeatOnce
+        };
+        Kind What;
+        std::string_view Name = {};    // of a rule
+        TokenType Token = END_OF_FILE; // of a terminal
+    };
+    struct FirstSet {
+        TokenSet Tokens = 0;
+        bool Nullable = false; // the empty sequence matches as well
+    };
+    struct Rule {
+        std::string_view Name;
+        size_t Begin; // its alternatives are m_Symbols[Begin, End)
+        size_t End;
+        FirstSet First = {};
+    };
+
+    static constexpr TokenType TerminalNamed(std::string_view name);
+    constexpr const Rule& Find(std::string_view name) const;
+    constexpr size_t Closing(size_t open) const;
+    constexpr FirstSet FirstOfAlternatives(size_t begin, size_t end) const;
+    constexpr FirstSet FirstOfSequence(size_t begin, size_t end) const;
+
+    std::vector<Symbol> m_Symbols;
+    std::vector<Rule> m_Rules;
+};
+
+constexpr Grammar::Grammar(std::string_view source) {
+    using Kind = Symbol::Kind;
+    const auto isNameChar = [](char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    };
+    constexpr std::string_view punctuation = ":|;()?*+";
+    constexpr std::array<Kind, 8> punctuationKinds = { Kind::Colon, Kind::Bar, Kind::Semicolon, Kind::Open,
+        Kind::Close, Kind::Optional, Kind::Repeat, Kind::RepeatOnce };
+
+    for (size_t i = 0; i < source.size();) {
+        const char c = source[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            i++;
+        } else if (c == '#') { // comment
+            i = std::min(source.find('\n', i), source.size());
+        } else if (c == '\'') {
+            const size_t end = source.find('\'', i + 1);
+            if (end == std::string_view::npos) {
+                throw "grammar.bnf: unterminated quote";
+            }
+            m_Symbols.push_back({ Kind::Terminal, {}, TerminalNamed(source.substr(i + 1, end - i - 1)) });
+            i = end + 1;
+        } else if (isNameChar(c)) {
+            size_t end = i;
+            while (end < source.size() && isNameChar(source[end])) {
+                end++;
+            }
+            const std::string_view name = source.substr(i, end - i);
+            if (c >= 'A' && c <= 'Z') {
+                m_Symbols.push_back({ Kind::Terminal, {}, TerminalNamed(name) });
+            } else {
+                m_Symbols.push_back({ Kind::Rule, name });
+            }
+            i = end;
+        } else if (const size_t p = punctuation.find(c); p != std::string_view::npos) {
+            m_Symbols.push_back({ punctuationKinds[p] });
+            i++;
+        } else {
+            throw "grammar.bnf: unexpected character";
+        }
+    }
+
+    // rule ':' alternatives ';'
+    for (size_t i = 0; i < m_Symbols.size();) {
+        if (i + 1 >= m_Symbols.size() || m_Symbols[i].What != Kind::Rule ||
+            m_Symbols[i + 1].What != Kind::Colon) {
+            throw "grammar.bnf: expected the name of a rule and ':'";
+        }
+        size_t end = i + 2;
+        while (end < m_Symbols.size() && m_Symbols[end].What != Kind::Semicolon) {
+            end++;
+        }
+        if (end == m_Symbols.size()) {
+            throw "grammar.bnf: a rule does not end in ';'";
+        }
+        m_Rules.push_back({ m_Symbols[i].Name, i + 2, end });
+        i = end + 1;
+    }
+
+    // the FIRST sets grow until they no longer change
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (Rule& rule : m_Rules) {
+            const FirstSet first = FirstOfAlternatives(rule.Begin, rule.End);
+            if (first.Tokens != rule.First.Tokens || first.Nullable != rule.First.Nullable) {
+                rule.First = first;
+                changed = true;
+            }
+        }
+    }
+}
+
+// IDENTIFIER and NUMBER, or a token as TokenNames spells it
+constexpr TokenType Grammar::TerminalNamed(std::string_view name) {
+    if (name == "IDENTIFIER") {
+        return IDENTIFIER;
+    } else if (name == "NUMBER") {
+        return LITERAL;
+    }
+    for (int type = 0; type < TOKEN_TYPE_NB; type++) {
+        if (TokenNames[type] == name) {
+            return static_cast<TokenType>(type);
+        }
+    }
+    throw "grammar.bnf: a terminal the lexer has no token for";
+}
+
+constexpr const Grammar::Rule& Grammar::Find(std::string_view name) const {
+    for (const Rule& rule : m_Rules) {
+        if (rule.Name == name) {
+            return rule;
+        }
+    }
+    throw "grammar.bnf: no rule of that name";
+}
+
+constexpr size_t Grammar::Closing(size_t open) const {
+    int depth = 0;
+    for (size_t i = open; i < m_Symbols.size(); i++) {
+        if (m_Symbols[i].What == Symbol::Kind::Open) {
+            depth++;
+        } else if (m_Symbols[i].What == Symbol::Kind::Close) {
+            depth--;
+        }
+        if (depth == 0) {
+            return i;
+        }
+    }
+    throw "grammar.bnf: unbalanced parentheses";
+}
+
+// the alternatives are separated by the '|' outside parentheses
+constexpr Grammar::FirstSet Grammar::FirstOfAlternatives(size_t begin, size_t end) const {
+    FirstSet first;
+    size_t start = begin;
+    for (size_t i = begin; i <= end; i++) {
+        if (i == end || m_Symbols[i].What == Symbol::Kind::Bar) {
+            const FirstSet alternative = FirstOfSequence(start, i);
+            first.Tokens |= alternative.Tokens;
+            first.Nullable |= alternative.Nullable;
+            start = i + 1;
+        } else if (m_Symbols[i].What == Symbol::Kind::Open) {
+            i = Closing(i);
+        }
+    }
+    return first;
+}
+
+constexpr Grammar::FirstSet Grammar::FirstOfSequence(size_t begin, size_t end) const {
+    FirstSet first{ 0, true };
+    for (size_t i = begin; i < end && first.Nullable;) {
+        const Symbol& symbol = m_Symbols[i];
+        FirstSet item;
+        if (symbol.What == Symbol::Kind::Terminal) {
+            item = { TokenBit(symbol.Token), false };
+            i++;
+        } else if (symbol.What == Symbol::Kind::Rule) {
+            item = Find(symbol.Name).First;
+            i++;
+        } else if (symbol.What == Symbol::Kind::Open) {
+            const size_t close = Closing(i);
+            item = FirstOfAlternatives(i + 1, close);
+            i = close + 1;
+        } else {
+            throw "grammar.bnf: unexpected symbol in a rule";
+        }
+        const Symbol::Kind suffix = i < end ? m_Symbols[i].What : Symbol::Kind::Semicolon;
+        if (suffix == Symbol::Kind::Optional || suffix == Symbol::Kind::Repeat) {
+            item.Nullable = true;
+            i++;
+        } else if (suffix == Symbol::Kind::RepeatOnce) {
+            i++;
+        }
+        first.Tokens |= item.Tokens;
+        first.Nullable = item.Nullable;
+    }
+    return first;
+}
+
+constexpr TokenSet Grammar::Operators(std::string_view name, std::string_view operand) const {
+    using Kind = Symbol::Kind;
+    const Rule& rule = Find(name);
+    const size_t group = rule.Begin + 1;
+    const auto isOperand = [&](size_t i) {
+        return m_Symbols[i].What == Kind::Rule && m_Symbols[i].Name == operand;
+    };
+    if (rule.End - rule.Begin < 4 || !isOperand(rule.Begin) || m_Symbols[group].What != Kind::Open ||
+        Closing(group) != rule.End - 2 || m_Symbols[rule.End - 1].What != Kind::Repeat ||
+        !isOperand(rule.End - 3)) {
+        throw "grammar.bnf: an operator layer is not of the form `operand (operator operand)*`";
+    }
+    return FirstOfSequence(group + 1, rule.End - 3).Tokens;
+}
+
+// the layers of binary operators, from the one that binds tightest, as Parser::ExpressionFrame keeps them
+enum class OperatorLayer : uint8_t { Multiplicative, Additive, Relational, Equality, None };
+
+inline constexpr std::array<OperatorLayer, TOKEN_TYPE_NB> OperatorLayers = [] {
+    const Grammar grammar(GrammarSource);
+    const std::array<std::pair<std::string_view, std::string_view>, 4> layers = { {
+        { "multiplicativeExpression", "postfixExpression" },
+        { "additiveExpression", "multiplicativeExpression" },
+        { "relationalExpression", "additiveExpression" },
+        { "equalityExpression", "relationalExpression" },
+    } };
+    std::array<OperatorLayer, TOKEN_TYPE_NB> table;
+    table.fill(OperatorLayer::None);
+    for (size_t layer = 0; layer < layers.size(); layer++) {
+        const TokenSet operators = grammar.Operators(layers[layer].first, layers[layer].second);
+        for (int type = 0; type < TOKEN_TYPE_NB; type++) {
+            if (InSet(operators, static_cast<TokenType>(type))) {
+                if (table[type] != OperatorLayer::None) {
+                    throw "grammar.bnf: an operator in two layers";
+                }
+                table[type] = static_cast<OperatorLayer>(layer);
+            }
+        }
+    }
+    return table;
+}();
+
+// what a block item starting with a given token is
+enum class ItemKind : uint8_t { None, Declaration, Expression, Return, If, While, Block };
+
+inline constexpr std::array<ItemKind, TOKEN_TYPE_NB> ItemStarts = [] {
+    const Grammar grammar(GrammarSource);
+    const std::array<std::pair<std::string_view, ItemKind>, 6> items = { {
+        { "declaration", ItemKind::Declaration },
+        { "expressionStatement", ItemKind::Expression },
+        { "returnStatement", ItemKind::Return },
+        { "ifStatement", ItemKind::If },
+        { "whileStatement", ItemKind::While },
+        { "block", ItemKind::Block },
+    } };
+    std::array<ItemKind, TOKEN_TYPE_NB> table{};
+    TokenSet covered = 0;
+    for (const auto& [rule, kind] : items) {
+        const TokenSet first = grammar.First(rule);
+        if (first & covered) {
+            throw "grammar.bnf: two kinds of block item start with the same token";
+        }
+        covered |= first;
+        for (int type = 0; type < TOKEN_TYPE_NB; type++) {
+            if (InSet(first, static_cast<TokenType>(type))) {
+                table[type] = kind;
+            }
+        }
+    }
+    if (covered != grammar.First("blockItem")) {
+        throw "grammar.bnf: a kind of block item that the parser does not know";
+    }
+    return table;
+}();
+
+inline constexpr TokenSet PrimaryFirst = Grammar(GrammarSource).First("primary");
+
+} // namespace Compiler
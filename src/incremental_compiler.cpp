@@ -0,0 +1,416 @@
+#include "incremental_compiler.h"
+#include "bytecode_compiler.h"
+#include "generator.h"
+#include "lexer.h"
+#include "parser.h"
+#include "pass_manager.h"
+#include "semantic_analyzer.h"
+#include "symbol_table.h"
+#include <algorithm>
+#include <format>
+#include <span>
+#include <sstream>
+
+namespace Compiler {
+
+// the locations in an expression; the expressions nested in parentheses or indices go to `nested`, as
+// their nesting has no bound
+template <typename Expr, typename Move>
+static void MoveExpression(Expr* expr, const Move& move, std::vector<Expression*>& nested) {
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        move(expr->Expr->Location);
+        if (expr->Expr->Index) {
+            nested.push_back(expr->Expr->Index);
+        }
+        MoveExpression(expr->Expr->Expr.Get(), move, nested);
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        MoveExpression(expr->Prim.Get(), move, nested);
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        move(expr->Location);
+        if (auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            nested.push_back(*inner);
+        }
+        if (expr->Index) {
+            nested.push_back(expr->Index);
+        }
+    } else {
+        MoveExpression(expr->Left.Get(), move, nested);
+        for (const auto& [op, right] : expr->Right) {
+            MoveExpression(right.Get(), move, nested);
+        }
+    }
+}
+
+// calls move(SourceLocation&) on every location in the item, walking it from a stack
+template <typename Move>
+static void MoveLocations(const BlockItem* item, const Move& move) {
+    std::vector<Statement*> statements;
+    std::vector<Expression*> expressions;
+    auto add = [&](const BlockItem* inner) {
+        std::visit(overloaded{ [&](Statement* stmt) { statements.push_back(stmt); },
+                       [&](Declaration* decl) { move(decl->Location); } },
+            inner->Item);
+    };
+
+    add(item);
+    while (!statements.empty()) {
+        Statement* stmt = statements.back();
+        statements.pop_back();
+        move(stmt->Location);
+        std::visit(overloaded{ [&](ExpressionStatement* exprStmt) { expressions.push_back(exprStmt->Expr); },
+                       [&](ReturnStatement* retStmt) {
+                           if (retStmt->Expr) {
+                               expressions.push_back(retStmt->Expr);
+                           }
+                       },
+                       [&](IfStatement* ifStmt) {
+                           expressions.push_back(ifStmt->Cond);
+                           statements.push_back(ifStmt->Then);
+                           if (ifStmt->Else) {
+                               statements.push_back(ifStmt->Else);
+                           }
+                       },
+                       [&](WhileStatement* whileStmt) {
+                           expressions.push_back(whileStmt->Cond);
+                           statements.push_back(whileStmt->Loop);
+                       },
+                       [&](Block* block) {
+                           move(block->Location);
+                           move(block->End);
+                           std::for_each(block->Items.begin(), block->Items.end(), add);
+                       },
+                       [](PrecomputedStatement*) {} },
+            stmt->Stmt);
+        while (!expressions.empty()) {
+            Expression* expr = expressions.back();
+            expressions.pop_back();
+            MoveExpression(expr, move, expressions);
+        }
+    }
+}
+
+// the names and sizes of the declarations among the items, which decide what the items after them see
+static bool SameDeclarations(std::span<const Ref<BlockItem>> before, std::span<const Ref<BlockItem>> after) {
+    auto declarations = [](std::span<const Ref<BlockItem>> items) {
+        std::vector<std::pair<std::string_view, int64_t>> found;
+        for (const BlockItem* item : items) {
+            if (const auto* decl = std::get_if<Ref<Declaration>>(&item->Item)) {
+                found.emplace_back((*decl)->Ident, (*decl)->Size);
+            }
+        }
+        return found;
+    };
+    return declarations(before) == declarations(after);
+}
+
+IncrementalCompiler::IncrementalCompiler(const Options& options)
+    : m_Options(options), m_Arena(ArenaChunkSize) {
+    const std::string_view pipeline =
+        m_Options.Passes.empty() ? PassManager::Pipeline(m_Options.OptimizationLevel) : m_Options.Passes;
+    if (const std::string_view pass = PassManager::FirstTransform(pipeline); !pass.empty()) {
+        Error(std::format("Pass '{}' cannot run in an incremental compilation, which takes -O0", pass));
+    }
+}
+
+CompileResult IncrementalCompiler::Compile(std::string source) {
+    m_Source = std::move(source);
+    return Recompile({}, {});
+}
+
+CompileResult IncrementalCompiler::Edit(size_t offset, size_t length, std::string_view text) {
+    if (offset > m_Source.size() || length > m_Source.size() - offset) {
+        const std::string msg = std::format("Edit of {} bytes at {} is outside the source", length, offset);
+        return { false, "", msg + "\n", { Diagnostic{ Diagnostic::Severity::Error, msg } } };
+    }
+    // found in the text before the edit, which the items' locations still refer to
+    std::vector<Span> spans;
+    Change change{};
+    if (m_Program && m_Source.size() - length + text.size() < UINT32_MAX) {
+        change = { static_cast<uint32_t>(offset), static_cast<uint32_t>(offset + length),
+            static_cast<int64_t>(text.size()) - static_cast<int64_t>(length) };
+        spans = FindSpans(change.Begin, change.End);
+    }
+    m_Source.replace(offset, length, text);
+    return Recompile(spans, change);
+}
+
+CompileResult IncrementalCompiler::Recompile(const std::vector<Span>& spans, const Change& change) {
+    CompileResult result;
+    std::ostringstream diagnostics;
+
+    try {
+        DiagnosticScope scope(m_Source, diagnostics, &result.Messages);
+        if (spans.empty() || !Reparse(spans, change)) {
+            Parse();
+        }
+        RunAtDepth(m_Program->NestingDepth, [&] {
+            DiagnosticScope threadScope(m_Source, diagnostics, &result.Messages); // diagnostics are per thread
+            result.Output = Generate();
+        });
+        result.Success = true;
+    } catch (const CompileError& e) {
+        diagnostics << e.what() << "\n";
+        result.Messages.push_back(e.Details());
+    }
+
+    result.Diagnostics = diagnostics.str();
+    return result;
+}
+
+void IncrementalCompiler::Parse() {
+    m_Program = nullptr;
+    m_Code.clear();
+    m_Changes.clear();
+    m_Moved.clear();
+    m_Arena.Reset();
+
+    Lexer lexer(m_Source, m_Options.LexThreads);
+    Parser parser(lexer.Lex(), m_Arena, m_Options);
+    m_Program = parser.ParseProgram();
+    m_ParsedBytes = m_Arena.PoolUsage().second;
+}
+
+// where a location in the item of the global block is in the text now
+uint32_t IncrementalCompiler::Moved(const BlockItem* item, uint32_t offset) const {
+    const auto moved = m_Moved.find(item);
+    for (size_t i = moved == m_Moved.end() ? 0 : moved->second; i < m_Changes.size(); ++i) {
+        if (offset >= m_Changes[i].End) {
+            offset = static_cast<uint32_t>(offset + m_Changes[i].Delta);
+        }
+    }
+    return offset;
+}
+
+void IncrementalCompiler::Move(const BlockItem* item) {
+    const auto moved = m_Moved.find(item);
+    if (moved == m_Moved.end() || moved->second != m_Changes.size()) {
+        MoveLocations(item, [&](SourceLocation& loc) { loc.Offset = Moved(item, loc.Offset); });
+        m_Moved[item] = m_Changes.size();
+    }
+}
+
+// Spans go from the global block inwards, [begin, end) being the text the edit replaced. A statement
+// whose item is the only one the edit touches leads to the next span when the edit is within the
+// braces of a block nested in it.
+std::vector<IncrementalCompiler::Span> IncrementalCompiler::FindSpans(uint32_t begin, uint32_t end) {
+    std::vector<Span> spans;
+    Block* block = m_Program->GlobalBlock;
+    size_t depth = 1;
+
+    while (block && begin > block->Location.Offset && end <= block->End.Offset) {
+        const NodeList<Ref<BlockItem>>& items = block->Items;
+        Span& span = spans.emplace_back(Span{ block, depth, 0, 0, block->Location.Offset + 1, block->End.Offset });
+        if (items.empty()) {
+            break;
+        }
+
+        // the items starting at or before the edit, and those starting before its end; the location of a
+        // declaration is that of its name, so the `int` before it may still be in the edit
+        auto location = [&](const BlockItem* item) {
+            const uint32_t offset = std::visit([](auto node) { return node->Location.Offset; }, item->Item);
+            return depth == 1 ? Moved(item, offset) : offset;
+        };
+        auto startingBy = [&](uint32_t offset) {
+            return std::partition_point(items.begin(), items.end(),
+                       [&](const BlockItem* item) { return location(item) <= offset; }) -
+                   items.begin();
+        };
+        const size_t first = std::max<ptrdiff_t>(startingBy(begin) - 1, 0);
+        size_t last = std::max<ptrdiff_t>(startingBy(end - 1) - 1, first);
+        while (last + 1 < items.size()) {
+            const std::optional<uint32_t> next = ItemStart(items[last + 1], location(items[last + 1]));
+            if (next && *next >= end) {
+                span.End = *next;
+                break;
+            }
+            last++;
+        }
+        span.First = first;
+        span.Count = last - first + 1;
+        if (first != 0) {
+            const std::optional<uint32_t> start = ItemStart(items[first], location(items[first]));
+            if (!start) {
+                spans.pop_back(); // left to the span around it
+                break;
+            }
+            span.Begin = *start;
+        }
+
+        // a block statement within the item, or the body of an if or while in it, with the edit inside
+        block = nullptr;
+        const auto* stmt = std::get_if<Ref<Statement>>(&items[first]->Item);
+        std::vector<std::pair<const Statement*, size_t>> nested;
+        if (span.Count == 1 && stmt) {
+            if (depth == 1) {
+                Move(items[first]);
+            }
+            nested.emplace_back(*stmt, depth + 1);
+        }
+        while (!nested.empty() && !block) {
+            const auto [inner, innerDepth] = nested.back();
+            nested.pop_back();
+            std::visit(overloaded{ [&](Block* b) {
+                                      if (begin > b->Location.Offset && end <= b->End.Offset) {
+                                          block = b;
+                                          depth = innerDepth;
+                                      }
+                                  },
+                           [&](IfStatement* ifStmt) {
+                               nested.emplace_back(ifStmt->Then, innerDepth + 1);
+                               if (ifStmt->Else) {
+                                   nested.emplace_back(ifStmt->Else, innerDepth + 1);
+                               }
+                           },
+                           [&](WhileStatement* whileStmt) { nested.emplace_back(whileStmt->Loop, innerDepth + 1); },
+                           [](ExpressionStatement*) {}, [](ReturnStatement*) {}, [](PrecomputedStatement*) {} },
+                inner->Stmt);
+        }
+    }
+    return spans;
+}
+
+// where the text of an item at `location` starts; the `int` of a declaration is found before its name,
+// unless a comment sits in between
+std::optional<uint32_t> IncrementalCompiler::ItemStart(const BlockItem* item, uint32_t location) const {
+    if (std::holds_alternative<Ref<Statement>>(item->Item)) {
+        return location;
+    }
+    size_t offset = location;
+    while (offset > 0 && std::isspace(static_cast<unsigned char>(m_Source[offset - 1]))) {
+        offset--;
+    }
+    if (offset < 3 || m_Source.compare(offset - 3, 3, "int") != 0) {
+        return std::nullopt;
+    }
+    return static_cast<uint32_t>(offset - 3);
+}
+
+// Text lexed on its own only gives the tokens it has within the whole source when the last of them
+// cannot go on into what follows, and no comment runs past its end.
+bool IncrementalCompiler::EndsBetweenTokens(uint32_t begin, uint32_t end) const {
+    if (begin == end) {
+        return true;
+    }
+    const std::string_view text(m_Source.data() + begin, end - begin);
+    const char last = text.back();
+    if (!std::isspace(static_cast<unsigned char>(last)) && last != ';' && last != '}' && last != '{') {
+        return false;
+    }
+    const size_t line = text.rfind('\n');
+    return text.find("//", line == std::string_view::npos ? 0 : line) == std::string_view::npos;
+}
+
+// The innermost span first: a span that does not lex or parse on its own is left to the one around it,
+// and the global block to Parse(), which reports what is wrong.
+bool IncrementalCompiler::Reparse(const std::vector<Span>& spans, const Change& change) {
+    if (m_Arena.PoolUsage().second > 2 * m_ParsedBytes) {
+        return false; // the nodes that edits replaced outweigh the tree: start over
+    }
+
+    // the items of the global block move with the edit once something reads them; the nested spans are
+    // within an item that FindSpans() brought up to date
+    m_Changes.push_back(change);
+    Block* global = m_Program->GlobalBlock;
+    for (SourceLocation* loc : { &global->Location, &global->End }) {
+        if (loc->Offset >= change.End) {
+            loc->Offset = static_cast<uint32_t>(loc->Offset + change.Delta);
+        }
+    }
+    if (spans.size() > 1) {
+        Move(global->Items[spans.front().First]);
+    }
+
+    for (auto span = spans.rbegin(); span != spans.rend(); ++span) {
+        const uint32_t begin = span->Begin;
+        const uint32_t end = static_cast<uint32_t>(span->End + change.Delta);
+        if (!EndsBetweenTokens(begin, end)) {
+            continue;
+        }
+
+        try {
+            std::vector<Token> tokens = Lexer(std::string_view(m_Source).substr(begin, end - begin)).Lex();
+            for (Token& token : tokens) {
+                token.Location.Offset += begin;
+            }
+            Parser parser(std::move(tokens), m_Arena, m_Options);
+            const Block* items = parser.ParseItems(span->Depth - 1);
+            m_Program->NestingDepth = std::max(m_Program->NestingDepth, parser.NestingDepth());
+            Splice(*span, items, spans.front().First);
+            return true;
+        } catch (const CompileError&) {
+            continue;
+        }
+    }
+    return false;
+}
+
+// Replaces the items of the span with the reparsed ones and drops the code that no longer holds.
+void IncrementalCompiler::Splice(const Span& span, const Block* items, size_t globalItem) {
+    const NodeList<Ref<BlockItem>> before = span.Scope->Items;
+    Ref<BlockItem>* first = before.begin() + span.First;
+    Ref<BlockItem>* last = first + span.Count;
+
+    std::vector<Ref<BlockItem>> spliced(before.begin(), first);
+    spliced.insert(spliced.end(), items->Items.begin(), items->Items.end());
+    spliced.insert(spliced.end(), last, before.end());
+
+    if (span.Scope != m_Program->GlobalBlock) {
+        m_Code.erase(m_Program->GlobalBlock->Items[globalItem]);
+    } else {
+        std::for_each(first, last, [&](const BlockItem* item) {
+            m_Code.erase(item);
+            m_Moved.erase(item);
+        });
+        if (!SameDeclarations({ first, last }, { items->Items.begin(), items->Items.end() })) {
+            std::for_each(last, before.end(), [&](const BlockItem* item) { m_Code.erase(item); });
+        }
+        for (const BlockItem* item : items->Items) {
+            m_Moved[item] = m_Changes.size(); // parsed from the text as it is
+        }
+    }
+    span.Scope->Items = m_Arena.allocList<Ref<BlockItem>>(spliced);
+}
+
+// The declarations of the global block are bound and laid out again, which is cheap, but of its
+// statements only those without code: the others see the same declarations as when they were compiled.
+std::string IncrementalCompiler::Generate() {
+    ScopeStack scopes;
+    SemanticAnalyzer analyzer(m_Program, scopes);
+    std::vector<std::pair<const BlockItem*, int64_t>> stale; // and the frame depth within each
+    analyzer.BeginItems();
+    for (BlockItem* item : m_Program->GlobalBlock->Items) {
+        if (const auto code = m_Code.find(item); code != m_Code.end()) {
+            analyzer.SkipItem(code->second.FrameDepth);
+            continue;
+        }
+        Move(item); // for the diagnostics
+        const int64_t depth = analyzer.AddItem(item);
+        if (std::holds_alternative<Ref<Statement>>(item->Item)) {
+            stale.emplace_back(item, depth);
+        }
+    }
+    analyzer.EndItems();
+    if (m_Options.Bytecode) {
+        return BytecodeCompiler(m_Program, m_Options).Compile().Serialize();
+    }
+
+    Generator generator(m_Program, m_Options);
+    auto emit = [&](Generator::CodePiece piece) {
+        return Generator::EmitPiece(std::move(piece), "label" + std::to_string(m_Pieces++));
+    };
+    for (const auto& [item, depth] : stale) {
+        const Statement* stmt = std::get<Ref<Statement>>(item->Item);
+        m_Code[item] = { emit(generator.GenerateStatementBlocks(stmt)), depth };
+    }
+
+    std::string code = emit(generator.GeneratePrologue());
+    for (const BlockItem* item : m_Program->GlobalBlock->Items) {
+        if (std::holds_alternative<Ref<Statement>>(item->Item)) {
+            code += m_Code.at(item).Code;
+        }
+    }
+    code += emit(generator.GenerateEpilogue());
+    return Generator::Assemble(code, m_Options);
+}
+
+} // namespace Compiler
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ast.h"
+#include "driver.h"
+#include "generator.h"
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Compiler {
+
+// Compiles a source, then edits to it, keeping the syntax tree and the code of each statement of the
+// global block in between. An edit is relexed and reparsed as the run of items it touches in the
+// innermost block around it; when those do not parse on their own (a brace came or went), the run
+// grows to the item around that block, up to the whole program. Only the statements of the global
+// block the edit was in are bound, laid out and generated again, and those after it when it changed
+// the declarations they see; the code of each statement is kept as assembly, labeled apart from the
+// others, so the output is their code put together. The locations of the other items move with the
+// text as they are next read.
+// The tree passes rewrite the whole tree and the layout pass reorders the whole program, so a pipeline
+// with any of them is rejected: the output is that of -O0.
+class IncrementalCompiler {
+  public:
+    explicit IncrementalCompiler(const Options& options); // throws CompileError for any other pipeline
+
+    IncrementalCompiler(const IncrementalCompiler&) = delete;
+    IncrementalCompiler& operator=(const IncrementalCompiler&) = delete;
+
+    CompileResult Compile(std::string source);
+    // replaces `length` bytes at `offset` of the source with `text`
+    CompileResult Edit(size_t offset, size_t length, std::string_view text);
+
+    const std::string& Source() const { return m_Source; }
+
+  private:
+    // items [First, First + Count) of a block nested Depth levels deep, and the text they take up to the
+    // next item, or to the block's braces at either end
+    struct Span {
+        Block* Scope;
+        size_t Depth;
+        size_t First;
+        size_t Count;
+        uint32_t Begin;
+        uint32_t End;
+    };
+
+    // the text of an edit before it, and how much longer it made the source
+    struct Change {
+        uint32_t Begin;
+        uint32_t End;
+        int64_t Delta;
+    };
+
+    CompileResult Recompile(const std::vector<Span>& spans, const Change& change);
+    void Parse();
+    bool Reparse(const std::vector<Span>& spans, const Change& change);
+    uint32_t Moved(const BlockItem* item, uint32_t offset) const;
+    void Move(const BlockItem* item); // brings the locations in an item of the global block up to date
+    std::vector<Span> FindSpans(uint32_t begin, uint32_t end);
+    std::optional<uint32_t> ItemStart(const BlockItem* item, uint32_t location) const;
+    bool EndsBetweenTokens(uint32_t begin, uint32_t end) const;
+    void Splice(const Span& span, const Block* items, size_t globalItem);
+    std::string Generate();
+
+    const Options m_Options;
+    std::string m_Source;
+    ArenaAllocator m_Arena;
+    Program* m_Program = nullptr; // null when the source did not parse
+    size_t m_ParsedBytes = 0;     // the tree after the last full parse, to bound what edits leave behind
+
+    // a statement of the global block as last compiled
+    struct Compiled {
+        std::string Code;       // Generator::EmitPiece()
+        int64_t FrameDepth = 0; // SemanticAnalyzer::AddItem()
+    };
+    std::unordered_map<const BlockItem*, Compiled> m_Code;
+    size_t m_Pieces = 0; // emitted so far, which numbers the labels of the next
+
+    std::vector<Change> m_Changes;                        // the edits since the last full parse
+    std::unordered_map<const BlockItem*, size_t> m_Moved; // by item of the global block: how many of them
+                                                          // its locations moved with, none when not found
+};
+
+} // namespace Compiler
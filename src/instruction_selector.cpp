@@ -0,0 +1,912 @@
+#include "instruction_selector.h"
+#include "block_layout.h"
+#include "utils.h"
+#include <algorithm>
+#include <bit>
+
+namespace Compiler {
+
+static constexpr int64_t Unreachable = INT64_MAX / 8; // the cost of what no rule derives; sums stay finite
+
+static std::string ConditionCode(BinaryOp op) {
+    switch (op) {
+        case BinaryOp::Gt: return "g";
+        case BinaryOp::Ge: return "ge";
+        case BinaryOp::Lt: return "l";
+        case BinaryOp::Le: return "le";
+        case BinaryOp::Eq: return "e";
+        case BinaryOp::Ne: return "ne";
+        default: Error("Unknown operator");
+    }
+}
+
+// the condition of `b op a` that holds when `a op b` does
+static std::string Mirror(const std::string& cc) {
+    if (cc == "g" || cc == "l") {
+        return cc == "g" ? "l" : "g";
+    } else if (cc == "ge" || cc == "le") {
+        return cc == "ge" ? "le" : "ge";
+    }
+    return cc;
+}
+
+static bool IsArithmetic(BinaryOp op) {
+    return op == BinaryOp::Add || op == BinaryOp::Sub || op == BinaryOp::Mul || op == BinaryOp::Div ||
+           op == BinaryOp::Mod;
+}
+
+// a displacement as it follows a register in an address
+static std::string Displacement(int64_t displacement) {
+    if (displacement == 0) {
+        return "";
+    }
+    return (displacement < 0 ? " - " + std::to_string(-displacement) : " + " + std::to_string(displacement));
+}
+
+static uint64_t Magnitude(int64_t value) {
+    return value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+}
+
+// x / d for a constant d that is not a power of two, after Hacker's Delight 10-3: the high word of
+// x * Multiplier, corrected by x when the signs of the multiplier and d differ, shifted right by Shift,
+// plus one when that is negative, so that the quotient rounds toward zero as idiv does.
+struct MagicDivisor {
+    int64_t Multiplier;
+    int Shift;
+};
+
+static MagicDivisor MagicOf(int64_t divisor) {
+    constexpr uint64_t two63 = uint64_t{ 1 } << 63;
+    const uint64_t magnitude = Magnitude(divisor);
+    const uint64_t t = two63 + (static_cast<uint64_t>(divisor) >> 63);
+    const uint64_t nc = t - 1 - t % magnitude; // the largest multiple of the magnitude, less one, below t
+    uint64_t q1 = two63 / nc, r1 = two63 - q1 * nc;
+    uint64_t q2 = two63 / magnitude, r2 = two63 - q2 * magnitude;
+    int p = 63;
+    uint64_t delta;
+    do {
+        p++;
+        q1 *= 2, r1 *= 2;
+        if (r1 >= nc) {
+            q1++, r1 -= nc;
+        }
+        q2 *= 2, r2 *= 2;
+        if (r2 >= magnitude) {
+            q2++, r2 -= magnitude;
+        }
+        delta = magnitude - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    const uint64_t multiplier = q2 + 1;
+    return { static_cast<int64_t>(divisor < 0 ? 0 - multiplier : multiplier), p - 64 };
+}
+
+// x * c without imul: the magnitude of c as 3, 5 or 9 times 3, 5 or 9, by lea, or as 2^Low + 1 or
+// 2^Low - 1 by shift and add, either shifted left by Shift and negated when c is
+struct Product {
+    std::array<int64_t, 2> Lea{}; // factors, or 0
+    int Low = 0;
+    bool Subtract = false;
+    int Shift = 0;
+    bool Negate = false;
+    int64_t Cost = 0;
+};
+
+static std::optional<Product> Decompose(int64_t factor) {
+    const uint64_t magnitude = Magnitude(factor);
+    if (magnitude == 0) {
+        return std::nullopt;
+    }
+    Product product{ .Shift = std::countr_zero(magnitude), .Negate = factor < 0 };
+    const uint64_t odd = magnitude >> product.Shift;
+    product.Cost = (product.Shift > 0) + product.Negate;
+
+    uint64_t rest = odd;
+    size_t leas = 0;
+    for (const int64_t m : { 9, 5, 3 }) {
+        while (leas < product.Lea.size() && rest % m == 0) {
+            product.Lea[leas++] = m;
+            rest /= m;
+        }
+    }
+    if (rest == 1) {
+        product.Cost += static_cast<int64_t>(leas);
+        return product;
+    }
+
+    product.Lea = {};
+    if (std::has_single_bit(odd - 1)) {
+        product.Low = std::countr_zero(odd - 1);
+    } else if (std::has_single_bit(odd + 1)) {
+        product.Low = std::countr_zero(odd + 1);
+        product.Subtract = true;
+    } else {
+        return std::nullopt;
+    }
+    product.Cost += 3;
+    return product;
+}
+
+static void EmitProduct(const Product& product, std::string& code) {
+    for (const int64_t m : product.Lea) {
+        if (m != 0) {
+            code += "lea rax, [rax + rax*" + std::to_string(m - 1) + "]\n";
+        }
+    }
+    if (product.Low > 0) {
+        code += "mov rcx, rax\nshl rax, " + std::to_string(product.Low) + "\n" +
+                (product.Subtract ? "sub" : "add") + " rax, rcx\n";
+    }
+    if (product.Shift > 0) {
+        code += "shl rax, " + std::to_string(product.Shift) + "\n";
+    }
+    if (product.Negate) {
+        code += "neg rax\n";
+    }
+}
+
+// x / ±2^k is an arithmetic shift of x, plus 2^k - 1 when x is negative, so that it rounds toward zero;
+// the remainder keeps the low k bits of the same sum, less what was added
+static void EmitDivideByPowerOfTwo(BinaryOp op, int64_t divisor, std::string& code) {
+    const int k = std::countr_zero(Magnitude(divisor));
+    const std::string shift = std::to_string(k);
+    const std::string complement = std::to_string(64 - k);
+    code += "mov rcx, rax\n";
+    code += k == 1 ? "shr rcx, 63\n" : "sar rcx, 63\nshr rcx, " + complement + "\n";
+    code += "add rax, rcx\n";
+    if (op == BinaryOp::Div) {
+        code += "sar rax, " + shift + "\n";
+        if (divisor < 0) {
+            code += "neg rax\n";
+        }
+        return;
+    }
+    if (k < 32) {
+        code += "and rax, " + std::to_string((int64_t{ 1 } << k) - 1) + "\n";
+    } else if (k == 32) {
+        code += "mov eax, eax\n"; // zero-extends
+    } else {
+        code += "shl rax, " + complement + "\nshr rax, " + complement + "\n";
+    }
+    code += "sub rax, rcx\n";
+}
+
+// one-operand imul leaves the high word of rax * rdx in rdx; the remainder is x less the quotient times d
+static void EmitDivideByConstant(BinaryOp op, int64_t divisor, std::string& code) {
+    const MagicDivisor magic = MagicOf(divisor);
+    code += "mov rcx, rax\nmov rdx, " + std::to_string(magic.Multiplier) + "\nimul rdx\n";
+    if (divisor > 0 && magic.Multiplier < 0) {
+        code += "add rdx, rcx\n";
+    } else if (divisor < 0 && magic.Multiplier > 0) {
+        code += "sub rdx, rcx\n";
+    }
+    if (magic.Shift > 0) {
+        code += "sar rdx, " + std::to_string(magic.Shift) + "\n";
+    }
+    code += "mov rax, rdx\nshr rax, 63\nadd rax, rdx\n";
+    if (op == BinaryOp::Mod) {
+        code += FitsImmediate(divisor) ? "imul rax, rax, " + std::to_string(divisor) + "\n"
+                                       : "mov rdx, " + std::to_string(divisor) + "\nimul rax, rdx\n";
+        code += "sub rcx, rax\nmov rax, rcx\n";
+    }
+}
+
+InstructionSelector::InstructionSelector(const Options& options) : m_Options(options) {}
+
+std::string InstructionSelector::Select(const Expression* expr, Goal goal, std::string& code) {
+    m_Nodes.clear();
+    const int root = Build(expr);
+    const Nonterminal nt = goal == Goal::Value ? Reg : goal == Goal::Condition ? Flags : Effect;
+    Reduce(root, nt, code);
+    return goal == Goal::Condition ? ConditionOf(m_Nodes[root]) : "";
+}
+
+// A mispredicted branch costs about as much as 20 instructions, and the cmov and the store that runs
+// either way as much as 2. Without a profile, or with fewer runs than MinProfiledRuns, the branch is
+// taken to mispredict once in 2.5 runs, about what a branch on data does.
+static constexpr double MispredictCost = 20;
+static constexpr int64_t ConditionalMoveCost = 2;
+static constexpr uint64_t MinProfiledRuns = 16;
+static constexpr double UnprofiledMispredictRate = 0.4;
+
+// rax is loaded with one value after the comparison and cmov takes the other from memory or a
+// register; a value that neither can take as it is is computed beforehand into r9 or r8, which the
+// code of the condition leaves alone
+bool InstructionSelector::SelectConditionalMove(const IfStatement* ifStmt, const AssignmentExpression* value,
+                                                const AssignmentExpression* other, std::string& code) {
+    const auto prints = [&](const AssignmentExpression* store) { return m_Options.Trace && !store->Silent; };
+    if (other ? prints(value) != prints(other) : prints(value)) {
+        return false; // one way prints and the other does not
+    }
+
+    m_Nodes.clear();
+    const int cond = Build(ifStmt->Cond.Get());
+    const int thenFirst = static_cast<int>(m_Nodes.size());
+    const int then = Build(value->Expr.Get());
+    const int elseFirst = static_cast<int>(m_Nodes.size());
+    int otherwise = -1;
+    if (other) {
+        otherwise = Build(other->Expr.Get());
+    } else {
+        otherwise = AddNode({ .What = Node::Kind::Variable, .Decl = value->Decl });
+        m_Built.pop_back();
+    }
+    if (m_Nodes[cond].Stores || !Speculable(thenFirst, then, cond) ||
+        !Speculable(elseFirst, otherwise, cond)) {
+        return false;
+    }
+
+    // either value may be the one loaded, with the condition inverted when it is the then-value
+    const auto loadCost = [&](int node) {
+        return OperandAfterFlags(m_Nodes[node]) ? 0 : m_Nodes[node].Cost[Reg] + 1;
+    };
+    const auto moveCost = [&](int node) {
+        return m_Nodes[node].What != Node::Kind::Constant && OperandAfterFlags(m_Nodes[node])
+                   ? 0
+                   : m_Nodes[node].Cost[Reg] + 1;
+    };
+    const bool inverted = loadCost(then) + moveCost(otherwise) < loadCost(otherwise) + moveCost(then);
+    const int loaded = inverted ? then : otherwise;
+    const int moved = inverted ? otherwise : then;
+
+    const uint64_t runs = ifStmt->Taken + ifStmt->NotTaken;
+    const double mispredictRate = runs >= MinProfiledRuns
+                                      ? static_cast<double>(std::min(ifStmt->Taken, ifStmt->NotTaken)) / runs
+                                      : UnprofiledMispredictRate;
+    if (ConditionalMoveCost + loadCost(loaded) + moveCost(moved) > MispredictCost * mispredictRate) {
+        return false;
+    }
+
+    const auto operand = [&](int node, bool immediate, const std::string& reg) {
+        const std::optional<std::string> direct = OperandAfterFlags(m_Nodes[node]);
+        if (direct && (immediate || m_Nodes[node].What != Node::Kind::Constant)) {
+            return *direct;
+        }
+        Reduce(node, Reg, code);
+        code += "mov " + reg + ", rax\n";
+        return reg;
+    };
+    const std::string load = operand(loaded, true, "r9");
+    const std::string move = operand(moved, false, "r8");
+    Reduce(cond, Flags, code);
+    const std::string cc = ConditionOf(m_Nodes[cond]);
+
+    code += "mov rax, " + load + "\n"; // keeps the flags, where xor would not
+    code += "cmov" + (inverted ? InvertCondition(cc) : cc) + " rax, " + move + "\n";
+    if (!value->DeadStore || (other && !other->DeadStore)) {
+        code += "mov " + MemoryOf(Node{ .What = Node::Kind::Variable, .Decl = value->Decl }) + ", rax\n";
+    }
+    if (prints(value)) {
+        code += "mov rdi, rax\ncall print\n";
+    }
+    return true;
+}
+
+// Operator chains become left-leaning binary nodes and parentheses disappear. Like the rest of the
+// generator, this runs from an explicit task stack, so nesting depth does not matter.
+int InstructionSelector::Build(BuildTask start) {
+    m_BuildTasks.push_back(start);
+
+    while (!m_BuildTasks.empty()) {
+        const BuildTask task = m_BuildTasks.back();
+        m_BuildTasks.pop_back();
+
+        auto pop = [&] {
+            const int node = m_Built.back();
+            m_Built.pop_back();
+            return node;
+        };
+        std::visit(overloaded{ [&](const Expression* e) {
+                                  const AssignmentExpression* assign = e->Expr;
+                                  if (assign->Ident) {
+                                      m_BuildTasks.emplace_back(Assignment{ assign });
+                                  }
+                                  m_BuildTasks.emplace_back(assign->Expr.Get());
+                                  if (assign->Index) {
+                                      m_BuildTasks.emplace_back(assign->Index.Get());
+                                  }
+                              },
+                       [&](const EqualityExpression* e) { ScheduleOperands(e); },
+                       [&](const RelationalExpression* e) { ScheduleOperands(e); },
+                       [&](const AdditiveExpression* e) { ScheduleOperands(e); },
+                       [&](const MultiplicativeExpression* e) { ScheduleOperands(e); },
+                       [&](const PostfixExpression* e) { m_BuildTasks.emplace_back(e->Prim.Get()); },
+                       [&](const Primary* primary) {
+                           if (const auto* i = std::get_if<int64_t>(&primary->Value)) {
+                               AddNode({ .What = Node::Kind::Constant, .Value = *i });
+                           } else if (const auto* inner = std::get_if<Ref<Expression>>(&primary->Value)) {
+                               m_BuildTasks.emplace_back(inner->Get());
+                           } else if (primary->Index) {
+                               m_BuildTasks.emplace_back(Load{ primary });
+                               m_BuildTasks.emplace_back(primary->Index.Get());
+                           } else {
+                               AddNode({ .What = Node::Kind::Variable, .Decl = primary->Decl });
+                           }
+                       },
+                       [&](BinaryOp op) {
+                           const int right = pop();
+                           const int left = pop();
+                           AddNode({ .What = Node::Kind::Binary,
+                               .Op = op,
+                               .Left = left,
+                               .Right = right,
+                               .Stores = m_Nodes[left].Stores || m_Nodes[right].Stores,
+                               .Traps = Faults(op, right) || m_Nodes[left].Traps || m_Nodes[right].Traps });
+                       },
+                       [&](Load load) {
+                           const int index = pop();
+                           AddNode({ .What = Node::Kind::Element,
+                               .Decl = load.Element->Decl,
+                               .Left = index,
+                               .Stores = m_Nodes[index].Stores,
+                               .Traps = true });
+                       },
+                       [&](Assignment assignment) {
+                           const int value = pop();
+                           const int index = assignment.Store->Index ? pop() : -1;
+                           AddNode({ .What = Node::Kind::Assign,
+                               .Decl = assignment.Store->Decl,
+                               .Store = assignment.Store,
+                               .Left = index,
+                               .Right = value,
+                               .Stores = true,
+                               .Traps = index >= 0 || m_Nodes[value].Traps });
+                       } },
+            task);
+    }
+
+    const int root = m_Built.back();
+    m_Built.pop_back();
+    return root;
+}
+
+// Left, then each right operand followed by the operator that combines it with the value so far. The
+// tasks are run from the back, so they are pushed in reverse.
+template <typename Expr>
+void InstructionSelector::ScheduleOperands(const Expr* expr) {
+    for (auto it = expr->Right.rbegin(); it != expr->Right.rend(); ++it) {
+        m_BuildTasks.emplace_back(it->first);
+        m_BuildTasks.emplace_back(it->second.Get());
+    }
+    m_BuildTasks.emplace_back(expr->Left.Get());
+}
+
+int InstructionSelector::AddNode(Node node) {
+    Label(node);
+    m_Nodes.push_back(node);
+    m_Built.push_back(static_cast<int>(m_Nodes.size()) - 1);
+    return m_Built.back();
+}
+
+void InstructionSelector::Label(Node& node) {
+    node.Cost.fill(Unreachable);
+    node.Rules.fill(Rule::None);
+    node.Swapped.fill(false);
+
+    switch (node.What) {
+        case Node::Kind::Constant:
+            if (FitsImmediate(node.Value)) {
+                Derive(node, Imm, Rule::ImmConstant, 0);
+            }
+            Derive(node, Reg, Rule::RegConstant, 1);
+            break;
+        case Node::Kind::Variable: Derive(node, Mem, Rule::MemVariable, 0); break;
+        case Node::Kind::Element:
+            if (ElementDisplacement(node)) {
+                Derive(node, Mem, Rule::MemElement, 0);
+            } else if (m_Nodes[node.Left].What == Node::Kind::Variable) {
+                Derive(node, Mem, Rule::MemElementIndexed, 1);
+            }
+            Derive(node, Reg, Rule::RegElement, m_Nodes[node.Left].Cost[Reg] + 1);
+            break;
+        case Node::Kind::Binary: LabelBinary(node); break;
+        case Node::Kind::Assign: LabelAssign(node); break;
+    }
+
+    // chain rules, in an order that needs a single pass: nothing derived from Reg makes Reg cheaper
+    Derive(node, Reg, Rule::RegMem, node.Cost[Mem] + 1);
+    Derive(node, Reg, Rule::RegScaled, node.Cost[Scaled] + 1);
+    Derive(node, Reg, Rule::RegBaseIndex, node.Cost[BaseIndex] + 1);
+    Derive(node, Reg, Rule::RegFlags, node.Cost[Flags] + 2);
+    Derive(node, Scaled, Rule::ScaledReg, node.Cost[Reg]);
+    Derive(node, Flags, Rule::FlagsReg, node.Cost[Reg] + 1);
+    Derive(node, Effect, Rule::EffectReg, node.Cost[Reg]);
+    Derive(node, Effect, Rule::EffectFlags, node.Cost[Flags]);
+}
+
+// Costs count instructions, with a multiply as 3 and a division as 20. A constant divisor but 0 and -1
+// does without the division: see MagicOf. Operators that commute, the
+// comparisons among them with their condition mirrored, match with the operands swapped as well.
+void InstructionSelector::LabelBinary(Node& node) {
+    const auto match = [&](const Node& a, const Node& b, bool swapped) {
+        const auto derive = [&](Nonterminal nt, Rule rule, int64_t cost) {
+            Derive(node, nt, rule, cost, swapped);
+        };
+        const bool constant = b.What == Node::Kind::Constant;
+
+        switch (node.Op) {
+            case BinaryOp::Add:
+            case BinaryOp::Sub:
+                if (node.Op == BinaryOp::Add) {
+                    derive(Reg, Rule::AddImm, a.Cost[Reg] + b.Cost[Imm] + 1);
+                    derive(Reg, Rule::AddMem, a.Cost[Reg] + b.Cost[Mem] + 1);
+                    derive(Reg, Rule::AddReg, a.Cost[Reg] + b.Cost[Reg] + 3);
+                    derive(BaseIndex, Rule::BaseIndexAdd, a.Cost[Reg] + b.Cost[Scaled] + 2);
+                } else {
+                    derive(Reg, Rule::SubImm, a.Cost[Reg] + b.Cost[Imm] + 1);
+                    derive(Reg, Rule::SubMem, a.Cost[Reg] + b.Cost[Mem] + 1);
+                    derive(Reg, Rule::SubReg, a.Cost[Reg] + b.Cost[Reg] + 4);
+                    derive(Reg, Rule::SubFromImm, a.Cost[Imm] + b.Cost[Reg] + 2);
+                    if (!b.Stores) { // a is read after b
+                        derive(Reg, Rule::SubFromMem, a.Cost[Mem] + b.Cost[Reg] + 2);
+                    }
+                }
+                if (constant && b.Value != INT32_MIN) { // negated for Sub
+                    derive(Reg, Rule::LeaScaled, a.Cost[Scaled] + b.Cost[Imm] + 1);
+                    derive(Reg, Rule::LeaBaseIndex, a.Cost[BaseIndex] + b.Cost[Imm] + 1);
+                }
+                break;
+            case BinaryOp::Mul:
+                derive(Reg, Rule::MulImm, a.Cost[Reg] + b.Cost[Imm] + 3);
+                derive(Reg, Rule::MulMem, a.Cost[Reg] + b.Cost[Mem] + 3);
+                derive(Reg, Rule::MulReg, a.Cost[Reg] + b.Cost[Reg] + 5);
+                if (constant) {
+                    const int64_t factor = b.Value;
+                    if (factor == 0 || factor == -1) {
+                        derive(Reg, factor == 0 ? Rule::MulZero : Rule::MulNegate, a.Cost[Reg] + 1);
+                    } else if (factor == 1) {
+                        derive(Reg, Rule::MulOne, a.Cost[Reg]);
+                    } else if (factor > 0 && std::has_single_bit(static_cast<uint64_t>(factor))) {
+                        derive(Reg, Rule::MulShift, a.Cost[Reg] + 1);
+                    } else if (const std::optional<Product> product = Decompose(factor)) {
+                        derive(Reg, Rule::MulSequence, a.Cost[Reg] + product->Cost);
+                    }
+                    if (factor == 2 || factor == 4 || factor == 8) {
+                        derive(Scaled, Rule::ScaledMul, a.Cost[Reg]);
+                    } else if (factor == 3 || factor == 5 || factor == 9) {
+                        derive(BaseIndex, Rule::BaseIndexMul, a.Cost[Reg]);
+                    }
+                }
+                break;
+            case BinaryOp::Div:
+            case BinaryOp::Mod:
+                derive(Reg, Rule::DivImm, a.Cost[Reg] + b.Cost[Imm] + 22);
+                derive(Reg, Rule::DivMem, a.Cost[Reg] + b.Cost[Mem] + 21);
+                derive(Reg, Rule::DivReg, a.Cost[Reg] + b.Cost[Reg] + 24);
+                if (constant && !Faults(node.Op, node.Right)) {
+                    const bool mod = node.Op == BinaryOp::Mod;
+                    if (b.Value == 1) {
+                        derive(Reg, Rule::DivOne, a.Cost[Reg] + mod);
+                    } else if (std::has_single_bit(Magnitude(b.Value))) {
+                        derive(Reg, Rule::DivShift, a.Cost[Reg] + (mod ? 6 : 5 + (b.Value < 0)));
+                    } else {
+                        derive(Reg, Rule::DivMagic, a.Cost[Reg] + (mod ? 14 : 9));
+                    }
+                }
+                break;
+            default:
+                derive(Flags, Rule::CmpImm, a.Cost[Reg] + b.Cost[Imm] + 1);
+                derive(Flags, Rule::CmpMem, a.Cost[Reg] + b.Cost[Mem] + 1);
+                derive(Flags, Rule::CmpReg, a.Cost[Reg] + b.Cost[Reg] + 3);
+                derive(Flags, Rule::CmpMemImm, a.Cost[Mem] + b.Cost[Imm] + 1);
+                break;
+        }
+    };
+
+    const Node& left = m_Nodes[node.Left];
+    const Node& right = m_Nodes[node.Right];
+    match(left, right, false);
+    const bool commutes = node.Op == BinaryOp::Add || node.Op == BinaryOp::Mul || !IsArithmetic(node.Op);
+    if (commutes && MayReorder(left, right)) {
+        match(right, left, true);
+    }
+}
+
+void InstructionSelector::LabelAssign(Node& node) {
+    const Node& value = m_Nodes[node.Right];
+    const int64_t print = Prints(node) ? 2 : 0;
+
+    if (node.Left >= 0) {
+        const Node& index = m_Nodes[node.Left];
+        if (ElementDisplacement(node)) {
+            Derive(node, Reg, Rule::StoreElementAt, value.Cost[Reg] + 1 + print);
+            Derive(node, Effect, Rule::StoreElementImmAt, value.Cost[Imm] + 1 + print);
+        }
+        Derive(node, Reg, Rule::StoreElementReg, index.Cost[Reg] + value.Cost[Reg] + 3 + print);
+        if (index.What == Node::Kind::Variable && !value.Stores) { // the index is read after the value
+            Derive(node, Reg, Rule::StoreElementIndexed, value.Cost[Reg] + 2 + print);
+        }
+        Derive(node, Effect, Rule::StoreElementImm, index.Cost[Reg] + value.Cost[Imm] + 1 + print);
+        return;
+    }
+
+    Derive(node, Reg, Rule::StoreReg, value.Cost[Reg] + 1 + print);
+    Derive(node, Effect, Rule::StoreImm, value.Cost[Imm] + 1 + print);
+
+    // x = x + e, x = e + x and x = x - e, on x in place
+    if (node.Store->DeadStore || value.What != Node::Kind::Binary ||
+        (value.Op != BinaryOp::Add && value.Op != BinaryOp::Sub)) {
+        return;
+    }
+    for (const bool swapped : { false, true }) {
+        const Node& variable = m_Nodes[swapped ? value.Right : value.Left];
+        const Node& other = m_Nodes[swapped ? value.Left : value.Right];
+        if (variable.What != Node::Kind::Variable || variable.Decl != node.Decl ||
+            (swapped && value.Op == BinaryOp::Sub)) {
+            continue;
+        }
+        Derive(node, Effect, Rule::UpdateImm, other.Cost[Imm] + 1 + print, swapped);
+        if (swapped || !other.Stores) { // x is read after e
+            Derive(node, Effect, Rule::UpdateReg, other.Cost[Reg] + 1 + print, swapped);
+        }
+    }
+}
+
+void InstructionSelector::Derive(Node& node, Nonterminal nt, Rule rule, int64_t cost, bool swapped) {
+    if (cost < node.Cost[nt] && cost < Unreachable) {
+        node.Cost[nt] = cost;
+        node.Rules[nt] = rule;
+        node.Swapped[nt] = swapped;
+    }
+}
+
+bool InstructionSelector::Prints(const Node& assign) const {
+    return m_Options.Trace && (assign.Left >= 0 || !assign.Store->Silent);
+}
+
+// Whether the code of `first` may run after that of `second`: a constant has no code, and otherwise
+// neither may assign, nor may both fault, which would change the signal the program dies of.
+bool InstructionSelector::MayReorder(const Node& first, const Node& second) const {
+    return first.What == Node::Kind::Constant ||
+           (!first.Stores && !second.Stores && !(first.Traps && second.Traps));
+}
+
+// idiv faults on a zero divisor and on INT64_MIN / -1, so a division may unless its divisor is a constant
+// other than these
+bool InstructionSelector::Faults(BinaryOp op, int right) const {
+    const Node& divisor = m_Nodes[right];
+    return (op == BinaryOp::Div || op == BinaryOp::Mod) &&
+           (divisor.What != Node::Kind::Constant || divisor.Value == 0 || divisor.Value == -1);
+}
+
+// Whether the value of nodes first to last may be computed when the program would not: it must not
+// assign or divide where that may fault, and its elements must be within bounds, at a constant index, or
+// read by the condition, nodes 0 to cond, already.
+bool InstructionSelector::Speculable(int first, int last, int cond) const {
+    const auto readByCondition = [&](const Node& element) {
+        for (int i = 0; i <= cond; i++) {
+            const Node& read = m_Nodes[i];
+            if (read.What == Node::Kind::Element && read.Decl == element.Decl &&
+                m_Nodes[read.Left].What == Node::Kind::Variable &&
+                m_Nodes[read.Left].Decl == m_Nodes[element.Left].Decl) {
+                return true;
+            }
+        }
+        return false;
+    };
+    for (int i = first; i <= last; i++) {
+        const Node& node = m_Nodes[i];
+        if (node.What == Node::Kind::Assign ||
+            (node.What == Node::Kind::Binary && Faults(node.Op, node.Right))) {
+            return false;
+        }
+        if (node.What == Node::Kind::Element) {
+            const Node& index = m_Nodes[node.Left];
+            const bool inBounds =
+                index.What == Node::Kind::Constant && index.Value >= 0 && index.Value < node.Decl->Size;
+            if (!inBounds && !(index.What == Node::Kind::Variable && readByCondition(node))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// an operand that `mov rax` takes as it is, so it can be loaded without touching the flags
+std::optional<std::string> InstructionSelector::OperandAfterFlags(const Node& node) const {
+    if (node.What == Node::Kind::Constant) {
+        return ImmediateOf(node);
+    } else if (node.Rules[Mem] == Rule::MemVariable || node.Rules[Mem] == Rule::MemElement) {
+        return MemoryOf(node);
+    }
+    return std::nullopt;
+}
+
+// [rbp + displacement] of an element at a constant index, if that fits an instruction
+std::optional<int64_t> InstructionSelector::ElementDisplacement(const Node& element) const {
+    const Node& index = m_Nodes[element.Left];
+    if (index.What != Node::Kind::Constant || index.Value < INT32_MIN || index.Value > INT32_MAX) {
+        return std::nullopt;
+    }
+    const int64_t displacement = index.Value * 8 - element.Decl->Offset;
+    if (!FitsImmediate(displacement)) {
+        return std::nullopt;
+    }
+    return displacement;
+}
+
+// Runs the rules of the cover from an explicit stack: the operands a rule reduces, the left one
+// pushed while the right one is computed, then the rule's own instructions.
+void InstructionSelector::Reduce(int root, Nonterminal goal, std::string& code) {
+    m_ReduceTasks.push_back({ root, goal, 0 });
+
+    while (!m_ReduceTasks.empty()) {
+        const ReduceTask task = m_ReduceTasks.back();
+        m_ReduceTasks.pop_back();
+
+        const Node& node = m_Nodes[task.Node];
+        const Operands operands = OperandsOf(node, task.Goal);
+        if (task.Step < operands.Count) {
+            if (task.Step == 1 && operands.Spill) {
+                code += "push rax\n";
+            }
+            m_ReduceTasks.push_back({ task.Node, task.Goal, task.Step + 1 });
+            m_ReduceTasks.push_back({ operands.Of[task.Step].first, operands.Of[task.Step].second, 0 });
+            continue;
+        }
+        EmitRule(node, task.Goal, code);
+    }
+}
+
+InstructionSelector::Operands InstructionSelector::OperandsOf(const Node& node, Nonterminal goal) const {
+    const int self = static_cast<int>(&node - m_Nodes.data());
+    const int a = node.Swapped[goal] ? node.Right : node.Left;
+    const int b = node.Swapped[goal] ? node.Left : node.Right;
+    const auto one = [](int operand, Nonterminal nt) { return Operands{ { { { operand, nt } } }, 1 }; };
+    const auto two = [](int first, Nonterminal firstNt, int second, Nonterminal secondNt) {
+        return Operands{ { { { first, firstNt }, { second, secondNt } } }, 2, true };
+    };
+
+    switch (node.Rules[goal]) {
+        case Rule::RegElement: return one(node.Left, Reg);
+        case Rule::RegScaled: return one(self, Scaled);
+        case Rule::RegBaseIndex: return one(self, BaseIndex);
+        case Rule::RegFlags:
+        case Rule::EffectFlags: return one(self, Flags);
+        case Rule::ScaledReg:
+        case Rule::FlagsReg:
+        case Rule::EffectReg: return one(self, Reg);
+        case Rule::AddImm:
+        case Rule::AddMem:
+        case Rule::SubImm:
+        case Rule::SubMem:
+        case Rule::MulImm:
+        case Rule::MulMem:
+        case Rule::DivImm:
+        case Rule::DivMem:
+        case Rule::MulZero:
+        case Rule::MulOne:
+        case Rule::MulNegate:
+        case Rule::MulShift:
+        case Rule::MulSequence:
+        case Rule::DivOne:
+        case Rule::DivShift:
+        case Rule::DivMagic:
+        case Rule::ScaledMul:
+        case Rule::BaseIndexMul:
+        case Rule::CmpImm:
+        case Rule::CmpMem: return one(a, Reg);
+        case Rule::SubFromImm:
+        case Rule::SubFromMem: return one(b, Reg);
+        case Rule::AddReg:
+        case Rule::SubReg:
+        case Rule::MulReg:
+        case Rule::DivReg:
+        case Rule::CmpReg: return two(a, Reg, b, Reg);
+        case Rule::BaseIndexAdd: return two(a, Reg, b, Scaled);
+        case Rule::LeaScaled: return one(a, Scaled);
+        case Rule::LeaBaseIndex: return one(a, BaseIndex);
+        case Rule::StoreReg:
+        case Rule::StoreElementAt:
+        case Rule::StoreElementIndexed: return one(node.Right, Reg);
+        case Rule::StoreElementReg: return two(node.Left, Reg, node.Right, Reg);
+        case Rule::StoreElementImm: return one(node.Left, Reg);
+        case Rule::UpdateReg: {
+            const Node& value = m_Nodes[node.Right];
+            return one(node.Swapped[goal] ? value.Left : value.Right, Reg);
+        }
+        default: return {};
+    }
+}
+
+void InstructionSelector::EmitRule(const Node& node, Nonterminal goal, std::string& code) const {
+    const Rule rule = node.Rules[goal];
+    const auto a = [&]() -> const Node& { return OperandA(node, goal); };
+    const auto b = [&]() -> const Node& { return OperandB(node, goal); };
+    const auto divide = [&](const std::string& divisor) {
+        code += "cqo\nidiv " + divisor + "\n";
+        if (node.Op == BinaryOp::Mod) {
+            code += "mov rax, rdx\n";
+        }
+    };
+    // print returns its argument, so a value in rax is still there afterwards
+    const auto print = [&](const std::string& value) {
+        if (Prints(node)) {
+            code += "mov rdi, " + value + "\ncall print\n";
+        }
+    };
+    const auto store = [&](const std::string& slot, const std::string& value) {
+        if (!node.Store->DeadStore) {
+            code += "mov " + slot + ", " + value + "\n";
+        }
+    };
+    const Node* memory = MemoryOperand(node, goal);
+    if (memory && memory->Rules[Mem] == Rule::MemElementIndexed) {
+        code += "mov rcx, " + MemoryOf(m_Nodes[memory->Left]) + "\n";
+    }
+
+    switch (rule) {
+        case Rule::RegConstant:
+            if (node.Value == 0) {
+                code += "xor eax, eax\n";
+            } else if (node.Value > 0 && node.Value <= UINT32_MAX) {
+                code += "mov eax, " + std::to_string(node.Value) + "\n"; // zero-extended, and shorter
+            } else {
+                code += "mov rax, " + std::to_string(node.Value) + "\n";
+            }
+            break;
+        case Rule::RegElement: code += "mov rax, " + ElementSlot(node, "rax") + "\n"; break;
+        case Rule::RegMem: code += "mov rax, " + MemoryOf(node) + "\n"; break;
+        case Rule::RegScaled:
+            if (ScaleOf(node) != 1) {
+                code += "shl rax, " +
+                        std::to_string(std::countr_zero(static_cast<uint64_t>(ScaleOf(node)))) + "\n";
+            }
+            break;
+        case Rule::RegBaseIndex: code += "lea rax, [" + AddressOf(node, BaseIndex) + "]\n"; break;
+        case Rule::RegFlags: code += "set" + ConditionOf(node) + " al\nmovzx eax, al\n"; break;
+        case Rule::FlagsReg: code += "test rax, rax\n"; break;
+
+        case Rule::AddImm: code += "add rax, " + ImmediateOf(b()) + "\n"; break;
+        case Rule::AddMem: code += "add rax, " + MemoryOf(b()) + "\n"; break;
+        case Rule::AddReg: code += "pop rcx\nadd rax, rcx\n"; break;
+        case Rule::SubImm: code += "sub rax, " + ImmediateOf(b()) + "\n"; break;
+        case Rule::SubMem: code += "sub rax, " + MemoryOf(b()) + "\n"; break;
+        case Rule::SubReg: code += "pop rcx\nsub rcx, rax\nmov rax, rcx\n"; break;
+        case Rule::SubFromImm: code += "neg rax\nadd rax, " + ImmediateOf(a()) + "\n"; break;
+        case Rule::SubFromMem: code += "neg rax\nadd rax, " + MemoryOf(a()) + "\n"; break;
+        case Rule::MulImm: code += "imul rax, rax, " + ImmediateOf(b()) + "\n"; break;
+        case Rule::MulMem: code += "imul rax, " + MemoryOf(b()) + "\n"; break;
+        case Rule::MulReg: code += "pop rcx\nimul rax, rcx\n"; break;
+        case Rule::MulZero: code += "xor eax, eax\n"; break;
+        case Rule::MulNegate: code += "neg rax\n"; break;
+        case Rule::MulShift:
+            code += "shl rax, " + std::to_string(std::countr_zero(static_cast<uint64_t>(b().Value))) + "\n";
+            break;
+        case Rule::DivImm:
+            code += "mov rcx, " + ImmediateOf(b()) + "\n";
+            divide("rcx");
+            break;
+        case Rule::DivMem: divide(MemoryOf(b())); break;
+        case Rule::MulSequence: EmitProduct(*Decompose(b().Value), code); break;
+        case Rule::DivOne:
+            if (node.Op == BinaryOp::Mod) {
+                code += "xor eax, eax\n";
+            }
+            break;
+        case Rule::DivShift: EmitDivideByPowerOfTwo(node.Op, b().Value, code); break;
+        case Rule::DivMagic: EmitDivideByConstant(node.Op, b().Value, code); break;
+        case Rule::DivReg:
+            code += "mov rcx, rax\npop rax\n";
+            divide("rcx");
+            break;
+
+        case Rule::BaseIndexAdd: code += "pop rcx\n"; break;
+        case Rule::LeaScaled:
+        case Rule::LeaBaseIndex: {
+            const int64_t displacement = node.Op == BinaryOp::Sub ? -b().Value : b().Value;
+            code += "lea rax, [" + AddressOf(a(), rule == Rule::LeaScaled ? Scaled : BaseIndex) +
+                    Displacement(displacement) + "]\n";
+            break;
+        }
+
+        case Rule::CmpImm: code += "cmp rax, " + ImmediateOf(b()) + "\n"; break;
+        case Rule::CmpMem: code += "cmp rax, " + MemoryOf(b()) + "\n"; break;
+        case Rule::CmpReg: code += "pop rcx\ncmp rcx, rax\n"; break;
+        case Rule::CmpMemImm: code += "cmp " + MemoryOf(a()) + ", " + ImmediateOf(b()) + "\n"; break;
+
+        case Rule::StoreReg:
+        case Rule::StoreElementAt:
+            store(MemoryOf(node), "rax");
+            print("rax");
+            break;
+        case Rule::StoreImm:
+        case Rule::StoreElementImmAt:
+            store(MemoryOf(node), ImmediateOf(m_Nodes[node.Right]));
+            print(ImmediateOf(m_Nodes[node.Right]));
+            break;
+        case Rule::StoreElementReg:
+            code += "pop rcx\n";
+            store(ElementSlot(node, "rcx"), "rax");
+            print("rax");
+            break;
+        case Rule::StoreElementIndexed:
+            if (!node.Store->DeadStore) {
+                code += "mov rcx, " + MemoryOf(m_Nodes[node.Left]) + "\n"; // after the value
+            }
+            store(ElementSlot(node, "rcx"), "rax");
+            print("rax");
+            break;
+        case Rule::StoreElementImm:
+            store(ElementSlot(node, "rax"), ImmediateOf(m_Nodes[node.Right]));
+            print(ImmediateOf(m_Nodes[node.Right]));
+            break;
+        case Rule::UpdateImm:
+        case Rule::UpdateReg: {
+            const Node& value = m_Nodes[node.Right];
+            const Node& other = m_Nodes[node.Swapped[goal] ? value.Left : value.Right];
+            code += (value.Op == BinaryOp::Add ? "add " : "sub ") + MemoryOf(node) + ", " +
+                    (rule == Rule::UpdateImm ? ImmediateOf(other) : "rax") + "\n";
+            print(MemoryOf(node));
+            break;
+        }
+        default: break; // operands that instructions take as they are, and chain rules without code
+    }
+}
+
+std::string InstructionSelector::ImmediateOf(const Node& node) const {
+    return std::to_string(node.Value);
+}
+
+// a variable or an element read or assigned; EmitRule loads rcx for an element indexed by a variable
+std::string InstructionSelector::MemoryOf(const Node& node) const {
+    if (node.Rules[Mem] == Rule::MemElementIndexed) {
+        return ElementSlot(node, "rcx");
+    } else if (node.What == Node::Kind::Variable || (node.What == Node::Kind::Assign && node.Left < 0)) {
+        return "QWORD [rbp - " + std::to_string(node.Decl->Offset) + "]";
+    }
+    return "QWORD [rbp" + Displacement(*ElementDisplacement(node)) + "]";
+}
+
+// the operand that the rule of the node for goal reads from memory, if any
+const InstructionSelector::Node* InstructionSelector::MemoryOperand(
+    const Node& node, Nonterminal goal) const {
+    switch (node.Rules[goal]) {
+        case Rule::RegMem: return &node;
+        case Rule::AddMem:
+        case Rule::SubMem:
+        case Rule::MulMem:
+        case Rule::DivMem:
+        case Rule::CmpMem: return &OperandB(node, goal);
+        case Rule::SubFromMem:
+        case Rule::CmpMemImm: return &OperandA(node, goal);
+        default: return nullptr;
+    }
+}
+
+std::string InstructionSelector::ElementSlot(const Node& node, const std::string& indexReg) const {
+    return "QWORD [rbp + " + indexReg + "*8 - " + std::to_string(node.Decl->Offset) + "]";
+}
+
+// the registers of an address that the node's derivation of nt leaves for lea
+std::string InstructionSelector::AddressOf(const Node& node, Nonterminal nt) const {
+    if (nt == Scaled) {
+        const int64_t scale = ScaleOf(node);
+        return scale == 1 ? "rax" : "rax*" + std::to_string(scale);
+    } else if (node.Rules[nt] == Rule::BaseIndexMul) {
+        return "rax + rax*" + std::to_string(OperandB(node, nt).Value - 1);
+    }
+    return "rcx + " + AddressOf(OperandB(node, nt), Scaled); // BaseIndexAdd, the left operand popped
+}
+
+int64_t InstructionSelector::ScaleOf(const Node& node) const {
+    return node.Rules[Scaled] == Rule::ScaledMul ? OperandB(node, Scaled).Value : 1;
+}
+
+std::string InstructionSelector::ConditionOf(const Node& node) const {
+    if (node.Rules[Flags] == Rule::FlagsReg) {
+        return "nz";
+    }
+    const std::string cc = ConditionCode(node.Op);
+    return node.Swapped[Flags] ? Mirror(cc) : cc;
+}
+
+const InstructionSelector::Node& InstructionSelector::OperandA(const Node& node, Nonterminal nt) const {
+    return m_Nodes[node.Swapped[nt] ? node.Right : node.Left];
+}
+
+const InstructionSelector::Node& InstructionSelector::OperandB(const Node& node, Nonterminal nt) const {
+    return m_Nodes[node.Swapped[nt] ? node.Left : node.Right];
+}
+
+} // namespace Compiler
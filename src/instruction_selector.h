@@ -0,0 +1,151 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace Compiler {
+
+// x86-64 immediates are 32 bits, sign-extended to 64
+inline bool FitsImmediate(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+// Instruction selection for scalar expressions by bottom-up tree rewriting. An expression becomes a
+// binary tree whose nodes are labeled, children first, with the cheapest cost of deriving each
+// nonterminal from the rules that match there: a value in rax, an immediate, a memory operand, an
+// address for lea (`rax*scale`, `base + rax*scale`) or the flags of a comparison. Reducing the root
+// top down emits the cover of least cost.
+// Values live in rax. A rule that needs both operands in registers pushes the left one while the right
+// one is computed and pops it into rcx, which print (the only call) may clobber in between. Operands
+// are evaluated in source order unless the first is a constant, or neither assigns and at most one of
+// them may fault.
+class InstructionSelector {
+  public:
+    // what the code of an expression leaves behind
+    enum class Goal {
+        Value,     // its value in rax
+        Condition, // flags, under the returned condition code it is nonzero
+        Effect,    // nothing, it only runs for its assignments
+    };
+
+    explicit InstructionSelector(const Options& options);
+
+    // appends the code of expr to `code`; returns the condition code for Goal::Condition
+    std::string Select(const Expression* expr, Goal goal, std::string& code);
+
+    // `if (cond) x = value; else x = other;` as cmp and cmov, where `other` is null for an if without
+    // an else. Both values are computed whichever way the condition goes, so this only appends code,
+    // and returns true, when neither may assign or fault and computing them costs less than the
+    // branch would mispredict: by the profile of the if where it has one.
+    bool SelectConditionalMove(const IfStatement* ifStmt, const AssignmentExpression* value,
+                               const AssignmentExpression* other, std::string& code);
+
+  private:
+    enum Nonterminal : uint8_t { Reg, Imm, Mem, Scaled, BaseIndex, Flags, Effect, NonterminalCount };
+
+    enum class Rule : uint8_t {
+        None,
+        // leaves
+        ImmConstant, RegConstant, MemVariable, MemElement, MemElementIndexed, RegElement,
+        // chain rules, from one nonterminal of a node to another
+        RegMem, RegScaled, RegBaseIndex, RegFlags, ScaledReg, FlagsReg, EffectReg, EffectFlags,
+        // Reg <- op(Reg, Imm | Mem | Reg)
+        AddImm, AddMem, AddReg, SubImm, SubMem, SubReg, MulImm, MulMem, MulReg, DivImm, DivMem, DivReg,
+        SubFromImm, SubFromMem, // Reg <- Sub(Imm | Mem, Reg)
+        MulZero, MulOne, MulNegate, MulShift, MulSequence,
+        DivOne, DivShift, DivMagic, // by a constant, without idiv
+        // addresses, and lea of them with a displacement
+        ScaledMul, BaseIndexMul, BaseIndexAdd, LeaScaled, LeaBaseIndex,
+        // Flags <- comparison
+        CmpImm, CmpMem, CmpReg, CmpMemImm,
+        // assignments; Update is `x = x + e` done in place
+        StoreReg, StoreImm, StoreElementAt, StoreElementReg, StoreElementIndexed, StoreElementImm,
+        StoreElementImmAt, UpdateImm, UpdateReg,
+    };
+
+    struct Node {
+        enum class Kind : uint8_t { Constant, Variable, Element, Binary, Assign };
+        Kind What;
+        BinaryOp Op = BinaryOp::Add;
+        int64_t Value = 0;
+        const Declaration* Decl = nullptr;           // Variable, Element and Assign
+        const AssignmentExpression* Store = nullptr; // Assign
+        int Left = -1;  // operands of Binary; the index of Element and Assign to an element
+        int Right = -1; // operand of Binary; the value of Assign
+        bool Stores = false; // an assignment in the subtree
+        bool Traps = false;  // a division that may fault or an array access in the subtree
+
+        // per nonterminal: the cheapest rule and its cost, and whether it matched the operands swapped
+        std::array<int64_t, NonterminalCount> Cost{};
+        std::array<Rule, NonterminalCount> Rules{};
+        std::array<bool, NonterminalCount> Swapped{};
+    };
+
+    struct Load { // of an array element, its index built
+        const Primary* Element;
+    };
+    struct Assignment { // its index and value built
+        const AssignmentExpression* Store;
+    };
+    using BuildTask = std::variant<const Expression*, const EqualityExpression*, const RelationalExpression*,
+        const AdditiveExpression*, const MultiplicativeExpression*, const PostfixExpression*, const Primary*,
+        BinaryOp, Load, Assignment>;
+
+    // the operands a rule reduces, in the order their code runs
+    struct Operands {
+        std::array<std::pair<int, Nonterminal>, 2> Of;
+        int Count = 0;
+        bool Spill = false; // rax is pushed between the two
+    };
+
+    struct ReduceTask {
+        int Node;
+        Nonterminal Goal;
+        int Step; // operands reduced so far
+    };
+
+    int Build(BuildTask start);
+    template <typename Expr>
+    void ScheduleOperands(const Expr* expr);
+    int AddNode(Node node);
+
+    void Label(Node& node);
+    void LabelBinary(Node& node);
+    void LabelAssign(Node& node);
+    void Derive(Node& node, Nonterminal nt, Rule rule, int64_t cost, bool swapped = false);
+    bool Prints(const Node& assign) const;
+    bool MayReorder(const Node& first, const Node& second) const;
+    bool Faults(BinaryOp op, int right) const;
+    bool Speculable(int first, int last, int cond) const;
+    std::optional<std::string> OperandAfterFlags(const Node& node) const;
+    std::optional<int64_t> ElementDisplacement(const Node& element) const;
+
+    void Reduce(int root, Nonterminal goal, std::string& code);
+    Operands OperandsOf(const Node& node, Nonterminal goal) const;
+    void EmitRule(const Node& node, Nonterminal goal, std::string& code) const;
+
+    // operands as the instructions take them
+    std::string ImmediateOf(const Node& node) const;
+    std::string MemoryOf(const Node& node) const;
+    const Node* MemoryOperand(const Node& node, Nonterminal goal) const;
+    std::string ElementSlot(const Node& node, const std::string& indexReg) const;
+    std::string AddressOf(const Node& node, Nonterminal nt) const;
+    int64_t ScaleOf(const Node& node) const;
+    std::string ConditionOf(const Node& node) const;
+    const Node& OperandA(const Node& node, Nonterminal nt) const; // the left operand of the pattern
+    const Node& OperandB(const Node& node, Nonterminal nt) const;
+
+    const Options& m_Options;
+    std::vector<Node> m_Nodes; // children before parents
+    std::vector<BuildTask> m_BuildTasks;
+    std::vector<int> m_Built; // nodes of the operands built so far
+    std::vector<ReduceTask> m_ReduceTasks;
+};
+
+} // namespace Compiler
@@ -1,6 +1,8 @@
 #include "lexer.h"
 #include "utils.h"
+#include <algorithm>
 #include <format>
+#include <thread>
 #include <unordered_map>
 
 namespace Compiler {
@@ -8,27 +10,87 @@ namespace Compiler {
 static const std::unordered_map<std::string_view, TokenType> keywords{ { "return", RETURN }, { "int", INT },
     { "if", IF }, { "else", ELSE }, { "while", WHILE } };
 
-Lexer::Lexer(std::string_view src) : m_Src(src), m_Size(src.size()) {}
+// below this many bytes per thread, starting the threads costs more than they save
+constexpr size_t MinimumChunkSize = 1024 * 1024;
+
+Lexer::Lexer(std::string_view src, unsigned threads) : m_Src(src), m_Size(src.size()), m_Index(0) {
+    if (m_Size >= UINT32_MAX) {
+        Error("Source files are limited to 4 GiB");
+    }
+    m_Threads = threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+Lexer::Lexer(std::string_view src, size_t begin, size_t end) : m_Src(src), m_Size(end), m_Index(begin) {}
 
 std::vector<Token> Lexer::Lex() {
-    m_Index = 0;
+    const size_t chunks = std::min<size_t>(m_Threads, m_Size / MinimumChunkSize);
+    if (chunks > 1) {
+        return LexParallel(chunks);
+    }
 
+    m_Index = 0;
     std::vector<Token> tokens;
+    if (auto failure = LexRange(tokens)) {
+        Error(failure->Location, failure->Message);
+    }
+    tokens.emplace_back(END_OF_FILE, Location());
+    return tokens;
+}
+
+std::vector<Token> Lexer::LexParallel(size_t chunks) {
+    std::vector<size_t> bounds = { 0 };
+    for (size_t i = 1; i < chunks; ++i) {
+        const size_t newline = m_Src.find('\n', std::max(i * m_Size / chunks, bounds.back()));
+        if (newline == std::string_view::npos) {
+            break;
+        }
+        bounds.push_back(newline + 1);
+    }
+    bounds.push_back(m_Size);
 
+    std::vector<std::vector<Token>> tokens(bounds.size() - 1);
+    std::vector<std::optional<Failure>> failures(tokens.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        threads.emplace_back([&, i] { failures[i] = Lexer(m_Src, bounds[i], bounds[i + 1]).LexRange(tokens[i]); });
+    }
+    failures[0] = Lexer(m_Src, bounds[0], bounds[1]).LexRange(tokens[0]);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    // the first error in the source is the one the sequential lexer would have stopped at
+    size_t total = 1;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (failures[i]) {
+            Error(failures[i]->Location, failures[i]->Message);
+        }
+        total += tokens[i].size();
+    }
+
+    std::vector<Token> result = std::move(tokens[0]);
+    result.reserve(total);
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        std::move(tokens[i].begin(), tokens[i].end(), std::back_inserter(result));
+        std::vector<Token>().swap(tokens[i]);
+    }
+    m_Index = m_Size;
+    result.emplace_back(END_OF_FILE, Location());
+    return result;
+}
+
+// Lexes from m_Index up to m_Size. Errors are returned rather than raised, so that a chunk lexed on
+// another thread can hand its error to the thread that holds the diagnostics.
+std::optional<Lexer::Failure> Lexer::LexRange(std::vector<Token>& tokens) {
     while (m_Index < m_Size) {
         const char c = m_Src[m_Index];
 
         if (IsSpace(c)) {
-            if (c == '\n') {
-                ++m_Index;
-                Newline();
-            } else {
-                Advance();
-            }
+            Advance();
             continue;
         }
 
-        SourceLocation startLoc = m_Loc;
+        SourceLocation startLoc = Location();
 
         if (IsAlpha(c) || c == '_') {
             auto lexeme = LexWhile([&](char ch) { return IsAlnum(ch) || ch == '_'; });
@@ -56,7 +118,6 @@ std::vector<Token> Lexer::Lex() {
                     while (m_Index < m_Size && m_Src[m_Index] != '\n') {
                         Advance();
                     }
-                    Newline();
                 } else {
                     tokens.emplace_back(FSLASH, startLoc);
                 }
@@ -69,7 +130,7 @@ std::vector<Token> Lexer::Lex() {
                 if (Match('=')) {
                     tokens.emplace_back(NOT_EQUAL, startLoc);
                 } else {
-                    Error(startLoc, "Unknown token '!'");
+                    return Failure{ startLoc, "Unknown token '!'" };
                 }
                 break;
 
@@ -78,18 +139,18 @@ std::vector<Token> Lexer::Lex() {
             case ')': tokens.emplace_back(RPAREN, startLoc); break;
             case '{': tokens.emplace_back(LBRACE, startLoc); break;
             case '}': tokens.emplace_back(RBRACE, startLoc); break;
+            case '[': tokens.emplace_back(LBRACKET, startLoc); break;
+            case ']': tokens.emplace_back(RBRACKET, startLoc); break;
             case ';': tokens.emplace_back(SEMICOLON, startLoc); break;
             case ',': tokens.emplace_back(COMMA, startLoc); break;
 
-            default: Error(startLoc, std::format("Unknow token '{}'", c));
+            default: return Failure{ startLoc, std::format("Unknow token '{}'", c) };
         }
 
         Advance();
     }
 
-    tokens.emplace_back(END_OF_FILE, m_Loc);
-
-    return tokens;
+    return std::nullopt;
 }
 
 bool Lexer::IsAlpha(char c) {
@@ -110,12 +171,10 @@ bool Lexer::IsSpace(char c) {
 
 void Lexer::Advance() {
     ++m_Index;
-    ++m_Loc.Column;
 }
 
-void Lexer::Newline() {
-    ++m_Loc.Line;
-    m_Loc.Column = 0;
+SourceLocation Lexer::Location() const {
+    return { static_cast<uint32_t>(m_Index) };
 }
 
 bool Lexer::Match(char expected) {
@@ -23,6 +23,8 @@ enum TokenType {
     RPAREN,
     LBRACE,
     RBRACE,
+    LBRACKET,
+    RBRACKET,
     SEMICOLON,
     COMMA,
 
@@ -44,13 +46,13 @@ enum TokenType {
     TOKEN_TYPE_NB
 };
 
+// byte offset into the source; LineTable turns it into a line and column when a diagnostic needs one
 struct SourceLocation {
-    uint16_t Line = 1;
-    uint16_t Column = 1;
+    uint32_t Offset = 0;
 };
 
 constexpr std::array<std::string_view, TOKEN_TYPE_NB> TokenNames = { "identifier", "literal", "return", "int",
-    "if", "else", "while", "(", ")", "{", "}", ";", ",", "+", "-", "*", "/", "%", ">", ">=", "<",
+    "if", "else", "while", "(", ")", "{", "}", "[", "]", ";", ",", "+", "-", "*", "/", "%", ">", ">=", "<",
     "<=", "==", "!=", "=", "eof" };
 
 constexpr std::string_view TokenToStr(TokenType type) {
@@ -66,19 +68,32 @@ struct Token {
     std::optional<std::string> Value = std::nullopt; // literal or identifier
 };
 
+// Sources of several MB are split into chunks at newlines and lexed on up to `threads` threads (0 for one
+// per core). A chunk ends right after a newline, so no token or `//` comment crosses into the next one and
+// the concatenated chunks match the sequential lexer token for token, locations included.
 class Lexer {
   public:
-    Lexer(std::string_view src);
+    Lexer(std::string_view src, unsigned threads = 1);
     std::vector<Token> Lex();
 
   private:
+    struct Failure {
+        SourceLocation Location;
+        std::string Message;
+    };
+
+    Lexer(std::string_view src, size_t begin, size_t end);
+
+    std::optional<Failure> LexRange(std::vector<Token>& tokens);
+    std::vector<Token> LexParallel(size_t chunks);
+
     static bool IsAlpha(char c);
     static bool IsAlnum(char c);
     static bool IsDigit(char c);
     static bool IsSpace(char c);
 
     void Advance();
-    void Newline();
+    SourceLocation Location() const;
 
     template <typename Predicate>
     std::string_view LexWhile(Predicate predicate) {
@@ -92,9 +107,9 @@ class Lexer {
     bool Match(char expected);
 
     const std::string_view m_Src;
-    const size_t m_Size;
+    const size_t m_Size; // end of the range to lex; offsets stay relative to the whole of m_Src
     size_t m_Index;
-    SourceLocation m_Loc;
+    unsigned m_Threads = 1;
 };
 
 } // namespace Compiler
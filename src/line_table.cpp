@@ -0,0 +1,45 @@
+#include "line_table.h"
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Compiler {
+
+LineTable::LineTable(std::string_view src) : m_Src(src) {}
+
+LineColumn LineTable::Find(uint32_t offset) {
+    if (m_LineStarts.empty()) {
+        Build();
+    }
+    // the last line starting at or before the offset
+    auto it = std::upper_bound(m_LineStarts.begin(), m_LineStarts.end(), offset) - 1;
+    return { static_cast<uint32_t>(it - m_LineStarts.begin()) + 1, offset - *it + 1 };
+}
+
+void LineTable::Build() {
+    m_LineStarts.push_back(0);
+
+    const char* data = m_Src.data();
+    const size_t size = m_Src.size();
+    size_t i = 0;
+#ifdef __SSE2__
+    // 16 bytes per compare; the mask has a bit set for every newline in the chunk
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= size; i += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+        while (mask != 0) {
+            m_LineStarts.push_back(static_cast<uint32_t>(i + __builtin_ctz(mask) + 1));
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (data[i] == '\n') {
+            m_LineStarts.push_back(static_cast<uint32_t>(i + 1));
+        }
+    }
+}
+
+} // namespace Compiler
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace Compiler {
+
+struct LineColumn {
+    uint32_t Line;
+    uint32_t Column;
+};
+
+// Maps byte offsets back to 1-based lines and columns. The line starts are only collected the first
+// time a position is asked for, which normally means a diagnostic is being printed.
+class LineTable {
+  public:
+    explicit LineTable(std::string_view src);
+    LineColumn Find(uint32_t offset);
+
+  private:
+    void Build();
+
+    std::string_view m_Src;
+    std::vector<uint32_t> m_LineStarts;
+};
+
+} // namespace Compiler
@@ -0,0 +1,222 @@
+#include "loop_vectorizer.h"
+#include "ast_visitor.h"
+#include <algorithm>
+
+namespace Compiler {
+
+static constexpr int VectorRegisterCount = 16;
+
+// the single primary an expression layer reduces to, if it has no operators and no parentheses
+template <typename Expr>
+static const Primary* AsPrimary(const Expr* expr) {
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        return expr->Expr->Ident ? nullptr : AsPrimary(expr->Expr->Expr.Get());
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        return expr->CallList.empty() ? expr->Prim.Get() : nullptr;
+    } else {
+        return expr->Right.empty() ? AsPrimary(expr->Left.Get()) : nullptr;
+    }
+}
+
+static bool IsVariable(const Primary* primary, const Declaration* decl) {
+    return primary && std::holds_alternative<Name>(primary->Value) && !primary->Index &&
+        primary->Decl == decl;
+}
+
+LoopVectorizer::LoopVectorizer(Program* program, ArenaAllocator& allocator, const Options& options)
+    : m_Program(program), m_Allocator(allocator), m_Options(options) {}
+
+int LoopVectorizer::Vectorize() {
+    m_Vectorized = 0;
+    VectorizeBlock(m_Program->GlobalBlock);
+    return m_Vectorized;
+}
+
+void LoopVectorizer::VectorizeBlock(Block* block) {
+    for (const auto& item : block->Items) {
+        if (auto* stmt = std::get_if<Ref<Statement>>(&item->Item)) {
+            VectorizeStatement(*stmt);
+        }
+    }
+}
+
+void LoopVectorizer::VectorizeStatement(Statement* stmt) {
+    std::visit(overloaded{ [&](IfStatement* ifStmt) {
+                              VectorizeStatement(ifStmt->Then);
+                              if (ifStmt->Else) {
+                                  VectorizeStatement(ifStmt->Else);
+                              }
+                          },
+                   [&](WhileStatement* whileStmt) {
+                       std::string reason;
+                       whileStmt->Vector = Analyze(whileStmt, reason);
+                       if (m_Options.Verbose) {
+                           Note(stmt->Location, whileStmt->Vector ? "vectorizer: vectorized loop"
+                                                                  : "vectorizer: loop not vectorized: " + reason);
+                       }
+                       if (whileStmt->Vector) {
+                           m_Vectorized++;
+                       } else {
+                           VectorizeStatement(whileStmt->Loop);
+                       }
+                   },
+                   [&](Block* block) { VectorizeBlock(block); }, [](ExpressionStatement*) {},
+                   [](ReturnStatement*) {}, [](PrecomputedStatement*) {} },
+        stmt->Stmt);
+}
+
+VectorLoop* LoopVectorizer::Analyze(const WhileStatement* loop, std::string& reason) {
+    // condition: i < n or i <= n
+    const RelationalExpression* cond = loop->Cond->Expr->Ident || !loop->Cond->Expr->Expr->Right.empty()
+        ? nullptr
+        : loop->Cond->Expr->Expr->Left.Get();
+    if (!cond || cond->Right.size() != 1 ||
+        (cond->Right[0].first != BinaryOp::Lt && cond->Right[0].first != BinaryOp::Le)) {
+        reason = "condition is not 'i < n' or 'i <= n'";
+        return nullptr;
+    }
+    const Primary* induction = AsPrimary(cond->Left.Get());
+    const Primary* bound = AsPrimary(cond->Right[0].second.Get());
+    if (!induction || !induction->Decl || induction->Index || induction->Decl->Size != 0 || !bound ||
+        bound->Index || std::holds_alternative<Ref<Expression>>(bound->Value) || bound->Decl == induction->Decl) {
+        reason = "condition is not 'i < n' or 'i <= n'";
+        return nullptr;
+    }
+
+    // body: element stores and reductions, then i = i + 1
+    const auto* body = std::get_if<Ref<Block>>(&loop->Loop->Stmt);
+    if (!body || (*body)->Items.empty()) {
+        reason = "body is not a block";
+        return nullptr;
+    }
+    std::vector<AssignmentExpression*> assigns;
+    for (const BlockItem* item : (*body)->Items) {
+        const auto* stmt = std::get_if<Ref<Statement>>(&item->Item);
+        const auto* exprStmt = stmt ? std::get_if<Ref<ExpressionStatement>>(&(*stmt)->Stmt) : nullptr;
+        if (!exprStmt || !(*exprStmt)->Expr->Expr->Ident) {
+            reason = "body has statements other than assignments";
+            return nullptr;
+        }
+        assigns.push_back((*exprStmt)->Expr->Expr);
+    }
+
+    const AssignmentExpression* step = assigns.back();
+    assigns.pop_back();
+    const AdditiveExpression* stepSum = step->Expr->Right.empty() && step->Expr->Left->Right.empty()
+        ? step->Expr->Left->Left.Get()
+        : nullptr;
+    const Primary* one = stepSum && stepSum->Right.size() == 1 && stepSum->Right[0].first == BinaryOp::Add
+        ? AsPrimary(stepSum->Right[0].second.Get())
+        : nullptr;
+    if (step->Decl != induction->Decl || step->Index || !stepSum ||
+        !IsVariable(AsPrimary(stepSum->Left.Get()), induction->Decl) ||
+        !one || !std::holds_alternative<int64_t>(one->Value) || std::get<int64_t>(one->Value) != 1) {
+        reason = "last statement is not 'i = i + 1'";
+        return nullptr;
+    }
+
+    if (m_Options.Trace) {
+        reason = "every assignment is printed in iteration order (compile with --no-trace)";
+        return nullptr;
+    }
+
+    VectorLoop* plan = m_Allocator.alloc<VectorLoop>(induction->Decl, bound,
+        cond->Right[0].first == BinaryOp::Le, m_Allocator.allocList<Ref<AssignmentExpression>>(assigns));
+
+    // every scalar assigned in the body is a reduction; everything else it reads must be invariant
+    m_Reductions.clear();
+    m_Invariants.clear();
+    m_Constants.clear();
+    for (const AssignmentExpression* assign : plan->Body) {
+        if (!assign->Index && (assign->Decl == induction->Decl || !m_Reductions.insert(assign->Decl).second)) {
+            reason = "'" + std::string(assign->Decl->Ident) + "' is assigned twice";
+            return nullptr;
+        }
+    }
+    if (bound->Decl && m_Reductions.contains(bound->Decl)) {
+        reason = "the bound changes inside the loop";
+        return nullptr;
+    }
+
+    int regsNeeded = 0;
+    for (const AssignmentExpression* assign : plan->Body) {
+        if (assign->Index) {
+            if (!IsVariable(AsPrimary(assign->Index.Get()), induction->Decl)) {
+                reason = "'" + std::string(assign->Decl->Ident) + "' is not indexed by the induction variable";
+                return nullptr;
+            }
+            if (!IsElementWise(assign->Expr.Get(), plan, 0, regsNeeded)) {
+                reason = "'" + std::string(assign->Decl->Ident) + "[i]' is not computed element-wise";
+                return nullptr;
+            }
+            continue;
+        }
+
+        // s = s + x - y ...
+        const AdditiveExpression* sum = assign->Expr->Right.empty() && assign->Expr->Left->Right.empty()
+            ? assign->Expr->Left->Left.Get()
+            : nullptr;
+        const bool isReduction = sum && IsVariable(AsPrimary(sum->Left.Get()), assign->Decl) &&
+            std::all_of(sum->Right.begin(), sum->Right.end(), [&](const auto& term) {
+                return IsElementWise(term.second.Get(), plan, 0, regsNeeded);
+            });
+        if (!isReduction) {
+            reason = "'" + std::string(assign->Decl->Ident) + "' is not a sum reduction";
+            return nullptr;
+        }
+    }
+
+    const int fixedRegs = static_cast<int>(m_Reductions.size() + m_Invariants.size() + m_Constants.size());
+    if (regsNeeded + fixedRegs > VectorRegisterCount) {
+        reason = "not enough vector registers";
+        return nullptr;
+    }
+
+    return plan;
+}
+
+// expr only combines i-indexed array elements, invariant scalars and literals with + - *;
+// regsNeeded grows to the number of stack registers the generator will use from reg upwards
+template <typename Expr>
+bool LoopVectorizer::IsElementWise(const Expr* expr, const VectorLoop* plan, int reg, int& regsNeeded) {
+    regsNeeded = std::max(regsNeeded, reg + 1);
+
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        return !expr->Expr->Ident && IsElementWise(expr->Expr->Expr.Get(), plan, reg, regsNeeded);
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        return expr->CallList.empty() && IsElementWise(expr->Prim.Get(), plan, reg, regsNeeded);
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        if (const auto* i = std::get_if<int64_t>(&expr->Value)) {
+            m_Constants.insert(*i);
+            return true;
+        } else if (const auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            return IsElementWise<Expression>(*inner, plan, reg, regsNeeded);
+        } else if (expr->Index) {
+            return IsVariable(AsPrimary(expr->Index.Get()), plan->Induction);
+        } else if (expr->Decl == plan->Induction || m_Reductions.contains(expr->Decl)) {
+            return false;
+        }
+        m_Invariants.insert(expr->Decl);
+        return true;
+    } else if constexpr (std::is_same_v<Expr, EqualityExpression> || std::is_same_v<Expr, RelationalExpression>) {
+        return expr->Right.empty() && IsElementWise(expr->Left.Get(), plan, reg, regsNeeded);
+    } else {
+        if (!IsElementWise(expr->Left.Get(), plan, reg, regsNeeded)) {
+            return false;
+        }
+        for (const auto& [op, right] : expr->Right) {
+            if (op != BinaryOp::Add && op != BinaryOp::Sub && op != BinaryOp::Mul) {
+                return false;
+            }
+            if (op == BinaryOp::Mul) {
+                regsNeeded = std::max(regsNeeded, reg + 4); // two scratch registers for the products
+            }
+            if (!IsElementWise(right.Get(), plan, reg + 1, regsNeeded)) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+} // namespace Compiler
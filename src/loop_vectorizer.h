@@ -0,0 +1,43 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+#include "utils.h"
+#include <unordered_set>
+
+namespace Compiler {
+
+// Marks counted while loops whose iterations are independent with a VectorLoop plan:
+//     while (i < n) {       // or i <= n, n a literal or a variable the loop does not assign
+//         a[i] = b[i] * k + c[i];
+//         s = s + a[i] - b[i];
+//         i = i + 1;
+//     }
+// Arrays may only be indexed by i itself, other scalars must be loop invariant, and a reduction
+// variable may only appear in its own update. Only + - * are vectorized. Loops that assign are
+// never vectorized while tracing is on, because every assignment prints in iteration order.
+class LoopVectorizer {
+  public:
+    LoopVectorizer(Program* program, ArenaAllocator& allocator, const Options& options);
+    int Vectorize(); // returns the number of loops vectorized
+
+  private:
+    void VectorizeBlock(Block* block);
+    void VectorizeStatement(Statement* stmt);
+
+    VectorLoop* Analyze(const WhileStatement* loop, std::string& reason);
+
+    template <typename Expr>
+    bool IsElementWise(const Expr* expr, const VectorLoop* plan, int reg, int& regsNeeded);
+
+    Program* m_Program;
+    ArenaAllocator& m_Allocator;
+    const Options& m_Options;
+
+    std::unordered_set<const Declaration*> m_Reductions;
+    std::unordered_set<const Declaration*> m_Invariants;
+    std::unordered_set<int64_t> m_Constants;
+    int m_Vectorized = 0;
+};
+
+} // namespace Compiler
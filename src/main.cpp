@@ -1,41 +1,91 @@
-#include "generator.h"
-#include "lexer.h"
-#include "parser.h"
-#include "semantic_analyzer.h"
-#include "symbol_table.h"
+#include "bytecode.h"
+#include "compile_server.h"
+#include "driver.h"
+#include "virtual_machine.h"
 #include <filesystem>
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <thread>
 
-int main() {
+// usage: Compiler [-O0..-O3] [--passes=LIST] [--stats] [-v|--verbose] [--no-trace] [-mavx2]
+//                 [--no-if-conversion] [--max-nesting=N] [--eval-budget=N] [--lex-threads=N]
+//                 [--emit-bytecode] [input [output]]
+//        Compiler --vm [flags] [input]    runs a source or bytecode file in the VirtualMachine
+//        Compiler --server <socket>
+int main(int argc, char* argv[]) try {
     std::filesystem::path inputFilePath = "test/main.c";
     std::filesystem::path outputFilePath = "test/main.asm";
+    Compiler::Options options;
+    bool runInVm = false;
 
-    std::ifstream inputFile(inputFilePath, std::ios::in);
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "--server") {
+            if (i + 1 == argc) {
+                Compiler::Error("--server needs a socket path");
+            }
+            Compiler::CompileServer server(argv[i + 1], std::thread::hardware_concurrency());
+            server.Run();
+        } else if (arg == "--vm") {
+            runInVm = true;
+        } else if (Compiler::ParseOption(arg, options)) {
+            continue;
+        } else if (arg.starts_with('-')) {
+            Compiler::Error(std::format("Unknown option: {}", arg));
+        } else if (positional == 0) {
+            inputFilePath = arg;
+            positional++;
+        } else if (positional == 1) {
+            outputFilePath = arg;
+            positional++;
+        } else {
+            Compiler::Error(std::format("Unexpected argument: {}", arg));
+        }
+    }
+
+    std::ifstream inputFile(inputFilePath, std::ios::in | std::ios::binary);
     if (!inputFile) {
         Compiler::Error("Failed to open file: " + inputFilePath.string());
     }
 
     std::string sourceCode((std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>());
-    sourceCode += '\n';
     inputFile.close();
 
-    Compiler::Lexer lexer(sourceCode);
-    Compiler::Parser parser(lexer.Lex());
-    auto program = parser.ParseProgram();
-    Compiler::ScopeStack scopes;
-    Compiler::SemanticAnalyzer analyzer(program, scopes);
-    analyzer.Analyze();
-    Compiler::Generator generator(program, scopes);
+    if (runInVm && Compiler::Bytecode::IsSerialized(sourceCode)) {
+        const Compiler::Bytecode code = Compiler::Bytecode::Deserialize(sourceCode);
+        return static_cast<int>(Compiler::VirtualMachine(code).Run() & 0xff);
+    }
+    sourceCode += '\n';
+    options.Bytecode |= runInVm;
+    if (options.Bytecode && positional < 2) {
+        outputFilePath = std::filesystem::path(inputFilePath).replace_extension(".bc");
+    }
+
+    const Compiler::CompileResult result = Compiler::Compile(sourceCode, options);
+    std::cerr << result.Diagnostics;
+    if (!result.Success) {
+        std::cin.get();
+        return 1;
+    }
+
+    if (runInVm) {
+        const Compiler::Bytecode code = Compiler::Bytecode::Deserialize(result.Output);
+        return static_cast<int>(Compiler::VirtualMachine(code).Run() & 0xff);
+    }
 
-    std::ofstream outputFile(outputFilePath);
+    std::ofstream outputFile(outputFilePath, std::ios::out | std::ios::binary);
     if (!outputFile) {
         Compiler::Error("Failed to write to file: " + outputFilePath.string());
     }
-    outputFile << generator.GenerateAsm();
+    outputFile << result.Output;
     outputFile.close();
 
     std::cout << "Output written to " << outputFilePath << "\n";
     return 0;
+} catch (const Compiler::CompileError& e) {
+    std::cerr << e.what() << "\n";
+    std::cin.get();
+    return 1;
 }
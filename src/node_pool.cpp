@@ -0,0 +1,91 @@
+#include "node_pool.h"
+#include "utils.h"
+#include <atomic>
+#include <format>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace Compiler {
+
+// the first extent, which every pool reserves when it is created
+static constexpr size_t FirstExtentBytes = size_t{ 4 } << 20;
+
+static std::atomic<size_t> s_RegionCount = 0;
+
+NodeRegion::NodeRegion(size_t nodeSize, uintptr_t* base) : m_Id(s_RegionCount++), m_NodeSize(nodeSize), m_Base(base) {
+    Reserve(std::max<size_t>(FirstExtentBytes / nodeSize, 1));
+}
+
+NodeRegion::Run NodeRegion::Acquire(uint32_t count) {
+    std::lock_guard lock(m_Mutex);
+    Run run;
+    const auto fits = std::find_if(m_Free.begin(), m_Free.end(), [&](const Run& free) { return free.Count >= count; });
+    if (fits != m_Free.end()) {
+        run = *fits;
+        m_Free.erase(fits);
+    } else {
+        if (count > m_End - m_Next) {
+            Reserve(count); // the rest of the newest extent stays unused
+        }
+        run = { static_cast<uint32_t>(m_Next), count };
+        m_Next += count;
+        Commit(run);
+    }
+    return run;
+}
+
+void NodeRegion::Release(Run run) {
+    // the memory of the pages the run has to itself goes back to the system
+    const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const uintptr_t start = (reinterpret_cast<uintptr_t>(Address(run.First)) + page - 1) / page * page;
+    const uintptr_t end = reinterpret_cast<uintptr_t>(Address(uint64_t{ run.First } + run.Count)) / page * page;
+    if (start < end) {
+        madvise(reinterpret_cast<void*>(start), end - start, MADV_DONTNEED);
+    }
+
+    std::lock_guard lock(m_Mutex);
+    m_Free.push_back(run);
+}
+
+// Address space only, for count slots or as many as all extents before hold, whichever is more. The first
+// extent fixes the base half the range of the indices below it, so that the extents the system places
+// near it later are in range too; a slot's index is its distance from the base in nodes, so the first
+// slot of an extent is the first one at such a distance.
+void NodeRegion::Reserve(uint64_t count) {
+    if (m_Reserved + count > UINT32_MAX) {
+        Error(std::format("The program needs more than {} nodes of {} bytes", UINT32_MAX, m_NodeSize));
+    }
+    const uint64_t slots = std::min(std::max(count, m_Reserved), UINT32_MAX - m_Reserved);
+    const size_t bytes = (slots + 1) * m_NodeSize;
+    void* reserved = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+        Error("Failed to reserve address space for the syntax tree");
+    }
+    const auto start = reinterpret_cast<uintptr_t>(reserved);
+    if (m_Reserved == 0) {
+        *m_Base = start - std::min<uintptr_t>(start / m_NodeSize, uintptr_t{ 1 } << 31) * m_NodeSize;
+    }
+    const uint64_t first = start < *m_Base ? 0 : (start - *m_Base + m_NodeSize - 1) / m_NodeSize;
+    if (first == 0 || first + slots > uint64_t{ 1 } << 32) {
+        munmap(reserved, bytes);
+        Error("The system placed the syntax tree beyond the address range of its indices");
+    }
+    m_Next = first;
+    m_End = first + slots;
+    m_Reserved += slots;
+}
+
+std::byte* NodeRegion::Address(uint64_t index) const {
+    return reinterpret_cast<std::byte*>(*m_Base + index * m_NodeSize);
+}
+
+void NodeRegion::Commit(Run run) {
+    const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const uintptr_t start = reinterpret_cast<uintptr_t>(Address(run.First)) / page * page;
+    const uintptr_t end = reinterpret_cast<uintptr_t>(Address(uint64_t{ run.First } + run.Count));
+    if (mprotect(reinterpret_cast<void*>(start), end - start, PROT_READ | PROT_WRITE) != 0) {
+        Error("Failed to commit memory for the syntax tree");
+    }
+}
+
+} // namespace Compiler
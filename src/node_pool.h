@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+namespace Compiler {
+
+// The slots of one pool: every node of a type, whichever ArenaAllocator it belongs to, is known by a 32-bit
+// index, its distance from a base address in nodes. The address space is reserved in extents as the
+// input needs it, each at least as large as all before it, wherever the system places them within
+// the range the indices reach. Arenas take runs of slots inside one extent, which are committed as they
+// are handed out and come back to a free list when the arena is destroyed. Index 0, the base itself,
+// is never in an extent and stands for null.
+class NodeRegion {
+  public:
+    struct Run {
+        uint32_t First;
+        uint32_t Count;
+    };
+
+    NodeRegion(size_t nodeSize, uintptr_t* base);
+    NodeRegion(const NodeRegion&) = delete;
+    NodeRegion& operator=(const NodeRegion&) = delete;
+
+    Run Acquire(uint32_t count); // count slots or more, contiguous
+    void Release(Run run);
+
+    size_t Id() const { return m_Id; } // small and dense, for arenas to keep their runs by
+    size_t NodeSize() const { return m_NodeSize; }
+
+  private:
+    void Reserve(uint64_t count);
+    std::byte* Address(uint64_t index) const;
+    void Commit(Run run);
+
+    const size_t m_Id;
+    const size_t m_NodeSize;
+    uintptr_t* m_Base;
+
+    std::mutex m_Mutex;
+    uint64_t m_Next = 0; // in the newest extent, up to m_End
+    uint64_t m_End = 0;
+    uint64_t m_Reserved = 0; // slots in all extents
+    std::vector<Run> m_Free;
+};
+
+template <typename T>
+class NodePool {
+  public:
+    static NodeRegion& Region() {
+        static NodeRegion region(sizeof(T), &s_Base);
+        return region;
+    }
+    static T* At(uint32_t index) { return reinterpret_cast<T*>(s_Base + uintptr_t{ index } * sizeof(T)); }
+    static uint32_t IndexOf(const T* node) {
+        return static_cast<uint32_t>((reinterpret_cast<uintptr_t>(node) - s_Base) / sizeof(T));
+    }
+
+  private:
+    static inline uintptr_t s_Base = 0; // set once, before the first slot is handed out
+};
+
+// A 32-bit handle of a node in its pool, used like a pointer to it. Handles do not carry constness.
+template <typename T>
+class Ref {
+  public:
+    Ref() = default;
+    Ref(std::nullptr_t) {}
+    Ref(const T* node) : m_Index(node ? NodePool<T>::IndexOf(node) : 0) {}
+
+    T* Get() const { return m_Index != 0 ? NodePool<T>::At(m_Index) : nullptr; }
+    operator T*() const { return Get(); }
+    T* operator->() const { return NodePool<T>::At(m_Index); }
+    T& operator*() const { return *NodePool<T>::At(m_Index); }
+
+  private:
+    uint32_t m_Index = 0;
+};
+
+// Consecutive elements in the pool of T: the operands of an operator chain, the items of a block. The
+// elements themselves can change in place, and erasing shifts the rest down, but the list only grows
+// by taking a new one from the arena (ArenaAllocator::allocList).
+template <typename T>
+class NodeList {
+  public:
+    using value_type = T;
+
+    NodeList() = default;
+
+    T* begin() const { return NodePool<T>::At(m_First); }
+    T* end() const { return begin() + m_Size; }
+    std::reverse_iterator<T*> rbegin() const { return std::reverse_iterator<T*>(end()); }
+    std::reverse_iterator<T*> rend() const { return std::reverse_iterator<T*>(begin()); }
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+    T& operator[](size_t index) const { return begin()[index]; }
+    T& front() const { return *begin(); }
+    T& back() const { return end()[-1]; }
+
+    T* erase(T* position) {
+        std::move(position + 1, end(), position);
+        m_Size--;
+        return position;
+    }
+
+    template <typename Predicate>
+    friend size_t erase_if(NodeList& list, Predicate predicate) {
+        T* const end = std::remove_if(list.begin(), list.end(), predicate);
+        const size_t removed = static_cast<size_t>(list.end() - end);
+        list.m_Size -= static_cast<uint32_t>(removed);
+        return removed;
+    }
+
+  private:
+    friend class ArenaAllocator;
+    NodeList(uint32_t first, uint32_t size) : m_First(first), m_Size(size) {}
+
+    uint32_t m_First = 0;
+    uint32_t m_Size = 0;
+};
+
+} // namespace Compiler
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Compiler {
+
+struct Options {
+    bool Verbose = false; // report what the optimization passes changed
+    bool Trace = true;    // print every assigned value; with it off the exit code is the only output
+    bool Avx2 = false;    // vectorize loops with 256-bit AVX2 instead of SSE2
+    bool IfConversion = true; // cmov in place of ifs that only choose the value of a variable
+    size_t MaxNestingDepth = 65536; // blocks, statements and parentheses open at once
+    int OptimizationLevel = 3;
+    std::string Passes;     // custom pipeline (see PassManager), replaces the one of the level
+    bool Statistics = false; // report time and changes per pass
+    bool Bytecode = false; // compile for the VirtualMachine instead of to assembly
+    uint64_t EvaluationBudget = 1'000'000; // steps the program may run for at compile time, 0 for none
+    unsigned LexThreads = 0; // threads that lex sources of several MB, 0 for one per core
+};
+
+} // namespace Compiler
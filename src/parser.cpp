@@ -1,186 +1,378 @@
 #include "parser.h"
+#include <algorithm>
+#include <charconv>
 #include <format>
 
 namespace Compiler {
 
-Parser::Parser(const std::vector<Token>& tokens)
-    : m_Tokens(tokens), m_Index(0), m_Allocator(4 * 1024 * 1024) {} // 4 MB
+// the dispatch on a primary below handles these
+static_assert(PrimaryFirst == (TokenBit(LPAREN) | TokenBit(IDENTIFIER) | TokenBit(LITERAL)),
+    "grammar.bnf: a primary that the parser does not know");
+
+Parser::Parser(std::vector<Token> tokens, ArenaAllocator& allocator, const Options& options)
+    : m_Tokens(std::move(tokens)), m_Index(0), m_Allocator(allocator), m_Options(options) {}
 
 Program* Parser::ParseProgram() {
     m_Index = 0;
-    return m_Allocator.alloc<Program>(ParseBlock());
+    m_Depth = 0;
+    m_MaxDepth = 0;
+    Program* program = m_Allocator.alloc<Program>(ParseBlock(RBRACE));
+    program->NestingDepth = m_MaxDepth;
+    return program;
 }
 
-Primary* Parser::ParsePrimary() {
-    if (Match(END_OF_FILE)) {
-        Error(m_Tokens.back().Location, "Expected primary");
-    } else if (Match(LITERAL)) {
-        return m_Allocator.alloc<Primary>(std::stoll(*Consume().Value));
-    } else if (Match(IDENTIFIER)) {
-        return m_Allocator.alloc<Primary>(*Consume().Value);
-    } else if (Match(LPAREN)) {
-        Consume();
-        Expression* expr = ParseExpression();
-        Expect(RPAREN);
-        return m_Allocator.alloc<Primary>(expr);
-    }
-
-    Error("Unexpected token in primary");
-    return nullptr; // never reached
+Block* Parser::ParseItems(size_t depth) {
+    m_Index = 0;
+    m_Depth = depth;
+    m_MaxDepth = depth;
+    return ParseBlock(END_OF_FILE);
 }
 
-PostfixExpression* Parser::ParsePostfixExpression() {
-    PostfixExpression* expr = m_Allocator.alloc<PostfixExpression>(ParsePrimary());
-
-    while (Match(LPAREN)) { // function call
-        Consume();
-        std::vector<AssignmentExpression*> argList;
-
-        if (!Match(RPAREN)) {
-            argList.emplace_back(ParseAssignmentExpression());
-            while (Match(COMMA)) {
-                Consume();
-                argList.emplace_back(ParseAssignmentExpression());
-            }
-        }
-
-        Expect(RPAREN);
-        expr->CallList.emplace_back(argList);
+void Parser::EnterNesting() {
+    m_MaxDepth = std::max(m_MaxDepth, ++m_Depth);
+    if (m_Depth > m_Options.MaxNestingDepth) {
+        const std::string limit = std::to_string(m_Options.MaxNestingDepth);
+        Error(m_Tokens[m_Index].Location, "Nesting exceeds the limit of " + limit + " (--max-nesting)");
     }
-
-    return expr;
 }
 
-MultiplicativeExpression* Parser::ParseMultiplicativeExpression() {
-    MultiplicativeExpression* expr = m_Allocator.alloc<MultiplicativeExpression>(ParsePostfixExpression());
-
-    while (Match(STAR, FSLASH, PERCENT)) {
-        auto t = Consume();
-        BinaryOp op = static_cast<BinaryOp>(t.Type);
-        PostfixExpression* right = ParsePostfixExpression();
-        expr->Right.emplace_back(op, right);
+// Opens a frame for an expression, consuming the target of an assignment if there is one. An indexed
+// target opens a further frame for its index.
+void Parser::BeginExpression(ExpressionUse use) {
+    while (true) {
+        EnterNesting();
+        ExpressionFrame& frame = m_ExpressionFrames.emplace_back();
+        frame.Use = use;
+
+        if (Match(IDENTIFIER) && m_Tokens[m_Index + 1].Type == EQUAL) {
+            frame.Target = &Consume();
+            Consume(); // '='
+            return;
+        } else if (Match(IDENTIFIER) && IsIndexedAssignment()) {
+            frame.Target = &Consume();
+            Consume(); // '['
+            use = ExpressionUse::AssignmentIndex;
+            continue;
+        }
+        return;
     }
-
-    return expr;
 }
 
-AdditiveExpression* Parser::ParseAdditiveExpression() {
-    MultiplicativeExpression* left = ParseMultiplicativeExpression();
-    AdditiveExpression* expr = m_Allocator.alloc<AdditiveExpression>(left);
-
-    while (Match(PLUS, MINUS)) {
-        auto t = Consume();
-        BinaryOp op = static_cast<BinaryOp>(t.Type);
-        MultiplicativeExpression* right = ParseMultiplicativeExpression();
-        expr->Right.emplace_back(op, right);
+// Adds the postfix expression just parsed to the layers of the frame. Returns true when an operator
+// follows, so that another operand is due; otherwise every layer is complete.
+bool Parser::ReduceOperand(ExpressionFrame& frame) {
+    auto attach = [&]<typename Node, typename Operand>(Node*& node, auto& right, Operand* operand) {
+        if (!node) {
+            node = m_Allocator.alloc<Node>(operand);
+        } else {
+            right.back().second = operand;
+        }
+    };
+    auto pending = [&](auto& right) {
+        right.emplace_back(static_cast<BinaryOp>(Consume().Type), nullptr);
+        return true;
+    };
+    auto close = [&](auto* node, auto& right) {
+        node->Right = m_Allocator.allocList<typename decltype(node->Right)::value_type>(right);
+        right.clear();
+    };
+
+    // the layers below that of the operator that follows, if any, are complete
+    const OperatorLayer layer = OperatorLayers[m_Tokens[m_Index].Type];
+    attach(frame.Multiplicative, frame.MultiplicativeRight, frame.Postfix);
+    frame.Postfix = nullptr;
+    if (layer == OperatorLayer::Multiplicative) {
+        return pending(frame.MultiplicativeRight);
     }
-
-    return expr;
+    close(frame.Multiplicative, frame.MultiplicativeRight);
+    attach(frame.Additive, frame.AdditiveRight, frame.Multiplicative);
+    frame.Multiplicative = nullptr;
+    if (layer == OperatorLayer::Additive) {
+        return pending(frame.AdditiveRight);
+    }
+    close(frame.Additive, frame.AdditiveRight);
+    attach(frame.Relational, frame.RelationalRight, frame.Additive);
+    frame.Additive = nullptr;
+    if (layer == OperatorLayer::Relational) {
+        return pending(frame.RelationalRight);
+    }
+    close(frame.Relational, frame.RelationalRight);
+    attach(frame.Equality, frame.EqualityRight, frame.Relational);
+    frame.Relational = nullptr;
+    if (layer == OperatorLayer::Equality) {
+        return pending(frame.EqualityRight);
+    }
+    close(frame.Equality, frame.EqualityRight);
+    return false;
 }
 
-RelationalExpression* Parser::ParseRelationalExpression() {
-    AdditiveExpression* left = ParseAdditiveExpression();
-    RelationalExpression* expr = m_Allocator.alloc<RelationalExpression>(left);
-
-    while (Match(GT, GE, LT, LE)) {
-        auto t = Consume();
-        BinaryOp op = static_cast<BinaryOp>(t.Type);
-        AdditiveExpression* right = ParseAdditiveExpression();
-        expr->Right.emplace_back(op, right);
-    }
+Expression* Parser::ParseExpression() {
+    const size_t outer = m_ExpressionFrames.size();
+    BeginExpression(ExpressionUse::Result);
+    bool operand = true; // the innermost frame waits for a primary, rather than for what follows one
+
+    while (true) {
+        ExpressionFrame& frame = m_ExpressionFrames.back();
+
+        if (operand) {
+            const TokenType type = m_Tokens[m_Index].Type;
+            if (!InSet(PrimaryFirst, type)) {
+                if (type == END_OF_FILE) {
+                    Error(m_Tokens.back().Location, "Expected primary");
+                }
+                Error(m_Tokens[m_Index].Location, "Unexpected token in primary");
+            }
+            if (type == LPAREN) {
+                Consume();
+                BeginExpression(ExpressionUse::Parenthesized);
+                continue;
+            }
+            const Token& t = Consume();
+            if (type == LITERAL) {
+                frame.Prim = m_Allocator.alloc<Primary>(LiteralValue(t));
+            } else {
+                frame.Prim = m_Allocator.alloc<Primary>(Intern(*t.Value), t.Location);
+                if (Match(LBRACKET)) {
+                    Consume();
+                    BeginExpression(ExpressionUse::ElementIndex);
+                    continue;
+                }
+            }
+            operand = false;
+        }
 
-    return expr;
-}
+        if (!frame.Postfix) {
+            frame.Postfix = m_Allocator.alloc<PostfixExpression>(frame.Prim);
+        }
+        if (Match(LPAREN)) { // function call
+            Consume();
+            if (Match(RPAREN)) {
+                Consume();
+                frame.Calls.emplace_back();
+            } else {
+                BeginExpression(ExpressionUse::CallArgument);
+                operand = true;
+            }
+            continue;
+        }
+        if (!frame.Calls.empty()) {
+            frame.Postfix->CallList = m_Allocator.allocList<NodeList<Ref<AssignmentExpression>>>(frame.Calls);
+            frame.Calls.clear();
+        }
+        if (ReduceOperand(frame)) {
+            operand = true;
+            continue;
+        }
 
-EqualityExpression* Parser::ParseEqualityExpression() {
-    RelationalExpression* left = ParseRelationalExpression();
-    EqualityExpression* expr = m_Allocator.alloc<EqualityExpression>(left);
+        // the frame is complete: hand its expression to the frame that is waiting for it
+        AssignmentExpression* assign = nullptr;
+        if (frame.Target) {
+            assign = m_Allocator.alloc<AssignmentExpression>(
+                Intern(*frame.Target->Value), frame.Target->Location, frame.Equality);
+        } else {
+            assign = m_Allocator.alloc<AssignmentExpression>(frame.Equality);
+        }
+        assign->Index = frame.TargetIndex;
+        const ExpressionUse use = frame.Use;
+        m_ExpressionFrames.pop_back();
+        m_Depth--;
+
+        if (use == ExpressionUse::CallArgument) {
+            ExpressionFrame& parent = m_ExpressionFrames.back();
+            parent.Arguments.emplace_back(assign);
+            if (Match(COMMA)) {
+                Consume();
+                BeginExpression(ExpressionUse::CallArgument);
+                operand = true;
+            } else {
+                Expect(RPAREN);
+                parent.Calls.push_back(m_Allocator.allocList<Ref<AssignmentExpression>>(parent.Arguments));
+                parent.Arguments.clear();
+            }
+            continue;
+        }
 
-    while (Match(IS_EQUAL, NOT_EQUAL)) {
-        auto t = Consume();
-        BinaryOp op = static_cast<BinaryOp>(t.Type);
-        RelationalExpression* right = ParseRelationalExpression();
-        expr->Right.emplace_back(op, right);
+        Expression* expr = m_Allocator.alloc<Expression>(assign);
+        if (m_ExpressionFrames.size() == outer) {
+            return expr;
+        }
+        ExpressionFrame& parent = m_ExpressionFrames.back();
+        if (use == ExpressionUse::AssignmentIndex) {
+            parent.TargetIndex = expr;
+            Expect(RBRACKET);
+            Expect(EQUAL);
+            operand = true;
+        } else if (use == ExpressionUse::ElementIndex) {
+            parent.Prim->Index = expr;
+            Expect(RBRACKET);
+        } else {
+            Expect(RPAREN);
+            parent.Prim = m_Allocator.alloc<Primary>(expr);
+        }
     }
-
-    return expr;
 }
 
-AssignmentExpression* Parser::ParseAssignmentExpression() {
-    AssignmentExpression* expr;
-
-    if (Match(IDENTIFIER) && m_Tokens[m_Index + 1].Type == EQUAL) {
-        std::string_view name = *Consume().Value;
-        Consume(); // '='
-        expr = m_Allocator.alloc<AssignmentExpression>(name, ParseEqualityExpression());
-    } else {
-        expr = m_Allocator.alloc<AssignmentExpression>(ParseEqualityExpression());
+// IDENTIFIER '[' ... ']' '=' ahead, with balanced brackets in between
+bool Parser::IsIndexedAssignment() const {
+    if (m_Tokens[m_Index + 1].Type != LBRACKET) {
+        return false;
     }
-
-    return expr;
+    int depth = 0;
+    for (size_t i = m_Index + 1; m_Tokens[i].Type != END_OF_FILE; ++i) {
+        if (m_Tokens[i].Type == LBRACKET) {
+            depth++;
+        } else if (m_Tokens[i].Type == RBRACKET && --depth == 0) {
+            return m_Tokens[i + 1].Type == EQUAL;
+        }
+    }
+    return false;
 }
 
-Expression* Parser::ParseExpression() {
-    return m_Allocator.alloc<Expression>(ParseAssignmentExpression());
-}
+// return and expression statements, which cannot contain other statements
+Statement* Parser::ParseSimpleStatement() {
+    const SourceLocation loc = m_Tokens[m_Index].Location;
 
-Statement* Parser::ParseStatement() {
     if (Match(RETURN)) {
         Consume();
         Expression* expr = ParseExpression();
         Expect(SEMICOLON);
         ReturnStatement* stmt = m_Allocator.alloc<ReturnStatement>(expr);
-        return m_Allocator.alloc<Statement>(stmt);
-    } else if (Match(IF)) {
-        Consume();
-        Expect(LPAREN);
-        Expression* expr = ParseExpression();
-        Expect(RPAREN);
-
-        IfStatement* stmt = m_Allocator.alloc<IfStatement>(expr, ParseStatement());
-        if (Match(ELSE)) {
-            Consume();
-            stmt->Else = ParseStatement();
-        }
-        return m_Allocator.alloc<Statement>(stmt);
-    } else if (Match(WHILE)) {
-        Consume();
-        Expect(LPAREN);
-        Expression* expr = ParseExpression();
-        Expect(RPAREN);
-
-        WhileStatement* stmt = m_Allocator.alloc<WhileStatement>(expr, ParseStatement());
-        return m_Allocator.alloc<Statement>(stmt);
-    } else if (Match(LBRACE)) {
-        return m_Allocator.alloc<Statement>(ParseBlock());
+        return m_Allocator.alloc<Statement>(stmt, loc);
     }
 
     Expression* expr = ParseExpression();
     Expect(SEMICOLON);
 
     ExpressionStatement* stmt = m_Allocator.alloc<ExpressionStatement>(expr);
-    return m_Allocator.alloc<Statement>(stmt);
+    return m_Allocator.alloc<Statement>(stmt, loc);
 }
 
-Block* Parser::ParseBlock() {
-    Block* block = m_Allocator.alloc<Block>();
-    Expect(LBRACE);
-    while (!Match(RBRACE, END_OF_FILE)) {
-        BlockItem* item;
-        if (Match(INT)) {
-            Consume();
-            std::string name = *Expect(IDENTIFIER).Value;
-            Expect(SEMICOLON);
-            Declaration* decl = m_Allocator.alloc<Declaration>(name);
+Declaration* Parser::ParseDeclaration() {
+    Expect(INT);
+    Token ident = Expect(IDENTIFIER);
+    int64_t size = 0;
+    if (Match(LBRACKET)) {
+        Consume();
+        const Token length = Expect(LITERAL);
+        size = LiteralValue(length);
+        if (size <= 0) {
+            Error(length.Location, "Array size must be positive");
+        } else if (size > MaxFrameSlots) {
+            Error(length.Location, std::format("Array size must be at most {}", MaxFrameSlots));
+        }
+        Expect(RBRACKET);
+    }
+    Expect(SEMICOLON);
+    return m_Allocator.alloc<Declaration>(Intern(*ident.Value), ident.Location, size);
+}
 
-            item = m_Allocator.alloc<BlockItem>(decl);
+// Parses a block and every statement nested in it, up to `end`: the closing brace, or the end of the
+// tokens for a block without braces. If, while and block statements open a frame that closes once their
+// last nested statement is complete.
+Block* Parser::ParseBlock(TokenType end) {
+    const size_t outer = m_StatementFrames.size();
+    Block* outermost = m_Allocator.alloc<Block>();
+    outermost->Location = m_Tokens[m_Index].Location;
+    if (end == RBRACE) {
+        Expect(LBRACE);
+    }
+    EnterNesting();
+    m_StatementFrames.push_back({ nullptr, outermost });
+
+    while (true) {
+        StatementFrame& frame = m_StatementFrames.back();
+        Statement* done = nullptr;
+        const ItemKind kind = ItemStarts[m_Tokens[m_Index].Type];
+
+        if (frame.Items && kind == ItemKind::Declaration) {
+            frame.Parsed.emplace_back(m_Allocator.alloc<BlockItem>(ParseDeclaration()));
+            continue;
+        } else if (frame.Items && Match(RBRACE, END_OF_FILE)) {
+            Block* block = frame.Items;
+            block->End = m_Tokens[m_Index].Location;
+            Expect(m_StatementFrames.size() == outer + 1 ? end : RBRACE);
+            m_Depth--;
+            block->Items = m_Allocator.allocList<Ref<BlockItem>>(frame.Parsed);
+            done = frame.Stmt;
+            m_StatementFrames.pop_back();
+            if (m_StatementFrames.size() == outer) {
+                return block;
+            }
         } else {
-            item = m_Allocator.alloc<BlockItem>(ParseStatement());
+            const SourceLocation loc = m_Tokens[m_Index].Location;
+            if (kind == ItemKind::If || kind == ItemKind::While) {
+                Consume();
+                const bool isIf = kind == ItemKind::If;
+                Expect(LPAREN);
+                Expression* cond = ParseExpression();
+                Expect(RPAREN);
+                EnterNesting();
+                Statement* stmt = nullptr;
+                if (isIf) {
+                    stmt = m_Allocator.alloc<Statement>(m_Allocator.alloc<IfStatement>(cond, nullptr), loc);
+                } else {
+                    WhileStatement* whileStmt = m_Allocator.alloc<WhileStatement>(cond, nullptr);
+                    stmt = m_Allocator.alloc<Statement>(whileStmt, loc);
+                }
+                m_StatementFrames.push_back({ stmt });
+                continue;
+            } else if (kind == ItemKind::Block) {
+                Consume();
+                EnterNesting();
+                Block* block = m_Allocator.alloc<Block>();
+                block->Location = loc;
+                m_StatementFrames.push_back({ m_Allocator.alloc<Statement>(block, loc), block });
+                continue;
+            }
+            done = ParseSimpleStatement();
         }
-        block->Items.emplace_back(item);
+
+        // hand the finished statement to its parent, closing every if and while it completes
+        while (true) {
+            StatementFrame& parent = m_StatementFrames.back();
+            if (parent.Items) {
+                parent.Parsed.emplace_back(m_Allocator.alloc<BlockItem>(done));
+                break;
+            }
+            if (auto* ifStmt = std::get_if<Ref<IfStatement>>(&parent.Stmt->Stmt)) {
+                if (!parent.InElse) {
+                    (*ifStmt)->Then = done;
+                    if (Match(ELSE)) {
+                        Consume();
+                        parent.InElse = true;
+                        break;
+                    }
+                } else {
+                    (*ifStmt)->Else = done;
+                }
+            } else {
+                std::get<Ref<WhileStatement>>(parent.Stmt->Stmt)->Loop = done;
+            }
+            done = parent.Stmt;
+            m_StatementFrames.pop_back();
+            m_Depth--;
+        }
+    }
+}
+
+// one copy of the characters of each distinct identifier
+Name Parser::Intern(std::string_view text) {
+    const auto found = m_Names.find(text);
+    if (found != m_Names.end()) {
+        return found->second;
+    }
+    const Name name{ m_Allocator.allocList<char>(text) };
+    m_Names.emplace(name, name);
+    return name;
+}
+
+int64_t Parser::LiteralValue(const Token& literal) {
+    const std::string& digits = *literal.Value;
+    int64_t value = 0;
+    if (std::from_chars(digits.data(), digits.data() + digits.size(), value).ec != std::errc()) {
+        Error(literal.Location, "Literal out of range");
     }
-    Expect(RBRACE);
-    return block;
+    return value;
 }
 
 Token Parser::Expect(TokenType type) {
@@ -190,4 +382,4 @@ Token Parser::Expect(TokenType type) {
     return Consume();
 }
 
-} // namespace Compiler
\ No newline at end of file
+} // namespace Compiler
@@ -1,42 +1,87 @@
 #pragma once
 
 #include "ast.h"
+#include "grammar.h"
+#include "options.h"
 #include "utils.h"
+#include <string_view>
+#include <unordered_map>
 
 namespace Compiler {
 
+// Nesting (blocks, if/while bodies, parentheses, array indices and call arguments) is tracked on explicit
+// work stacks instead of the native one, so only Options::MaxNestingDepth bounds how deep a source goes.
 class Parser {
   public:
-    explicit Parser(const std::vector<Token>& tokens);
+    Parser(std::vector<Token> tokens, ArenaAllocator& allocator, const Options& options);
     Program* ParseProgram();
+    // the tokens as the items of a block nested `depth` levels deep, without its braces (IncrementalCompiler)
+    Block* ParseItems(size_t depth);
+    size_t NestingDepth() const { return m_MaxDepth; }
 
   private:
-    Primary* ParsePrimary();
-    PostfixExpression* ParsePostfixExpression();
-    MultiplicativeExpression* ParseMultiplicativeExpression();
-    AdditiveExpression* ParseAdditiveExpression();
-    RelationalExpression* ParseRelationalExpression();
-    EqualityExpression* ParseEqualityExpression();
-    AssignmentExpression* ParseAssignmentExpression();
+    // what the expression that a frame parses is for, once it is complete
+    enum class ExpressionUse { Result, AssignmentIndex, ElementIndex, Parenthesized, CallArgument };
+
+    // one level of expression nesting: the layers of the grammar that are still open at that level
+    struct ExpressionFrame {
+        ExpressionUse Use;
+        const Token* Target = nullptr; // assignment to Target[TargetIndex]
+        Expression* TargetIndex = nullptr;
+        EqualityExpression* Equality = nullptr;
+        RelationalExpression* Relational = nullptr;
+        AdditiveExpression* Additive = nullptr;
+        MultiplicativeExpression* Multiplicative = nullptr;
+        PostfixExpression* Postfix = nullptr;
+        Primary* Prim = nullptr;
+        // operands of the open layers, which go to their pools side by side once the layer is complete
+        std::vector<std::pair<BinaryOp, Ref<RelationalExpression>>> EqualityRight;
+        std::vector<std::pair<BinaryOp, Ref<AdditiveExpression>>> RelationalRight;
+        std::vector<std::pair<BinaryOp, Ref<MultiplicativeExpression>>> AdditiveRight;
+        std::vector<std::pair<BinaryOp, Ref<PostfixExpression>>> MultiplicativeRight;
+        std::vector<NodeList<Ref<AssignmentExpression>>> Calls;
+        std::vector<Ref<AssignmentExpression>> Arguments;
+    };
+
+    // an if, while or block whose nested statements are still being parsed
+    struct StatementFrame {
+        Statement* Stmt;
+        Block* Items = nullptr; // set for blocks
+        std::vector<Ref<BlockItem>> Parsed = {}; // its items so far
+        bool InElse = false;
+    };
+
     Expression* ParseExpression();
-    Statement* ParseStatement();
-    Block* ParseBlock();
+    void BeginExpression(ExpressionUse use);
+    bool ReduceOperand(ExpressionFrame& frame);
+    Statement* ParseSimpleStatement();
+    Declaration* ParseDeclaration();
+    Block* ParseBlock(TokenType end);
+    Name Intern(std::string_view text);
+    static int64_t LiteralValue(const Token& literal);
 
     const Token& Consume() { return m_Tokens[m_Index++]; }
 
+    // one test of the token against the set of the types, whatever their number
     template <typename... Args>
-    bool Match(TokenType first, Args... rest) {
-        if (((m_Tokens[m_Index].Type == first) || ... || (m_Tokens[m_Index].Type == rest))) {
-            return true;
-        }
-        return false;
+    bool Match(TokenType first, Args... rest) const {
+        return InSet((TokenBit(first) | ... | TokenBit(rest)), m_Tokens[m_Index].Type);
     }
 
     Token Expect(TokenType type);
+    bool IsIndexedAssignment() const;
+    void EnterNesting();
 
     const std::vector<Token> m_Tokens;
     size_t m_Index = 0;
-    ArenaAllocator m_Allocator;
+    ArenaAllocator& m_Allocator; // owns every node of the parsed program
+    const Options& m_Options;
+
+    size_t m_Depth = 0;
+    size_t m_MaxDepth = 0;
+    std::vector<ExpressionFrame> m_ExpressionFrames;
+    std::vector<StatementFrame> m_StatementFrames;
+    std::unordered_map<std::string_view, Name> m_Names; // keyed by the characters in the pool
 };
 
 } // namespace Compiler
@@ -0,0 +1,165 @@
+#include "pass_manager.h"
+#include "bytecode_compiler.h"
+#include "generator.h"
+#include <algorithm>
+#include <chrono>
+#include <format>
+
+namespace Compiler {
+
+PassManager::PassManager(Program* program, ArenaAllocator& allocator, const Options& options)
+    : m_Program(program), m_Allocator(allocator), m_Options(options), m_Analyzer(program, m_Scopes),
+      m_Evaluator(program, allocator, options), m_Eliminator(program, allocator, options),
+      m_Vectorizer(program, allocator, options), m_Numbering(program, allocator),
+      m_Superword(program, allocator, options) {
+    m_Passes = {
+        { "resolve", Stage::Analysis, {}, {}, [this] { m_Analyzer.Analyze(); return 0; } },
+        { "frame", Stage::Analysis, { "resolve" }, {}, [this] { m_Analyzer.LayoutFrame(); return 0; } },
+        { "evaluate", Stage::Tree, { "resolve", "frame" }, { "resolve" },
+            [this] { return m_Evaluator.Evaluate(); } },
+        { "dce", Stage::Tree, { "resolve" }, { "resolve" },
+            [this] { return m_Eliminator.PruneUnreachable(); } },
+        { "dse", Stage::Tree, { "resolve" }, { "resolve" },
+            [this] { return m_Eliminator.EliminateDeadStores(); } },
+        { "unused-vars", Stage::Tree, { "resolve" }, { "resolve" },
+            [this] { return m_Eliminator.RemoveUnusedVariables(); } },
+        { "gvn", Stage::Tree, { "resolve" }, { "resolve" },
+            [this] { return m_Numbering.EliminateRedundancies(); } },
+        { "vectorize", Stage::Tree, { "resolve" }, { "resolve", "frame" },
+            [this] { return m_Vectorizer.Vectorize(); } },
+        { "slp", Stage::Tree, { "resolve" }, { "resolve" }, [this] { return m_Superword.Vectorize(); } },
+        { "layout", Stage::Machine, {}, {}, [this] { return m_Layout->Optimize(); } },
+    };
+}
+
+std::string_view PassManager::Pipeline(int level) {
+    switch (level) {
+        case 0: return "";
+        case 1: return "dce,unused-vars";
+        case 2: return "evaluate,dce,dse,unused-vars,gvn,layout";
+        default: return "evaluate,dce,dse,unused-vars,vectorize,gvn,slp,layout";
+    }
+}
+
+std::string_view PassManager::FirstTransform(std::string_view pipeline) {
+    for (size_t start = 0; start < pipeline.size();) {
+        const size_t end = std::min(pipeline.find(',', start), pipeline.size());
+        const std::string_view name = pipeline.substr(start, end - start);
+        if (name != "resolve" && name != "frame") {
+            return name;
+        }
+        start = end + 1;
+    }
+    return {};
+}
+
+const PassManager::Pass& PassManager::Find(std::string_view name) const {
+    auto it = std::find_if(m_Passes.begin(), m_Passes.end(),
+        [&](const Pass& pass) { return pass.Name == name; });
+    if (it == m_Passes.end()) {
+        Error(std::format("Unknown pass: {}", name));
+    }
+    return *it;
+}
+
+void PassManager::Require(std::string_view analysis) {
+    if (!m_Valid.contains(analysis)) {
+        RunPass(Find(analysis));
+    }
+}
+
+void PassManager::RunPass(const Pass& pass) {
+    for (std::string_view analysis : pass.Requires) {
+        Require(analysis);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const int transformations = pass.Run();
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    m_Statistics.push_back({ pass.Name, pass.Kind == Stage::Analysis, elapsed.count(), transformations });
+
+    if (pass.Kind == Stage::Analysis) {
+        m_Valid.insert(pass.Name);
+    } else if (transformations != 0) {
+        std::erase_if(m_Valid, [&](std::string_view analysis) {
+            return std::find(pass.Preserves.begin(), pass.Preserves.end(), analysis) == pass.Preserves.end();
+        });
+    }
+}
+
+void PassManager::Generate() {
+    Require("resolve");
+    Require("frame");
+
+    const auto start = std::chrono::steady_clock::now();
+    Generator generator(m_Program, m_Options);
+    m_Blocks = generator.GenerateBlocks();
+    m_Layout = std::make_unique<BlockLayout>(m_Blocks);
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    m_Statistics.push_back({ "codegen", false, elapsed.count(), 0 });
+}
+
+// Machine passes need the generated code: the first one runs the generator, and with machine false they
+// are skipped.
+void PassManager::RunPipeline(std::string_view pipeline, bool machine) {
+    m_Statistics.clear();
+    Require("resolve"); // reports undeclared identifiers even when nothing else needs the bindings
+
+    for (size_t start = 0; start < pipeline.size();) {
+        const size_t end = std::min(pipeline.find(',', start), pipeline.size());
+        const Pass& pass = Find(pipeline.substr(start, end - start));
+        start = end + 1;
+
+        if (pass.Kind == Stage::Machine && !machine) {
+            continue;
+        } else if (pass.Kind == Stage::Machine && !m_Layout) {
+            Generate();
+        } else if (pass.Kind != Stage::Machine && m_Layout) {
+            Error(std::format("Pass '{}' works on the syntax tree and must come before 'layout'", pass.Name));
+        }
+        if (pass.Kind == Stage::Analysis && m_Valid.contains(pass.Name)) {
+            continue; // cached
+        }
+        RunPass(pass);
+    }
+}
+
+std::string PassManager::Run(std::string_view pipeline) {
+    RunPipeline(pipeline, true);
+    if (!m_Layout) {
+        Generate();
+    }
+    return Generator::Assemble(m_Layout->Emit(), m_Options);
+}
+
+Bytecode PassManager::RunBytecode(std::string_view pipeline) {
+    RunPipeline(pipeline, false);
+    Require("resolve");
+    Require("frame");
+
+    const auto start = std::chrono::steady_clock::now();
+    Bytecode code = BytecodeCompiler(m_Program, m_Options).Compile();
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    m_Statistics.push_back({ "bytecode", false, elapsed.count(), 0 });
+    return code;
+}
+
+std::string PassManager::FormatStatistics() const {
+    std::string table =
+        std::format("{:<12} {:>10} {:>9} {:>15}\n", "pass", "time (ms)", "changed", "transformations");
+    double total = 0;
+    for (const PassStatistics& pass : m_Statistics) {
+        const bool transform = !pass.Analysis && pass.Name != "codegen" && pass.Name != "bytecode";
+        table += std::format("{:<12} {:>10.3f} {:>9} {:>15}\n", pass.Name, pass.Milliseconds,
+            transform ? (pass.Transformations != 0 ? "yes" : "no") : "-",
+            transform ? std::to_string(pass.Transformations) : "-");
+        total += pass.Milliseconds;
+    }
+    table += std::format("{:<12} {:>10.3f}\n", "total", total);
+    // the node pools, nodes the passes detached from the tree included
+    const auto [nodes, bytes] = m_Allocator.PoolUsage();
+    table += std::format("{:<12} {} nodes, {} KB\n", "tree", nodes, (bytes + 1023) / 1024);
+    return table;
+}
+
+} // namespace Compiler
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "ast.h"
+#include "block_layout.h"
+#include "bytecode.h"
+#include "dead_code_eliminator.h"
+#include "loop_vectorizer.h"
+#include "options.h"
+#include "program_evaluator.h"
+#include "semantic_analyzer.h"
+#include "superword_vectorizer.h"
+#include "symbol_table.h"
+#include "utils.h"
+#include "value_numbering.h"
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace Compiler {
+
+struct PassStatistics {
+    std::string_view Name;
+    bool Analysis;
+    double Milliseconds;
+    int Transformations; // what the pass removed, vectorized or rotated; a transform changed nothing at 0
+};
+
+// Turns a parsed program into assembly by running a pipeline of passes, given as comma-separated pass
+// names. Transforms run in the given order, tree passes before the generator and machine passes after
+// it. Analyses run when a pass requires them and stay cached until a transform that does not preserve
+// them changes the program.
+//   analyses:        resolve (bind identifiers), frame (lay out the stack frame)
+//   tree passes:     evaluate, dce, dse, unused-vars, gvn, vectorize, slp (see ProgramEvaluator,
+//                    DeadCodeEliminator, GlobalValueNumbering, LoopVectorizer, SuperwordVectorizer)
+//   machine passes:  layout (see BlockLayout)
+class PassManager {
+  public:
+    PassManager(Program* program, ArenaAllocator& allocator, const Options& options);
+
+    static std::string_view Pipeline(int level); // -O0 to -O3
+    // the first pass of the pipeline that changes the program or its code, empty when it only has analyses
+    static std::string_view FirstTransform(std::string_view pipeline);
+    std::string Run(std::string_view pipeline);
+    Bytecode RunBytecode(std::string_view pipeline); // for the VirtualMachine; machine passes are skipped
+    std::string FormatStatistics() const;
+
+  private:
+    enum class Stage { Analysis, Tree, Machine };
+
+    struct Pass {
+        std::string_view Name;
+        Stage Kind;
+        std::vector<std::string_view> Requires;  // analyses that must be valid before the pass runs
+        std::vector<std::string_view> Preserves; // analyses that stay valid when the pass changes something
+        std::function<int()> Run;                // returns the number of transformations
+    };
+
+    const Pass& Find(std::string_view name) const;
+    void Require(std::string_view analysis);
+    void RunPass(const Pass& pass);
+    void RunPipeline(std::string_view pipeline, bool machine);
+    void Generate();
+
+    Program* m_Program;
+    ArenaAllocator& m_Allocator;
+    const Options& m_Options;
+    ScopeStack m_Scopes;
+    SemanticAnalyzer m_Analyzer;
+    ProgramEvaluator m_Evaluator;
+    DeadCodeEliminator m_Eliminator;
+    LoopVectorizer m_Vectorizer;
+    GlobalValueNumbering m_Numbering;
+    SuperwordVectorizer m_Superword;
+    std::vector<MachineBlock> m_Blocks;
+    std::unique_ptr<BlockLayout> m_Layout; // set once the generator has run
+
+    std::vector<Pass> m_Passes;
+    std::unordered_set<std::string_view> m_Valid;
+    std::vector<PassStatistics> m_Statistics;
+};
+
+} // namespace Compiler
@@ -0,0 +1,268 @@
+#include "program_evaluator.h"
+#include "ast_visitor.h"
+#include <algorithm>
+#include <format>
+#include <unordered_set>
+
+namespace Compiler {
+
+// slots of the frame model, 8 MB of stack: programs with a larger frame are left to run, as are those that
+// need more than the step budget
+constexpr size_t FrameBudget = size_t(1) << 20;
+
+ProgramEvaluator::ProgramEvaluator(Program* program, ArenaAllocator& allocator, const Options& options)
+    : m_Program(program), m_Allocator(allocator), m_Options(options) {}
+
+int ProgramEvaluator::Evaluate() {
+    if (m_Options.EvaluationBudget == 0) {
+        return 0;
+    }
+    const size_t slots = static_cast<size_t>(m_Program->FrameSize / 8) + 1;
+    if (slots > FrameBudget) {
+        if (m_Options.Verbose) {
+            Note(m_Program->GlobalBlock->Location,
+                std::format("evaluate: skipped, the frame takes more than {} slots", FrameBudget));
+        }
+        return 0;
+    }
+    m_Frame.assign(slots, 0);
+    m_Assigned.assign(slots, false);
+    m_LoggedIn.assign(slots, 0);
+    m_Statement = 0;
+    m_Output.clear();
+    m_ExitCode.reset();
+    m_Steps = 0;
+
+    Block* global = m_Program->GlobalBlock;
+    int replaced = 0;
+    std::optional<SourceLocation> first;
+    size_t prefixEnd = 0;
+    for (; prefixEnd < global->Items.size() && !m_ExitCode; ++prefixEnd) {
+        auto* stmt = std::get_if<Ref<Statement>>(&global->Items[prefixEnd]->Item);
+        if (!stmt) {
+            Forget(std::get<Ref<Declaration>>(global->Items[prefixEnd]->Item));
+            continue;
+        }
+
+        const size_t outputSize = m_Output.size();
+        m_UndoLog.clear();
+        m_Statement++;
+        try {
+            ExecuteStatement(*stmt); // sets m_ExitCode when the program returns
+        } catch (const Abandon& abandon) {
+            Rollback(outputSize);
+            if (m_Options.Verbose) {
+                Note((*stmt)->Location, "evaluate: stopped, " + abandon.Reason);
+            }
+            break;
+        }
+        first = first.value_or((*stmt)->Location);
+        replaced += !std::holds_alternative<Ref<PrecomputedStatement>>((*stmt)->Stmt);
+    }
+    if (prefixEnd == global->Items.size() && !m_ExitCode) {
+        m_ExitCode = 0; // fell off the end of the program
+    }
+
+    if (replaced == 0) {
+        return 0; // nothing new, at most an earlier result ran again
+    }
+    if (m_Options.Verbose) {
+        Note(*first, m_ExitCode ? "evaluate: ran the program at compile time"
+                                : std::format("evaluate: ran the first {} statements at compile time", replaced));
+    }
+    Replace(prefixEnd, *first);
+    return replaced;
+}
+
+// Turns the items before prefixEnd into one PrecomputedStatement, keeping the declarations the rest
+// of the program still uses.
+void ProgramEvaluator::Replace(size_t prefixEnd, SourceLocation loc) {
+    Block* global = m_Program->GlobalBlock;
+    auto* precomputed = m_Allocator.alloc<PrecomputedStatement>();
+    precomputed->Output = m_Allocator.allocList<char>(m_Output);
+    precomputed->ExitCode = m_ExitCode;
+
+    std::vector<Ref<BlockItem>> items;
+    std::vector<PrecomputedStatement::Value> values;
+    if (!m_ExitCode) {
+        std::unordered_set<const Declaration*> used;
+        for (size_t i = prefixEnd; i < global->Items.size(); ++i) {
+            if (auto* stmt = std::get_if<Ref<Statement>>(&global->Items[i]->Item)) {
+                VisitStatementExpressions(*stmt, [&](Expression* expr) {
+                    VisitExpression(expr, overloaded{ [&](Primary* primary) { used.insert(primary->Decl); },
+                                              [&](AssignmentExpression* assign) { used.insert(assign->Decl); } });
+                });
+            }
+        }
+
+        for (size_t i = 0; i < prefixEnd; ++i) {
+            auto* decl = std::get_if<Ref<Declaration>>(&global->Items[i]->Item);
+            if (!decl || !used.contains(*decl)) {
+                continue;
+            }
+            items.push_back(global->Items[i]);
+
+            const int64_t size = std::max<int64_t>((*decl)->Size, 1);
+            std::vector<int64_t> elements;
+            bool assigned = false;
+            for (int64_t index = 0; index < size; ++index) {
+                const size_t slot = Slot(*decl, index);
+                elements.push_back(m_Frame[slot]); // elements never assigned were undefined, 0 will do
+                assigned |= m_Assigned[slot];
+            }
+            if (assigned) {
+                values.push_back({ *decl, m_Allocator.allocList<int64_t>(elements) });
+            }
+        }
+    }
+    precomputed->Values = m_Allocator.allocList<PrecomputedStatement::Value>(values);
+
+    auto* stmt = m_Allocator.alloc<Statement>(precomputed, loc);
+    items.push_back(m_Allocator.alloc<BlockItem>(stmt));
+    items.insert(items.end(), global->Items.begin() + prefixEnd, global->Items.end());
+    global->Items = m_Allocator.allocList<Ref<BlockItem>>(items);
+}
+
+void ProgramEvaluator::Rollback(size_t outputSize) {
+    for (auto it = m_UndoLog.rbegin(); it != m_UndoLog.rend(); ++it) {
+        m_Frame[it->Slot] = it->Value;
+        m_Assigned[it->Slot] = it->Assigned;
+    }
+    m_Output.resize(outputSize);
+}
+
+void ProgramEvaluator::Step() {
+    if (++m_Steps > m_Options.EvaluationBudget) {
+        throw Abandon{ std::format("the budget of {} steps is used up", m_Options.EvaluationBudget) };
+    }
+}
+
+size_t ProgramEvaluator::Slot(const Declaration* decl, int64_t index) const {
+    if (index < 0 || index >= std::max<int64_t>(decl->Size, 1)) {
+        const std::string_view name = decl->Ident;
+        throw Abandon{ std::format("index {} is out of bounds for '{}'", index, name) };
+    }
+    return static_cast<size_t>(decl->Offset / 8 - index);
+}
+
+int64_t ProgramEvaluator::Load(const Declaration* decl, int64_t index) const {
+    const size_t slot = Slot(decl, index);
+    if (!m_Assigned[slot]) {
+        throw Abandon{ "'" + std::string(decl->Ident) + "' is read before it is assigned" };
+    }
+    return m_Frame[slot];
+}
+
+void ProgramEvaluator::Store(size_t slot, int64_t value, bool assigned) {
+    if (m_LoggedIn[slot] != m_Statement) {
+        m_LoggedIn[slot] = m_Statement;
+        m_UndoLog.push_back({ slot, m_Frame[slot], m_Assigned[slot] });
+    }
+    m_Frame[slot] = value;
+    m_Assigned[slot] = assigned;
+}
+
+void ProgramEvaluator::Forget(const Declaration* decl) {
+    for (int64_t index = 0; index < std::max<int64_t>(decl->Size, 1); ++index) {
+        const size_t slot = Slot(decl, index);
+        Store(slot, m_Frame[slot], false);
+    }
+}
+
+// evaluates in the order of the generated code: an array index first, then the operands left to right
+template <typename Expr>
+int64_t ProgramEvaluator::EvaluateExpression(const Expr* expr) {
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        const AssignmentExpression* assign = expr->Expr;
+        if (!assign->Ident) {
+            return EvaluateExpression(assign->Expr.Get());
+        }
+        const int64_t index = assign->Index ? EvaluateExpression(assign->Index.Get()) : 0;
+        const int64_t value = EvaluateExpression(assign->Expr.Get());
+        Store(Slot(assign->Decl, index), value, true);
+        if (m_Options.Trace && !assign->Silent) {
+            m_Output += std::to_string(value);
+            m_Output += '\n';
+        }
+        Step();
+        return value;
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        return EvaluateExpression(expr->Prim.Get()); // like the generator, ignores call arguments
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        Step();
+        if (const auto* i = std::get_if<int64_t>(&expr->Value)) {
+            return *i;
+        } else if (const auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            return EvaluateExpression<Expression>(*inner);
+        }
+        return Load(expr->Decl, expr->Index ? EvaluateExpression<Expression>(expr->Index) : 0);
+    } else {
+        int64_t value = EvaluateExpression(expr->Left.Get());
+        for (const auto& [op, right] : expr->Right) {
+            const std::optional<int64_t> result = EvaluateBinaryOp(op, value, EvaluateExpression(right.Get()));
+            if (!result) {
+                throw Abandon{ "the division faults" };
+            }
+            value = *result;
+            Step();
+        }
+        return value;
+    }
+}
+
+bool ProgramEvaluator::ExecuteStatement(const Statement* stmt) {
+    Step();
+    return std::visit(
+        overloaded{ [&](const ExpressionStatement* exprStmt) {
+                       EvaluateExpression(exprStmt->Expr.Get());
+                       return false;
+                   },
+            [&](const ReturnStatement* retStmt) {
+                m_ExitCode = retStmt->Expr ? EvaluateExpression(retStmt->Expr.Get()) : 0;
+                return true;
+            },
+            [&](IfStatement* ifStmt) {
+                if (EvaluateExpression(ifStmt->Cond.Get()) != 0) {
+                    ifStmt->Taken++;
+                    return ExecuteStatement(ifStmt->Then);
+                }
+                ifStmt->NotTaken++;
+                return ifStmt->Else && ExecuteStatement(ifStmt->Else);
+            },
+            [&](const WhileStatement* whileStmt) {
+                // a vectorized loop computes the same as its scalar form
+                while (EvaluateExpression(whileStmt->Cond.Get()) != 0) {
+                    if (ExecuteStatement(whileStmt->Loop)) {
+                        return true;
+                    }
+                }
+                return false;
+            },
+            [&](const Block* block) { return ExecuteBlock(block); },
+            [&](const PrecomputedStatement* precomputed) {
+                m_Output.append(precomputed->Output.begin(), precomputed->Output.end());
+                for (const PrecomputedStatement::Value& value : precomputed->Values) {
+                    for (size_t index = 0; index < value.Elements.size(); ++index) {
+                        Store(Slot(value.Decl, static_cast<int64_t>(index)), value.Elements[index], true);
+                    }
+                }
+                m_ExitCode = precomputed->ExitCode;
+                return m_ExitCode.has_value();
+            } },
+        stmt->Stmt);
+}
+
+bool ProgramEvaluator::ExecuteBlock(const Block* block) {
+    for (const BlockItem* item : block->Items) {
+        if (auto* stmt = std::get_if<Ref<Statement>>(&item->Item)) {
+            if (ExecuteStatement(*stmt)) {
+                return true;
+            }
+        } else {
+            Forget(std::get<Ref<Declaration>>(item->Item));
+        }
+    }
+    return false;
+}
+
+} // namespace Compiler
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+#include "utils.h"
+#include <string>
+#include <vector>
+
+namespace Compiler {
+
+// Programs take no input, so what they do up to their first fault is already known at compile time.
+// This runs the statements of the global block in order on a model of the stack frame, for at most
+// Options::EvaluationBudget steps in all, and replaces the leading statements that finished with a
+// PrecomputedStatement. A program that ends within the budget is reduced to its output and exit
+// code; otherwise the rest of it starts from the precomputed variable values. Evaluation stops at the
+// first statement that faults (division by zero, an index out of bounds, reading a variable that was
+// never assigned) or runs out of steps, and that statement is left to run normally. A program whose
+// frame is larger than the model may take is not evaluated at all.
+class ProgramEvaluator {
+  public:
+    ProgramEvaluator(Program* program, ArenaAllocator& allocator, const Options& options);
+    int Evaluate(); // returns the number of statements replaced; needs the frame layout
+
+  private:
+    struct Abandon { // the statement being run cannot be finished at compile time
+        std::string Reason;
+    };
+
+    template <typename Expr>
+    int64_t EvaluateExpression(const Expr* expr);
+    bool ExecuteStatement(const Statement* stmt); // returns true when the program exits
+    bool ExecuteBlock(const Block* block);
+
+    size_t Slot(const Declaration* decl, int64_t index) const;
+    int64_t Load(const Declaration* decl, int64_t index) const;
+    void Store(size_t slot, int64_t value, bool assigned);
+    void Forget(const Declaration* decl); // its block is entered (again)
+    void Step();
+
+    void Rollback(size_t outputSize);
+    void Replace(size_t prefixEnd, SourceLocation loc);
+
+    Program* m_Program;
+    ArenaAllocator& m_Allocator;
+    const Options& m_Options;
+
+    // slot n stands for [rbp - 8 * n], so variables share slots exactly as in the generated code
+    std::vector<int64_t> m_Frame;
+    std::vector<bool> m_Assigned;
+
+    // the first overwritten value of each slot, to undo a top-level statement that does not finish
+    struct Undo {
+        size_t Slot;
+        int64_t Value;
+        bool Assigned;
+    };
+    std::vector<Undo> m_UndoLog;
+    std::vector<uint32_t> m_LoggedIn; // the top-level statement that last logged each slot
+    uint32_t m_Statement = 0;
+
+    std::string m_Output;
+    std::optional<int64_t> m_ExitCode;
+    uint64_t m_Steps = 0;
+};
+
+} // namespace Compiler
@@ -0,0 +1,142 @@
+; Runtime linked into every program that prints. Generator::Assemble appends it to the generated code.
+;
+; Output is collected in a userspace buffer and written with one syscall when the buffer fills up or
+; the program exits, instead of two syscalls per printed value. The routines follow the System V
+; calling convention and touch only caller-saved registers, so nothing has to be saved or restored.
+
+PRINT_BUFFER_SIZE equ 65536
+
+section .bss
+alignb 64
+print_buffer: resb PRINT_BUFFER_SIZE
+print_length: resq 1
+
+section .data
+digit_pairs: db "00010203040506070809101112131415161718192021222324"
+             db "25262728293031323334353637383940414243444546474849"
+             db "50515253545556575859606162636465666768697071727374"
+             db "75767778798081828384858687888990919293949596979899"
+
+section .text
+
+; print(rdi): appends rdi in decimal and a newline to the buffer and returns rdi in rax.
+; The digits are produced two at a time, back to front, into the red zone below rsp; division by 100
+; is done as a multiplication by its reciprocal.
+print:
+    mov r8, [rel print_length]
+    cmp r8, PRINT_BUFFER_SIZE - 32
+    ja .flush
+.format:
+    mov r9, rdi
+    neg r9
+    cmovs r9, rdi                   ; |rdi|, also right for INT64_MIN when read as unsigned
+    lea rsi, [rsp - 8]
+    mov byte [rsi], 10
+    mov r10, 0x28F5C28F5C28F5C3
+    lea r11, [rel digit_pairs]
+.pairs:
+    cmp r9, 100
+    jb .last
+    mov rax, r9
+    shr rax, 2
+    mul r10
+    shr rdx, 2                      ; rdx = r9 / 100
+    imul rcx, rdx, 100
+    neg rcx
+    add rcx, r9
+    movzx ecx, word [r11 + rcx * 2]
+    sub rsi, 2
+    mov [rsi], cx
+    mov r9, rdx
+    jmp .pairs
+.last:
+    cmp r9, 10
+    jb .single
+    movzx ecx, word [r11 + r9 * 2]
+    sub rsi, 2
+    mov [rsi], cx
+    jmp .sign
+.single:
+    add r9d, '0'
+    dec rsi
+    mov [rsi], r9b
+.sign:
+    test rdi, rdi
+    jns .copy
+    dec rsi
+    mov byte [rsi], '-'
+.copy:
+    ; at most 21 bytes; copying 32 is fine, the buffer has room for them
+    lea rcx, [rel print_buffer]
+    add rcx, r8
+    movdqu xmm0, [rsi]
+    movdqu xmm1, [rsi + 16]
+    movdqu [rcx], xmm0
+    movdqu [rcx + 16], xmm1
+    lea rax, [rsp - 7]
+    sub rax, rsi
+    add r8, rax
+    mov [rel print_length], r8
+    mov rax, rdi
+    ret
+.flush:
+    push rdi
+    call print_flush
+    pop rdi
+    xor r8d, r8d
+    jmp .format
+
+; print_text(rsi, rdx): appends rdx bytes at rsi to the buffer, or writes them out directly when they
+; do not fit into it.
+print_text:
+    mov rax, [rel print_length]
+    lea rcx, [rax + rdx]
+    cmp rcx, PRINT_BUFFER_SIZE
+    jbe .append
+    push rsi
+    push rdx
+    call print_flush
+    pop rdx
+    pop rsi
+    cmp rdx, PRINT_BUFFER_SIZE
+    ja write_all
+    xor eax, eax
+.append:
+    lea rdi, [rel print_buffer]
+    add rdi, rax
+    add rax, rdx
+    mov [rel print_length], rax
+    mov rcx, rdx
+    rep movsb
+    ret
+
+; print_flush(): writes out the buffer.
+print_flush:
+    mov rdx, [rel print_length]
+    lea rsi, [rel print_buffer]
+    mov qword [rel print_length], 0
+
+; write_all(rsi, rdx): writes rdx bytes at rsi to stdout, retrying short and interrupted writes.
+write_all:
+    test rdx, rdx
+    jz .done
+    mov eax, 1
+    mov edi, 1
+    syscall
+    cmp rax, -4                     ; EINTR
+    je write_all
+    test rax, rax
+    jle .done
+    add rsi, rax
+    sub rdx, rax
+    jmp write_all
+.done:
+    ret
+
+; exit(rdi): flushes the output and exits with status rdi.
+exit:
+    push rdi
+    call print_flush
+    pop rdi
+    mov eax, 60
+    syscall
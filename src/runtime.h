@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string_view>
+
+namespace Compiler {
+
+// src/runtime.asm, embedded at build time; the generated programs include it instead of linking print.o
+extern const std::string_view RuntimeSource;
+
+} // namespace Compiler
@@ -1,11 +1,211 @@
 #include "semantic_analyzer.h"
+#include "ast_visitor.h"
 #include "symbol_table.h"
+#include <algorithm>
+#include <format>
 
 namespace Compiler {
 
 SemanticAnalyzer::SemanticAnalyzer(Program* program, ScopeStack& scopes)
     : m_Program(program), m_Scopes(scopes) {}
 
-void SemanticAnalyzer::Analyze() {}
+void SemanticAnalyzer::Analyze() {
+    AnalyzeBlock(m_Program->GlobalBlock);
+}
+
+void SemanticAnalyzer::LayoutFrame() {
+    m_StackSize = 0;
+    m_MaxStackSize = 0;
+    m_Placed.clear();
+
+    LayoutBlock(m_Program->GlobalBlock);
+    m_Program->FrameSize = m_MaxStackSize * 8;
+}
+
+void SemanticAnalyzer::BeginItems() {
+    m_StackSize = 0;
+    m_MaxStackSize = 0;
+    m_Placed.clear();
+    m_Scopes.EnterScope();
+}
+
+int64_t SemanticAnalyzer::AddItem(BlockItem* item) {
+    if (auto* stmt = std::get_if<Ref<Statement>>(&item->Item)) {
+        AnalyzeStatement(*stmt);
+        const int64_t deepest = m_MaxStackSize;
+        m_MaxStackSize = m_StackSize;
+        LayoutStatement(*stmt);
+        const int64_t depth = m_MaxStackSize;
+        m_MaxStackSize = std::max(deepest, depth);
+        return depth;
+    }
+    Declaration* decl = std::get<Ref<Declaration>>(item->Item);
+    m_Scopes.Insert(decl->Ident, { VARIABLE, decl });
+    LayoutDeclaration(decl);
+    return m_StackSize;
+}
+
+void SemanticAnalyzer::SkipItem(int64_t depth) {
+    m_MaxStackSize = std::max(m_MaxStackSize, depth);
+}
+
+void SemanticAnalyzer::EndItems() {
+    m_Scopes.ExitScope();
+    m_Program->FrameSize = m_MaxStackSize * 8;
+}
+
+Declaration* SemanticAnalyzer::Resolve(std::string_view name, SourceLocation loc) const {
+    const TableEntry* entry = m_Scopes.Find(name);
+    if (!entry) {
+        Error(loc, "Undeclared identifier: " + std::string(name));
+    }
+    return entry->Decl;
+}
+
+void SemanticAnalyzer::AnalyzePrimary(Primary* primary) {
+    std::visit(overloaded{ [&](int64_t) {},
+                   [&](Name name) {
+                       primary->Decl = Resolve(name, primary->Location);
+                       CheckIndex(primary->Decl, primary->Index, primary->Location);
+                   },
+                   [&](Expression* expr) { AnalyzeExpression(expr); } },
+        primary->Value);
+}
+
+void SemanticAnalyzer::AnalyzePostfixExpression(PostfixExpression* expr) {
+    AnalyzePrimary(expr->Prim);
+}
+
+void SemanticAnalyzer::AnalyzeMultiplicativeExpression(MultiplicativeExpression* expr) {
+    AnalyzePostfixExpression(expr->Left);
+    for (const auto& [op, right] : expr->Right) {
+        AnalyzePostfixExpression(right);
+    }
+}
+
+void SemanticAnalyzer::AnalyzeAdditiveExpression(AdditiveExpression* expr) {
+    AnalyzeMultiplicativeExpression(expr->Left);
+    for (const auto& [op, right] : expr->Right) {
+        AnalyzeMultiplicativeExpression(right);
+    }
+}
+
+void SemanticAnalyzer::AnalyzeRelationalExpression(RelationalExpression* expr) {
+    AnalyzeAdditiveExpression(expr->Left);
+    for (const auto& [op, right] : expr->Right) {
+        AnalyzeAdditiveExpression(right);
+    }
+}
+
+void SemanticAnalyzer::AnalyzeEqualityExpression(EqualityExpression* expr) {
+    AnalyzeRelationalExpression(expr->Left);
+    for (const auto& [op, right] : expr->Right) {
+        AnalyzeRelationalExpression(right);
+    }
+}
+
+void SemanticAnalyzer::AnalyzeExpression(Expression* expr) {
+    AssignmentExpression* assign = expr->Expr;
+    AnalyzeEqualityExpression(assign->Expr);
+    if (assign->Ident) {
+        assign->Decl = Resolve(assign->Ident, assign->Location);
+        CheckIndex(assign->Decl, assign->Index, assign->Location);
+    }
+}
+
+// arrays are only used element by element, and constant indices must be in bounds
+void SemanticAnalyzer::CheckIndex(const Declaration* decl, Expression* index, SourceLocation loc) {
+    if (!index) {
+        if (decl->Size != 0) {
+            Error(loc, "Array '" + std::string(decl->Ident) + "' must be indexed");
+        }
+        return;
+    }
+    if (decl->Size == 0) {
+        Error(loc, "'" + std::string(decl->Ident) + "' is not an array");
+    }
+
+    AnalyzeExpression(index);
+    if (const auto value = FoldConstant(index); value && (*value < 0 || *value >= decl->Size)) {
+        Error(loc, std::format("Index {} is out of bounds for '{}' of size {}", *value,
+                       std::string_view(decl->Ident), decl->Size));
+    }
+}
+
+void SemanticAnalyzer::AnalyzeBlock(Block* block) {
+    m_Scopes.EnterScope();
+
+    for (const auto& item : block->Items) {
+        std::visit(overloaded{ [&](Statement* stmt) { AnalyzeStatement(stmt); },
+                       [&](Declaration* decl) { m_Scopes.Insert(decl->Ident, { VARIABLE, decl }); } },
+            item->Item);
+    }
+
+    m_Scopes.ExitScope();
+}
+
+void SemanticAnalyzer::AnalyzeStatement(Statement* stmt) {
+    std::visit(overloaded{ [&](ExpressionStatement* exprStmt) { AnalyzeExpression(exprStmt->Expr); },
+                   [&](ReturnStatement* retStmt) {
+                       if (retStmt->Expr) {
+                           AnalyzeExpression(retStmt->Expr);
+                       }
+                   },
+                   [&](IfStatement* ifStmt) {
+                       AnalyzeExpression(ifStmt->Cond);
+                       AnalyzeStatement(ifStmt->Then);
+                       if (ifStmt->Else) {
+                           AnalyzeStatement(ifStmt->Else);
+                       }
+                   },
+                   [&](WhileStatement* whileStmt) {
+                       AnalyzeExpression(whileStmt->Cond);
+                       AnalyzeStatement(whileStmt->Loop);
+                   },
+                   [&](Block* block) { AnalyzeBlock(block); }, [](PrecomputedStatement*) {} },
+        stmt->Stmt);
+}
+
+void SemanticAnalyzer::LayoutBlock(Block* block) {
+    const int64_t stackBefore = m_StackSize;
+
+    for (const auto& item : block->Items) {
+        std::visit(overloaded{ [&](Statement* stmt) { LayoutStatement(stmt); },
+                       [&](Declaration* decl) { LayoutDeclaration(decl); } },
+            item->Item);
+    }
+
+    m_StackSize = stackBefore; // the slots are free for sibling blocks
+}
+
+void SemanticAnalyzer::LayoutDeclaration(Declaration* decl) {
+    if (!decl->Packed) {
+        m_StackSize += std::max<int64_t>(decl->Size, 1);
+        decl->Offset = m_StackSize * 8;
+    } else if (m_Placed.insert(decl->Packed).second) {
+        const NodeList<Ref<Declaration>>& lanes = decl->Packed->Lanes;
+        m_StackSize += static_cast<int64_t>(lanes.size());
+        for (size_t lane = 0; lane < lanes.size(); lane++) {
+            lanes[lane]->Offset = (m_StackSize - static_cast<int64_t>(lane)) * 8;
+        }
+    }
+    if (m_StackSize > MaxFrameSlots) {
+        Error(decl->Location, std::format("Stack frame too large: more than {} slots", MaxFrameSlots));
+    }
+    m_MaxStackSize = std::max(m_MaxStackSize, m_StackSize);
+}
+
+void SemanticAnalyzer::LayoutStatement(Statement* stmt) {
+    std::visit(overloaded{ [&](IfStatement* ifStmt) {
+                              LayoutStatement(ifStmt->Then);
+                              if (ifStmt->Else) {
+                                  LayoutStatement(ifStmt->Else);
+                              }
+                          },
+                   [&](WhileStatement* whileStmt) { LayoutStatement(whileStmt->Loop); },
+                   [&](Block* block) { LayoutBlock(block); }, [](ExpressionStatement*) {},
+                   [](ReturnStatement*) {}, [](PrecomputedStatement*) {} },
+        stmt->Stmt);
+}
 
 } // namespace Compiler
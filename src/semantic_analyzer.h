@@ -1,19 +1,52 @@
 #pragma once
 
 #include "parser.h"
+#include <unordered_set>
 
 namespace Compiler {
 
 class ScopeStack;
 
+// Binds every identifier use to its Declaration and lays out the stack frame. Each declaration
+// gets a fixed slot at [rbp - Offset]; slots are released when their block ends, so disjoint
+// scopes share storage and Program::FrameSize is the deepest point reached. Scalars packed by
+// SuperwordVectorizer, which are declared in the same block, take adjacent slots from the first of
+// them declared.
 class SemanticAnalyzer {
   public:
     SemanticAnalyzer(Program* program, ScopeStack& scopes);
-    void Analyze();
+    void Analyze();     // binds the identifiers
+    void LayoutFrame(); // rerun after passes that add or remove declarations
+
+    // Analyze() and LayoutFrame() over the items of the global block one at a time, for
+    // IncrementalCompiler: a statement it kept from before is skipped, and only its frame depth counted
+    void BeginItems();
+    int64_t AddItem(BlockItem* item); // returns the deepest point of the frame (in slots) within it
+    void SkipItem(int64_t depth);
+    void EndItems();
 
   private:
+    void AnalyzePrimary(Primary* primary);
+    void AnalyzePostfixExpression(PostfixExpression* expr);
+    void AnalyzeMultiplicativeExpression(MultiplicativeExpression* expr);
+    void AnalyzeAdditiveExpression(AdditiveExpression* expr);
+    void AnalyzeRelationalExpression(RelationalExpression* expr);
+    void AnalyzeEqualityExpression(EqualityExpression* expr);
+    void AnalyzeExpression(Expression* expr);
+    void AnalyzeBlock(Block* block);
+    void AnalyzeStatement(Statement* stmt);
+
+    void LayoutBlock(Block* block);
+    void LayoutDeclaration(Declaration* decl);
+    void LayoutStatement(Statement* stmt);
+
+    Declaration* Resolve(std::string_view name, SourceLocation loc) const;
+    void CheckIndex(const Declaration* decl, Expression* index, SourceLocation loc);
+
     Program* m_Program;
-    int64_t m_StackSize = 0;
+    std::unordered_set<const PackedSlots*> m_Placed;
+    int64_t m_StackSize = 0; // slots currently in use
+    int64_t m_MaxStackSize = 0;
     ScopeStack& m_Scopes;
 };
 
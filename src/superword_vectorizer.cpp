@@ -0,0 +1,515 @@
+#include "superword_vectorizer.h"
+#include "ast_visitor.h"
+#include <algorithm>
+#include <utility>
+
+namespace Compiler {
+
+using Step = SuperwordVectorizer::Step;
+template <typename T>
+using LaneArray = std::array<const T*, SuperwordVectorizer::MaxLanes>;
+
+static constexpr int MaxDepth = 14; // of the stack of vector registers, the one above it is scratch
+static constexpr int MaxRounds = 4;
+
+// Costs count instructions, like those of InstructionSelector. A load of a vector that overlaps scalar
+// stores still in flight waits for them to retire, which costs about as much as a dozen instructions.
+static constexpr int64_t StoreForwardingStall = 12;
+// A vector that a loop loads back from where it stored it the time before waits longer for that store
+// than the scalars would, whose chains overlap and which the processor may forward in registers.
+static constexpr int64_t LoopCarried = 4;
+
+// element `index` of an array, or -1 for a scalar, when the slot is fixed and within the frame
+static std::optional<int64_t> SlotIndex(const Declaration* decl, const Expression* index) {
+    if (!decl || (decl->Size == 0) != !index) {
+        return std::nullopt;
+    } else if (!index) {
+        return -1;
+    }
+    const std::optional<int64_t> element = FoldConstant(index);
+    if (!element || *element < 0 || *element >= decl->Size) {
+        return std::nullopt;
+    }
+    return element;
+}
+
+template <typename Left, typename Right>
+static bool SameSlot(const Left* left, const Right* right) {
+    return left->Decl == right->Decl &&
+           SlotIndex(left->Decl, left->Index) == SlotIndex(right->Decl, right->Index);
+}
+
+// the assignment that is all a block item does, if it is one
+static const AssignmentExpression* AssignmentOf(const BlockItem* item) {
+    const auto* stmt = std::get_if<Ref<Statement>>(&item->Item);
+    const auto* exprStmt = stmt ? std::get_if<Ref<ExpressionStatement>>(&(*stmt)->Stmt) : nullptr;
+    return exprStmt && (*exprStmt)->Expr->Expr->Ident ? (*exprStmt)->Expr->Expr.Get() : nullptr;
+}
+
+using Slot = std::pair<const Declaration*, int64_t>; // an element, or -1 for a scalar
+
+static std::vector<Slot> SlotsOf(const Step& step, size_t lanes) {
+    std::vector<Slot> slots;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        const Primary* leaf = step.Leaves[lane];
+        slots.emplace_back(leaf->Decl, *SlotIndex(leaf->Decl, leaf->Index));
+    }
+    return slots;
+}
+
+static std::vector<Slot> SlotsOf(const std::vector<const AssignmentExpression*>& lanes) {
+    std::vector<Slot> slots;
+    for (const AssignmentExpression* assign : lanes) {
+        slots.emplace_back(assign->Decl, *SlotIndex(assign->Decl, assign->Index));
+    }
+    return slots;
+}
+
+// whether the slots are adjacent and in order already: elements of an array, or scalars packed just so
+static bool InOrder(const std::vector<Slot>& slots) {
+    if (slots[0].second >= 0) {
+        for (size_t lane = 0; lane < slots.size(); lane++) {
+            if (slots[lane].first != slots[0].first ||
+                slots[lane].second != slots[0].second + static_cast<int64_t>(lane)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    const PackedSlots* packed = slots[0].first->Packed;
+    return packed &&
+           std::equal(slots.begin(), slots.end(), packed->Lanes.begin(), packed->Lanes.end(),
+               [](const Slot& slot, const Ref<Declaration>& lane) { return slot.first == lane.Get(); });
+}
+
+static bool IsComparison(BinaryOp op) {
+    return op != BinaryOp::Add && op != BinaryOp::Sub && op != BinaryOp::Mul && op != BinaryOp::Div &&
+           op != BinaryOp::Mod;
+}
+
+// there is no multiply of 64-bit lanes before AVX-512, and no comparison of them in SSE2
+static bool Packable(BinaryOp op, const Options& options) {
+    return op == BinaryOp::Add || op == BinaryOp::Sub || (IsComparison(op) && options.Avx2);
+}
+
+// appends the steps of the lanes, which must have the same operators in the same places
+template <typename Expr>
+static bool Flatten(const LaneArray<Expr>& lanes, size_t count, const Options& options,
+                    std::vector<Step>& steps) {
+    if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        LaneArray<Primary> primaries{};
+        for (size_t lane = 0; lane < count; lane++) {
+            if (!lanes[lane]->CallList.empty()) {
+                return false;
+            }
+            primaries[lane] = lanes[lane]->Prim;
+        }
+        return Flatten(primaries, count, options, steps);
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        const auto inner = [](const Primary* primary) -> const Expression* {
+            const auto* expr = std::get_if<Ref<Expression>>(&primary->Value);
+            return expr ? expr->Get() : nullptr;
+        };
+        if (inner(lanes[0])) {
+            LaneArray<EqualityExpression> values{};
+            for (size_t lane = 0; lane < count; lane++) {
+                const Expression* expr = inner(lanes[lane]);
+                if (!expr || expr->Expr->Ident) {
+                    return false;
+                }
+                values[lane] = expr->Expr->Expr;
+            }
+            return Flatten(values, count, options, steps);
+        }
+        Step& step = steps.emplace_back();
+        const bool constant = std::holds_alternative<int64_t>(lanes[0]->Value);
+        for (size_t lane = 0; lane < count; lane++) {
+            const Primary* leaf = lanes[lane];
+            if (inner(leaf) || std::holds_alternative<int64_t>(leaf->Value) != constant ||
+                (!constant && !SlotIndex(leaf->Decl, leaf->Index))) {
+                return false;
+            }
+            step.Leaves[lane] = leaf;
+        }
+        return true;
+    } else {
+        using Operand = std::remove_cvref_t<decltype(*lanes[0]->Left.Get())>;
+        LaneArray<Operand> operands{};
+        for (size_t lane = 0; lane < count; lane++) {
+            if (lanes[lane]->Right.size() != lanes[0]->Right.size()) {
+                return false;
+            }
+            operands[lane] = lanes[lane]->Left;
+        }
+        if (!Flatten(operands, count, options, steps)) {
+            return false;
+        }
+        for (size_t i = 0; i < lanes[0]->Right.size(); i++) {
+            const BinaryOp op = lanes[0]->Right[i].first;
+            if (!Packable(op, options)) {
+                return false;
+            }
+            for (size_t lane = 0; lane < count; lane++) {
+                if (lanes[lane]->Right[i].first != op) {
+                    return false;
+                }
+                operands[lane] = lanes[lane]->Right[i].second;
+            }
+            if (!Flatten(operands, count, options, steps)) {
+                return false;
+            }
+            steps.push_back({ {}, op });
+        }
+        return true;
+    }
+}
+
+std::optional<std::vector<Step>> SuperwordVectorizer::Steps(
+    const std::vector<const AssignmentExpression*>& lanes, const Options& options) {
+    const size_t count = lanes.size();
+    if (count < 2 || count > MaxLanes) {
+        return std::nullopt;
+    }
+    LaneArray<EqualityExpression> values{};
+    for (size_t lane = 0; lane < count; lane++) {
+        if (!lanes[lane]->Ident || !SlotIndex(lanes[lane]->Decl, lanes[lane]->Index)) {
+            return std::nullopt;
+        }
+        values[lane] = lanes[lane]->Expr;
+    }
+    std::vector<Step> steps;
+    if (!Flatten(values, count, options, steps)) {
+        return std::nullopt;
+    }
+
+    // every lane is computed before any is assigned
+    int depth = 0;
+    int deepest = 0;
+    for (const Step& step : steps) {
+        if (step.Op) {
+            depth--;
+            continue;
+        }
+        deepest = std::max(deepest, ++depth);
+        for (size_t lane = 0; lane < count; lane++) {
+            const Primary* leaf = step.Leaves[lane];
+            for (size_t earlier = 0; std::holds_alternative<Name>(leaf->Value) && earlier < lane; earlier++) {
+                if (SameSlot(leaf, lanes[earlier])) {
+                    return std::nullopt;
+                }
+            }
+        }
+    }
+    for (size_t lane = 0; lane < count; lane++) {
+        for (size_t earlier = 0; earlier < lane; earlier++) {
+            if (SameSlot(lanes[earlier], lanes[lane])) {
+                return std::nullopt;
+            }
+        }
+    }
+    if (deepest > MaxDepth) {
+        return std::nullopt;
+    }
+    return steps;
+}
+
+SuperwordVectorizer::SuperwordVectorizer(Program* program, ArenaAllocator& allocator, const Options& options)
+    : m_Program(program), m_Allocator(allocator), m_Options(options) {}
+
+// Whether a pack stalls store forwarding depends on how the rest of its loop accesses the same variables,
+// which depends on the other packs: the program is packed again with what the last round packed until
+// that settles.
+int SuperwordVectorizer::Vectorize() {
+    m_Accesses = {};
+    for (int round = 0; round < MaxRounds; round++) {
+        m_Packs = 0;
+        m_Notes.clear();
+        m_DeclaredIn.clear();
+        ClearBlock(m_Program->GlobalBlock); // packs of an earlier round or run
+        VectorizeBlock(m_Program->GlobalBlock);
+
+        LoopAccesses accesses;
+        AccessBlock(m_Program->GlobalBlock, accesses);
+        if (accesses == m_Accesses) {
+            break;
+        }
+        m_Accesses = std::move(accesses);
+    }
+    for (const auto& [location, note] : m_Notes) {
+        Note(location, note);
+    }
+    return m_Packs;
+}
+
+void SuperwordVectorizer::ClearBlock(Block* block) {
+    for (const auto& item : block->Items) {
+        std::visit(overloaded{ [&](Statement* stmt) { ClearStatement(stmt); },
+                       [&](Declaration* decl) {
+                           decl->Packed = nullptr;
+                           m_DeclaredIn[decl] = block;
+                       } },
+            item->Item);
+    }
+}
+
+void SuperwordVectorizer::ClearStatement(Statement* stmt) {
+    std::visit(overloaded{ [&](IfStatement* ifStmt) {
+                              ClearStatement(ifStmt->Then);
+                              if (ifStmt->Else) {
+                                  ClearStatement(ifStmt->Else);
+                              }
+                          },
+                   [&](WhileStatement* whileStmt) { ClearStatement(whileStmt->Loop); },
+                   [&](Block* block) { ClearBlock(block); },
+                   [](ExpressionStatement* exprStmt) { exprStmt->Pack = nullptr; }, [](ReturnStatement*) {},
+                   [](PrecomputedStatement*) {} },
+        stmt->Stmt);
+}
+
+// Packs greedily from the front of each run of assignments, as many lanes as pay off.
+void SuperwordVectorizer::VectorizeBlock(Block* block) {
+    m_Written.clear();
+    for (size_t i = 0; i < block->Items.size();) {
+        const AssignmentExpression* assign = AssignmentOf(block->Items[i]);
+        if (!assign) {
+            if (auto* stmt = std::get_if<Ref<Statement>>(&block->Items[i]->Item)) {
+                VectorizeStatement(*stmt);
+                m_Written.clear();
+            }
+            i++;
+            continue;
+        }
+        size_t packed = 0;
+        for (const size_t lanes : { m_Options.Avx2 ? MaxLanes : 2, size_t{ 2 } }) {
+            if (!packed && i + lanes <= block->Items.size() && Pack(block, i, lanes)) {
+                packed = lanes;
+            }
+        }
+        if (!packed) {
+            m_Written.insert(assign->Decl);
+        }
+        i += std::max<size_t>(packed, 1);
+    }
+}
+
+void SuperwordVectorizer::VectorizeStatement(Statement* stmt) {
+    std::visit(overloaded{ [&](IfStatement* ifStmt) {
+                              VectorizeStatement(ifStmt->Then);
+                              if (ifStmt->Else) {
+                                  VectorizeStatement(ifStmt->Else);
+                              }
+                          },
+                   [&](WhileStatement* whileStmt) {
+                       const WhileStatement* outer = std::exchange(m_Loop, whileStmt);
+                       VectorizeStatement(whileStmt->Loop);
+                       m_Loop = outer;
+                   },
+                   [&](Block* block) { VectorizeBlock(block); }, [](ExpressionStatement*) {},
+                   [](ReturnStatement*) {}, [](PrecomputedStatement*) {} },
+        stmt->Stmt);
+}
+
+// Records the variables that the code of each loop reads or writes lane by lane and as whole vectors.
+void SuperwordVectorizer::AccessBlock(Block* block, LoopAccesses& accesses) {
+    for (size_t i = 0; i < block->Items.size(); i++) {
+        auto* stmt = std::get_if<Ref<Statement>>(&block->Items[i]->Item);
+        auto* exprStmt = stmt ? std::get_if<Ref<ExpressionStatement>>(&(*stmt)->Stmt) : nullptr;
+        if (exprStmt && (*exprStmt)->Pack && (*exprStmt)->Pack->Lanes[0] == exprStmt->Get()) {
+            AccessPack((*exprStmt)->Pack, accesses);
+            i += (*exprStmt)->Pack->Lanes.size() - 1;
+        } else if (stmt) {
+            AccessStatement(*stmt, accesses);
+        }
+    }
+}
+
+void SuperwordVectorizer::AccessStatement(Statement* stmt, LoopAccesses& accesses) {
+    const auto narrow = [&](Expression* expr) {
+        VisitExpression(expr, overloaded{ [&](Primary* primary) {
+                                             if (primary->Decl) {
+                                                 accesses.Narrow[m_Loop].insert(primary->Decl);
+                                             }
+                                         },
+                                  [&](AssignmentExpression* assign) {
+                                      if (assign->Decl) {
+                                          accesses.Narrow[m_Loop].insert(assign->Decl);
+                                      }
+                                  } });
+    };
+    std::visit(overloaded{ [&](IfStatement* ifStmt) {
+                              narrow(ifStmt->Cond);
+                              AccessStatement(ifStmt->Then, accesses);
+                              if (ifStmt->Else) {
+                                  AccessStatement(ifStmt->Else, accesses);
+                              }
+                          },
+                   [&](WhileStatement* whileStmt) {
+                       const WhileStatement* outer = std::exchange(m_Loop, whileStmt);
+                       narrow(whileStmt->Cond);
+                       AccessStatement(whileStmt->Loop, accesses);
+                       m_Loop = outer;
+                   },
+                   [&](Block* block) { AccessBlock(block, accesses); },
+                   [&](ExpressionStatement* exprStmt) { narrow(exprStmt->Expr); },
+                   [&](ReturnStatement* retStmt) {
+                       if (retStmt->Expr) {
+                           narrow(retStmt->Expr);
+                       }
+                   },
+                   [&](PrecomputedStatement* precomputed) {
+                       for (const PrecomputedStatement::Value& value : precomputed->Values) {
+                           accesses.Narrow[m_Loop].insert(value.Decl);
+                       }
+                   } },
+        stmt->Stmt);
+}
+
+void SuperwordVectorizer::AccessPack(const SuperwordPack* pack, LoopAccesses& accesses) {
+    std::vector<const AssignmentExpression*> assigns;
+    for (const Ref<ExpressionStatement>& lane : pack->Lanes) {
+        assigns.push_back(lane->Expr->Expr);
+    }
+    const auto access = [&](const std::vector<Slot>& slots) {
+        auto& decls = InOrder(slots) ? accesses.Whole[m_Loop] : accesses.Narrow[m_Loop];
+        for (const Slot& slot : slots) {
+            decls.insert(slot.first);
+        }
+    };
+    const std::optional<std::vector<Step>> steps = Steps(assigns, m_Options); // as Pack found them
+    for (const Step& step : *steps) {
+        if (!step.Op && !std::holds_alternative<int64_t>(step.Leaves[0]->Value)) {
+            access(SlotsOf(step, assigns.size()));
+        }
+    }
+    access(SlotsOf(assigns));
+}
+
+// Packs items [first, first + lanes) of the block if they can be and that costs less than the scalar
+// code, giving the scalars it loads and stores as vectors adjacent slots where it can.
+bool SuperwordVectorizer::Pack(Block* block, size_t first, size_t lanes) {
+    std::vector<const AssignmentExpression*> assigns;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        const AssignmentExpression* assign = AssignmentOf(block->Items[first + lane]);
+        if (!assign) {
+            return false;
+        }
+        assigns.push_back(assign);
+    }
+    const std::optional<std::vector<Step>> steps = Steps(assigns, m_Options);
+    if (!steps) {
+        return false;
+    }
+
+    std::vector<std::vector<const Declaration*>> claimed; // scalars this pack lays out side by side
+    const auto isClaimed = [&](const Declaration* decl) {
+        return std::any_of(claimed.begin(), claimed.end(), [&](const auto& tuple) {
+            return std::find(tuple.begin(), tuple.end(), decl) != tuple.end();
+        });
+    };
+    // scalars declared in the same block, which this pack may give adjacent slots unless another has
+    const auto claim = [&](const std::vector<Slot>& slots) {
+        // unused-vars leaves the stores to variables it removed, which have no slot of their own
+        const auto declaredIn = m_DeclaredIn.find(slots[0].first);
+        std::vector<const Declaration*> decls;
+        for (const auto& [decl, index] : slots) {
+            const auto block = m_DeclaredIn.find(decl);
+            if (index >= 0 || std::find(decls.begin(), decls.end(), decl) != decls.end() ||
+                block == m_DeclaredIn.end() || block->second != declaredIn->second) {
+                return false;
+            }
+            decls.push_back(decl);
+        }
+        if (std::find(claimed.begin(), claimed.end(), decls) != claimed.end()) {
+            return true;
+        } else if (std::any_of(decls.begin(), decls.end(), [&](const Declaration* decl) {
+                       return decl->Packed || isClaimed(decl);
+                   })) {
+            return false;
+        }
+        claimed.push_back(decls);
+        return true;
+    };
+    // Loading a vector from slots that were just stored lane by lane stalls store forwarding, as does
+    // loading a lane of a vector just stored; so does either in a loop where the other access comes
+    // around again.
+    const auto accessedIn = [&](const auto& loops, const std::vector<Slot>& slots) {
+        const auto loop = loops.find(m_Loop);
+        const auto accessed = [&](const Slot& slot) { return loop->second.contains(slot.first); };
+        return loop != loops.end() && loop->first && std::any_of(slots.begin(), slots.end(), accessed);
+    };
+    const int64_t laneByLane = lanes == 4 ? 5 : 2; // gathering or scattering, vmovq and vpinsrq
+    const auto access = [&](const std::vector<Slot>& slots, bool load) -> int64_t {
+        if (!InOrder(slots) && !claim(slots)) {
+            return laneByLane + (accessedIn(m_Accesses.Whole, slots) ? StoreForwardingStall : 0);
+        }
+        const bool written = load && std::any_of(slots.begin(), slots.end(), [&](const Slot& slot) {
+            return m_Written.contains(slot.first);
+        });
+        return 1 + (written || accessedIn(m_Accesses.Narrow, slots) ? StoreForwardingStall : 0);
+    };
+
+    // a scalar lane loads or combines each leaf with one instruction and stores the value, while a
+    // comparison adds setcc and movzx; the vector code of a comparison turns its mask into 0 or 1
+    int64_t loads = 0;
+    int64_t comparisons = 0;
+    int64_t vectorCost = access(SlotsOf(assigns), false);
+    if (lanes == 4) {
+        vectorCost++; // vzeroupper
+    }
+    for (const Step& step : *steps) {
+        if (step.Op) {
+            comparisons += IsComparison(*step.Op);
+            vectorCost += IsComparison(*step.Op) ? 3 : 1;
+            continue;
+        }
+        loads++;
+        const Primary* leaf = step.Leaves[0];
+        const bool same = std::all_of(step.Leaves.begin(), step.Leaves.begin() + lanes,
+            [&](const Primary* other) { return SameSlot(other, leaf); });
+        if (std::holds_alternative<int64_t>(leaf->Value)) {
+            vectorCost++; // from .rodata
+        } else if (same) {
+            vectorCost += m_Options.Avx2 ? 1 : 2; // vpbroadcastq, or movq and punpcklqdq
+            vectorCost += accessedIn(m_Accesses.Whole, SlotsOf(step, 1)) ? StoreForwardingStall : 0;
+        } else {
+            const std::vector<Slot> slots = SlotsOf(step, lanes);
+            vectorCost += access(slots, true) + (m_Loop && slots == SlotsOf(assigns) ? LoopCarried : 0);
+        }
+    }
+    const int64_t scalarCost = static_cast<int64_t>(lanes) * (loads + 2 * comparisons + 1);
+
+    const Statement* stmt = std::get<Ref<Statement>>(block->Items[first]->Item);
+    if (vectorCost >= scalarCost) {
+        if (m_Options.Verbose) {
+            const std::string costs = std::to_string(vectorCost) + " vector instructions against " +
+                                      std::to_string(scalarCost);
+            m_Notes.emplace_back(stmt->Location,
+                "superword: " + std::to_string(lanes) + " assignments not packed: " + costs);
+        }
+        return false;
+    }
+
+    for (const std::vector<const Declaration*>& tuple : claimed) {
+        PackedSlots* slots = m_Allocator.alloc<PackedSlots>(m_Allocator.allocList<Ref<Declaration>>(tuple));
+        for (const Declaration* decl : tuple) {
+            const_cast<Declaration*>(decl)->Packed = slots;
+        }
+    }
+    std::vector<Ref<ExpressionStatement>> statements;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        statements.push_back(std::get<Ref<ExpressionStatement>>(
+            std::get<Ref<Statement>>(block->Items[first + lane]->Item)->Stmt));
+    }
+    SuperwordPack* pack =
+        m_Allocator.alloc<SuperwordPack>(m_Allocator.allocList<Ref<ExpressionStatement>>(statements));
+    for (const Ref<ExpressionStatement>& exprStmt : statements) {
+        exprStmt->Pack = pack;
+    }
+    if (m_Options.Verbose) {
+        m_Notes.emplace_back(stmt->Location, "superword: packed " + std::to_string(lanes) + " assignments");
+    }
+    m_Packs++;
+    return true;
+}
+
+} // namespace Compiler
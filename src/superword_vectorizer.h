@@ -0,0 +1,74 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+#include "utils.h"
+#include <array>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Compiler {
+
+// Packs runs of consecutive assignments of the same shape into the lanes of one vector operation,
+// two with SSE2 and four with AVX2 (or two, when four do not pack):
+//     a0 = a0 + b0;          // a0 a1 and b0 b1 are given adjacent frame slots, so this is
+//     a1 = a1 + b1;          // movdqu, paddq and movdqu
+// The values are built with + - and, with AVX2, the comparisons, from variables, array elements at a
+// constant index and literals; no lane may read what an earlier one assigns. An operand is loaded as
+// one vector when its lanes are adjacent in memory: elements in order, or scalars declared in the same
+// block that no other pack lays out differently. The same variable in every lane is broadcast, and
+// anything else is gathered lane by lane, which the cost model weighs against the scalar code along
+// with scattering the results and mixing vector and scalar accesses to the same variables, either
+// right after each other or in the same loop, which stalls store forwarding.
+class SuperwordVectorizer {
+  public:
+    static constexpr size_t MaxLanes = 4;
+
+    // the code of a pack as a stack machine: loading the leaves of the lanes, or combining the two
+    // vectors on top
+    struct Step {
+        std::array<const Primary*, MaxLanes> Leaves{}; // of a load
+        std::optional<BinaryOp> Op;                   // of a combination
+    };
+
+    SuperwordVectorizer(Program* program, ArenaAllocator& allocator, const Options& options);
+    int Vectorize(); // returns the number of packs
+
+    // the steps that compute the values of the assignments as lanes, if they can be: later passes may
+    // have changed a pack, so the generator asks again
+    static std::optional<std::vector<Step>> Steps(const std::vector<const AssignmentExpression*>& lanes,
+                                                  const Options& options);
+
+  private:
+    // the variables that the code of each loop, or of no loop, accesses lane by lane and as whole vectors
+    struct LoopAccesses {
+        std::unordered_map<const WhileStatement*, std::unordered_set<const Declaration*>> Narrow;
+        std::unordered_map<const WhileStatement*, std::unordered_set<const Declaration*>> Whole;
+        bool operator==(const LoopAccesses&) const = default;
+    };
+
+    void ClearBlock(Block* block);
+    void ClearStatement(Statement* stmt);
+    void VectorizeBlock(Block* block);
+    void VectorizeStatement(Statement* stmt);
+    bool Pack(Block* block, size_t first, size_t lanes);
+    void AccessBlock(Block* block, LoopAccesses& accesses);
+    void AccessStatement(Statement* stmt, LoopAccesses& accesses);
+    void AccessPack(const SuperwordPack* pack, LoopAccesses& accesses);
+
+    Program* m_Program;
+    ArenaAllocator& m_Allocator;
+    const Options& m_Options;
+
+    std::unordered_map<const Declaration*, const Block*> m_DeclaredIn;
+    std::unordered_set<const Declaration*> m_Written; // by scalar code since the run of assignments began
+    const WhileStatement* m_Loop = nullptr;          // innermost around the code being packed
+    LoopAccesses m_Accesses;                         // by the packs of the round before
+    std::vector<std::pair<SourceLocation, std::string>> m_Notes; // of the last round
+    int m_Packs = 0;
+};
+
+} // namespace Compiler
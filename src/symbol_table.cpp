@@ -1,4 +1,5 @@
 #include "symbol_table.h"
+#include "ast.h"
 #include "utils.h"
 #include <iostream>
 
@@ -17,28 +18,35 @@ size_t ScopeStack::ExitScope() {
     return popCount;
 }
 
-void ScopeStack::Insert(const std::string& name, const TableEntry& entry) {
+void ScopeStack::Insert(std::string_view name, const TableEntry& entry) {
     if (m_Scopes.empty()) {
         Error("No active scope");
     } else if (!m_Scopes.back().emplace(name, entry).second) {
-        Error("Redefinition of identifier: " + name);
+        Error("Redefinition of identifier: " + std::string(name));
     }
 }
 
-const TableEntry& ScopeStack::Lookup(const std::string& name) const {
+const TableEntry& ScopeStack::Lookup(std::string_view name) const {
+    if (const TableEntry* entry = Find(name)) {
+        return *entry;
+    }
+    Error("Undeclared identifier: " + std::string(name));
+}
+
+const TableEntry* ScopeStack::Find(std::string_view name) const {
     for (auto it = m_Scopes.rbegin(); it != m_Scopes.rend(); ++it) {
         auto found = it->find(name);
         if (found != it->end()) {
-            return found->second;
+            return &found->second;
         }
     }
-    Error("Undeclared identifier: " + name);
+    return nullptr;
 }
 
 void ScopeStack::Print() const {
     for (const auto& scope : m_Scopes) {
         for (const auto& [key, value] : scope) {
-            std::cout << key << ":  type: " << value.Type << ", stackOffset: " << value.StackOffset << "\n";
+            std::cout << key << ":  type: " << value.Type << ", offset: " << value.Decl->Offset << "\n";
         }
     }
 }
@@ -2,29 +2,33 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 namespace Compiler {
 
+struct Declaration;
+
 enum IdentifierType { VARIABLE, FUNCTION };
 
 struct TableEntry {
     IdentifierType Type;
-    int64_t StackOffset = 0;
+    Declaration* Decl = nullptr;
 };
 
 class ScopeStack {
   public:
-    void Insert(const std::string& name, const TableEntry& entry);
-    const TableEntry& Lookup(const std::string& name) const;
+    void Insert(std::string_view name, const TableEntry& entry);
+    const TableEntry& Lookup(std::string_view name) const;
+    const TableEntry* Find(std::string_view name) const; // nullptr when undeclared
     void Print() const;
 
     void EnterScope();
     size_t ExitScope();
 
   private:
-    std::vector<std::unordered_map<std::string, TableEntry>> m_Scopes;
+    std::vector<std::unordered_map<std::string_view, TableEntry>> m_Scopes;
 };
 
 } // namespace Compiler
\ No newline at end of file
@@ -1,29 +1,126 @@
 #include "utils.h"
 #include "lexer.h"
+#include <algorithm>
 #include <format>
 #include <iostream>
 
 namespace Compiler {
     
 ArenaAllocator::ArenaAllocator(size_t chunkSize) : m_Size(chunkSize) {
-    m_Buffer = new std::byte[m_Size];
-    m_Offset = m_Buffer;
+    NewChunk();
 }
 
 ArenaAllocator::~ArenaAllocator() {
-    delete[] m_Buffer;
+    Reset();
+    for (const Pool& pool : m_Pools) {
+        for (const PoolRun& run : pool.Runs) {
+            pool.Region->Release(run.Slots);
+        }
+    }
+}
+
+void ArenaAllocator::NewChunk() {
+    m_Chunks.push_back(std::make_unique<std::byte[]>(m_Size));
+    m_Offset = m_Chunks.back().get();
+    m_End = m_Offset + m_Size;
+}
+
+void ArenaAllocator::Reset() {
+    for (auto it = m_Destructors.rbegin(); it != m_Destructors.rend(); ++it) {
+        it->Destroy(it->Object);
+    }
+    m_Destructors.clear();
+    m_Chunks.resize(1);
+    m_Offset = m_Chunks.front().get();
+    m_End = m_Offset + m_Size;
+
+    for (Pool& pool : m_Pools) {
+        for (PoolRun& run : pool.Runs) {
+            run.Used = 0;
+        }
+        pool.Current = 0;
+    }
+}
+
+uint32_t ArenaAllocator::Take(NodeRegion& region, uint32_t count) {
+    if (region.Id() >= m_Pools.size()) {
+        m_Pools.resize(region.Id() + 1);
+    }
+    Pool& pool = m_Pools[region.Id()];
+    pool.Region = &region;
+
+    // the runs kept over a Reset are refilled first
+    for (; pool.Current < pool.Runs.size(); pool.Current++) {
+        PoolRun& run = pool.Runs[pool.Current];
+        if (count <= run.Slots.Count - run.Used) {
+            run.Used += count;
+            return run.Slots.First + run.Used - count;
+        }
+    }
+
+    const size_t perChunk = std::max<size_t>(m_Size / region.NodeSize(), 1);
+    pool.Runs.push_back({ region.Acquire(std::max(count, static_cast<uint32_t>(perChunk))), count });
+    pool.Current = pool.Runs.size() - 1;
+    return pool.Runs.back().Slots.First;
+}
+
+std::pair<size_t, size_t> ArenaAllocator::PoolUsage() const {
+    size_t nodes = 0;
+    size_t bytes = 0;
+    for (const Pool& pool : m_Pools) {
+        ForEachUsed(pool, [&](uint32_t, uint32_t count) {
+            nodes += count;
+            bytes += count * pool.Region->NodeSize();
+        });
+    }
+    return { nodes, bytes };
+}
+
+static thread_local DiagnosticScope* s_Diagnostics = nullptr;
+
+DiagnosticScope::DiagnosticScope(std::string_view src, std::ostream& out, std::vector<Diagnostic>* collected)
+    : m_Lines(src), m_Out(out), m_Collected(collected), m_Previous(s_Diagnostics) {
+    s_Diagnostics = this;
+}
+
+DiagnosticScope::~DiagnosticScope() {
+    s_Diagnostics = m_Previous;
+}
+
+Diagnostic Locate(SourceLocation loc, Diagnostic::Severity level, const std::string& msg) {
+    Diagnostic diagnostic{ level, msg };
+    if (s_Diagnostics) {
+        const LineColumn position = s_Diagnostics->m_Lines.Find(loc.Offset);
+        diagnostic.Line = position.Line;
+        diagnostic.Column = position.Column;
+    }
+    return diagnostic;
+}
+
+static std::string FormatLocation(const Diagnostic& diagnostic, SourceLocation loc) {
+    if (diagnostic.Line == 0) {
+        return std::format("[Offset {}]", loc.Offset);
+    }
+    return std::format("[Ln {}, Col {}]", diagnostic.Line, diagnostic.Column);
 }
 
 [[noreturn]] void Error(SourceLocation loc, const std::string& msg) {
-    std::cerr << std::format("{} [Ln {}, Col {}]\n", msg, loc.Line, loc.Column);
-    std::cin.get();
-    std::exit(1);
+    Diagnostic diagnostic = Locate(loc, Diagnostic::Severity::Error, msg);
+    const std::string what = msg + " " + FormatLocation(diagnostic, loc);
+    throw CompileError(what, std::move(diagnostic));
 }
 
 [[noreturn]] void Error(const std::string& msg) {
-    std::cerr << msg << "\n";
-    std::cin.get();
-    std::exit(1);
+    throw CompileError(msg, Diagnostic{ Diagnostic::Severity::Error, msg });
+}
+
+void Note(SourceLocation loc, const std::string& msg) {
+    Diagnostic diagnostic = Locate(loc, Diagnostic::Severity::Note, msg);
+    std::ostream& out = s_Diagnostics ? s_Diagnostics->m_Out : std::cerr;
+    out << msg << " " << FormatLocation(diagnostic, loc) << "\n";
+    if (s_Diagnostics && s_Diagnostics->m_Collected) {
+        s_Diagnostics->m_Collected->push_back(std::move(diagnostic));
+    }
 }
 
 } // namespace Compiler
@@ -1,11 +1,24 @@
 #pragma once
 
 #include "lexer.h"
+#include "line_table.h"
+#include "node_pool.h"
 #include <cstddef>
+#include <memory>
 #include <new>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace Compiler {
 
+// Objects of trivially destructible types, which is every node of the syntax tree, live in the pool of
+// their type (node_pool.h) and are linked by 32-bit handles; the arena holds runs of each pool, filled
+// in allocation order. Other objects are bump-allocated in chunks and destroyed with the arena.
 class ArenaAllocator {
   public:
     explicit ArenaAllocator(size_t chunkSize);
@@ -16,20 +29,100 @@ class ArenaAllocator {
 
     template <typename T, typename... Args>
     T* alloc(Args&&... args) {
-        if (m_Offset + sizeof(T) > m_Buffer + m_Size) {
-            throw std::bad_alloc();
+        if constexpr (std::is_trivially_destructible_v<T>) {
+            return new (NodePool<T>::At(Take(NodePool<T>::Region(), 1))) T(std::forward<Args>(args)...);
+        } else {
+            std::byte* start = Align(m_Offset, alignof(T));
+            if (start + sizeof(T) > m_End) {
+                NewChunk();
+                start = m_Offset;
+            }
+            m_Offset = start + sizeof(T);
+            T* object = new (start) T(std::forward<Args>(args)...);
+            m_Destructors.push_back({ object, [](void* p) { static_cast<T*>(p)->~T(); } });
+            return object;
         }
+    }
+
+    // copies the elements side by side into the pool of T
+    template <typename T, typename Range>
+    NodeList<T> allocList(const Range& elements) {
+        static_assert(std::is_trivially_destructible_v<T>);
+        const auto size = static_cast<uint32_t>(std::size(elements));
+        if (size == 0) {
+            return {};
+        }
+        const uint32_t first = Take(NodePool<T>::Region(), size);
+        std::uninitialized_copy(std::begin(elements), std::end(elements), NodePool<T>::At(first));
+        return NodeList<T>(first, size);
+    }
 
-        std::byte* start = m_Offset;
-        m_Offset += sizeof(T);
-        return new (start) T(std::forward<Args>(args)...);
+    // Every T allocated since the last Reset, a span per run, in allocation order: for a tree the
+    // parser built that is the order of a left-to-right walk. Nodes that passes have detached from the
+    // tree since are still in there.
+    template <typename T>
+    std::vector<std::span<T>> Nodes() const {
+        std::vector<std::span<T>> spans;
+        const size_t id = NodePool<T>::Region().Id();
+        if (id < m_Pools.size()) {
+            ForEachUsed(m_Pools[id], [&](uint32_t first, uint32_t count) {
+                spans.emplace_back(NodePool<T>::At(first), count);
+            });
+        }
+        return spans;
     }
 
+    // nodes in all pools, and the bytes they take
+    std::pair<size_t, size_t> PoolUsage() const;
+
+    // destroys every object and rewinds to the start of the first chunk and of the runs, which are kept
+    // for reuse
+    void Reset();
+
   private:
+    struct PoolRun {
+        NodeRegion::Run Slots;
+        uint32_t Used = 0;
+    };
+    struct Pool {
+        NodeRegion* Region = nullptr;
+        std::vector<PoolRun> Runs;
+        size_t Current = 0; // the run being filled
+    };
+
+    // index of the first of count consecutive free slots in the pool
+    uint32_t Take(NodeRegion& region, uint32_t count);
+
+    template <typename Callback>
+    static void ForEachUsed(const Pool& pool, Callback&& callback) {
+        for (const PoolRun& run : pool.Runs) {
+            if (run.Used != 0) {
+                callback(run.Slots.First, run.Used);
+            }
+        }
+    }
+
+    static std::byte* Align(std::byte* p, size_t alignment) {
+        const auto address = reinterpret_cast<uintptr_t>(p);
+        return p + ((alignment - address % alignment) % alignment);
+    }
+
+    // large inputs outgrow the first chunk; nodes never move, so earlier chunks stay where they are
+    void NewChunk();
+
+    struct Destructor {
+        void* Object;
+        void (*Destroy)(void*);
+    };
+
     const size_t m_Size;
 
-    std::byte* m_Buffer;
+    std::vector<std::unique_ptr<std::byte[]>> m_Chunks;
+    std::vector<Destructor> m_Destructors;
     std::byte* m_Offset;
+    std::byte* m_End;
+
+    std::vector<Pool> m_Pools; // by NodeRegion::Id
 };
 
 template <typename... Ts>
@@ -40,7 +133,51 @@ struct overloaded : Ts... {
 template <typename... Ts>
 overloaded(Ts...) -> overloaded<Ts...>;
 
+// A note or error as CompileResult lists it; Line and Column are 1-based, and 0 without a location or
+// outside a DiagnosticScope.
+struct Diagnostic {
+    enum class Severity : uint8_t { Note, Error };
+    Severity Level = Severity::Error;
+    std::string Message; // without the location
+    uint32_t Line = 0;
+    uint32_t Column = 0;
+};
+
+// Thrown by Error(); what() is the complete diagnostic, location included.
+class CompileError : public std::runtime_error {
+  public:
+    CompileError(const std::string& what, Diagnostic diagnostic)
+        : std::runtime_error(what), m_Diagnostic(std::move(diagnostic)) {}
+
+    const Diagnostic& Details() const { return m_Diagnostic; }
+
+  private:
+    Diagnostic m_Diagnostic;
+};
+
+// Routes the diagnostics of the current thread: locations are resolved against `src`, notes are
+// written to `out` and, given `collected`, appended to it as well. Without a scope, notes go to
+// std::cerr and locations are printed as byte offsets.
+class DiagnosticScope {
+  public:
+    DiagnosticScope(std::string_view src, std::ostream& out, std::vector<Diagnostic>* collected = nullptr);
+    ~DiagnosticScope();
+
+    DiagnosticScope(const DiagnosticScope&) = delete;
+    DiagnosticScope& operator=(const DiagnosticScope&) = delete;
+
+  private:
+    friend Diagnostic Locate(SourceLocation loc, Diagnostic::Severity level, const std::string& msg);
+    friend void Note(SourceLocation loc, const std::string& msg);
+
+    LineTable m_Lines;
+    std::ostream& m_Out;
+    std::vector<Diagnostic>* m_Collected;
+    DiagnosticScope* m_Previous;
+};
+
 [[noreturn]] void Error(SourceLocation loc, const std::string& msg);
 [[noreturn]] void Error(const std::string& msg);
+void Note(SourceLocation loc, const std::string& msg);
 
 } // namespace Compiler
@@ -0,0 +1,564 @@
+#include "value_numbering.h"
+#include "ast_visitor.h"
+#include <algorithm>
+#include <tuple>
+
+namespace Compiler {
+
+static constexpr int ElementLoad = -1; // Key::Kind of a load, next to the BinaryOp values
+
+// the same key for `b + a` as for `a + b`, and for `b > a` as for `a < b`
+static std::tuple<int, uint32_t, uint32_t> Canonical(BinaryOp op, uint32_t left, uint32_t right) {
+    switch (op) {
+        case BinaryOp::Add:
+        case BinaryOp::Mul:
+        case BinaryOp::Eq:
+        case BinaryOp::Ne: return { static_cast<int>(op), std::min(left, right), std::max(left, right) };
+        case BinaryOp::Gt: return { static_cast<int>(BinaryOp::Lt), right, left };
+        case BinaryOp::Ge: return { static_cast<int>(BinaryOp::Le), right, left };
+        default: return { static_cast<int>(op), left, right };
+    }
+}
+
+GlobalValueNumbering::GlobalValueNumbering(Program* program, ArenaAllocator& allocator)
+    : m_Program(program), m_Allocator(allocator) {}
+
+int GlobalValueNumbering::EliminateRedundancies() {
+    m_NextNumber = 0;
+    m_Values.clear();
+    m_Sites.clear();
+    m_Current.clear();
+    m_Constants.clear();
+    m_ConstantValues.clear();
+    m_Holders.clear();
+    m_Visible.clear();
+    m_UndoLog.clear();
+    m_Marks.clear();
+    m_Defined.clear();
+    m_Used.clear();
+    m_Temporaries.clear();
+    m_Replaced = 0;
+    m_Assigned.clear();
+    m_Declared.clear();
+
+    std::vector<const Declaration*> assigned;
+    CollectAssigned(m_Program->GlobalBlock, assigned);
+    NumberBlock(m_Program->GlobalBlock);
+
+    // A replacement drops the computations inside it, first computations of other values included, so
+    // the first walk finds out which temporaries are both assigned and read in what is left.
+    VisitStatementExpressions(m_Program->GlobalBlock, [&](Expression* expr) { Rewrite(expr, false); });
+    std::vector<Ref<BlockItem>> items;
+    VisitStatementExpressions(m_Program->GlobalBlock, [&](Expression* expr) { Rewrite(expr, true); });
+    for (const auto& [number, temporary] : m_Temporaries) {
+        items.push_back(m_Allocator.alloc<BlockItem>(temporary));
+    }
+    if (!items.empty()) {
+        Block* global = m_Program->GlobalBlock;
+        items.insert(items.end(), global->Items.begin(), global->Items.end());
+        global->Items = m_Allocator.allocList<Ref<BlockItem>>(items);
+    }
+    return m_Replaced;
+}
+
+GlobalValueNumbering::ValueNumber GlobalValueNumbering::Constant(int64_t value) {
+    auto [it, added] = m_Constants.try_emplace(value, m_NextNumber);
+    if (added) {
+        m_ConstantValues.emplace(NewNumber(), value);
+    }
+    return it->second;
+}
+
+GlobalValueNumbering::ValueNumber GlobalValueNumbering::Current(const Declaration* decl) {
+    if (auto it = m_Current.find(decl); it != m_Current.end()) {
+        return it->second;
+    }
+    const ValueNumber number = NewNumber();
+    SetCurrent(decl, number);
+    return number;
+}
+
+void GlobalValueNumbering::SetCurrent(const Declaration* decl, ValueNumber number) {
+    auto it = m_Current.find(decl);
+    Undo undo{ Undo::Kind::Current, {}, number, decl, std::nullopt };
+    if (it != m_Current.end()) {
+        undo.Previous = it->second;
+        it->second = number;
+    } else {
+        m_Current.emplace(decl, number);
+    }
+    m_UndoLog.push_back(undo);
+}
+
+// the variable still has the value, and its name still refers to it
+bool GlobalValueNumbering::Holds(const Declaration* decl, ValueNumber number) const {
+    const auto current = m_Current.find(decl);
+    const auto visible = m_Visible.find(decl->Ident);
+    return current != m_Current.end() && current->second == number && visible != m_Visible.end() &&
+        !visible->second.empty() && visible->second.back() == decl;
+}
+
+void GlobalValueNumbering::Rollback(size_t start) {
+    while (m_UndoLog.size() > start) {
+        const Undo& undo = m_UndoLog.back();
+        switch (undo.What) {
+            case Undo::Kind::Value: m_Values.erase(undo.Computation); break;
+            case Undo::Kind::Site: m_Sites.erase(undo.Number); break;
+            case Undo::Kind::Current:
+                if (undo.Previous) {
+                    m_Current[undo.Decl] = *undo.Previous;
+                } else {
+                    m_Current.erase(undo.Decl);
+                }
+                break;
+        }
+        m_UndoLog.pop_back();
+    }
+}
+
+// Numbers expr in evaluation order: an array index first, then the operands left to right, then the
+// assignment. node and prefix locate a computation for its marks; start is the undo log position
+// before its first operand.
+template <typename Expr>
+GlobalValueNumbering::Value GlobalValueNumbering::Number(Expr* expr) {
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        AssignmentExpression* assign = expr->Expr;
+        if (!assign->Ident) {
+            return Number(assign->Expr.Get());
+        }
+        if (assign->Index) {
+            const Value index = Number(assign->Index.Get());
+            const Value value = Number(assign->Expr.Get());
+            // a new version of the array, where the element just stored is known unless the store is dead
+            const ValueNumber version = NewNumber();
+            SetCurrent(assign->Decl, version);
+            if (!assign->DeadStore) {
+                const Key load{ ElementLoad, version, index.Number };
+                m_Values.emplace(load, value.Number);
+                m_UndoLog.push_back({ Undo::Kind::Value, load, value.Number, nullptr, std::nullopt });
+            }
+            return { value.Number, true };
+        }
+        const Value value = Number(assign->Expr.Get());
+        if (assign->DeadStore) { // the generated code keeps the old value, the bytecode stores anyway
+            SetCurrent(assign->Decl, NewNumber());
+        } else {
+            SetCurrent(assign->Decl, value.Number);
+            m_Holders[value.Number].push_back(assign->Decl);
+        }
+        return { value.Number, true };
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        return Number(expr->Prim.Get());
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        if (const auto* i = std::get_if<int64_t>(&expr->Value)) {
+            return { Constant(*i), false };
+        } else if (auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            return Number<Expression>(*inner);
+        }
+        const size_t start = m_UndoLog.size();
+        if (!expr->Index) {
+            const ValueNumber number = Current(expr->Decl);
+            if (const auto constant = m_ConstantValues.find(number); constant != m_ConstantValues.end()) {
+                Use({ Mark::Action::UseConstant, 0, number, constant->second }, expr, start);
+            }
+            return { number, false };
+        }
+        const Value index = Number<Expression>(expr->Index);
+        return Compute({ ElementLoad, Current(expr->Decl), index.Number }, index.Assigns, expr, 0, start);
+    } else {
+        const size_t start = m_UndoLog.size();
+        Value value = Number(expr->Left.Get());
+        for (size_t i = 0; i < expr->Right.size(); ++i) {
+            const auto& [op, right] = expr->Right[i];
+            const Value rhs = Number(right.Get());
+            value = Combine(op, value, rhs, expr, i + 1, start);
+        }
+        return value;
+    }
+}
+
+GlobalValueNumbering::Value GlobalValueNumbering::Combine(
+    BinaryOp op, Value left, Value right, void* node, size_t prefix, size_t start) {
+    const bool assigns = left.Assigns || right.Assigns;
+    const auto l = m_ConstantValues.find(left.Number);
+    const auto r = m_ConstantValues.find(right.Number);
+    if (l != m_ConstantValues.end() && r != m_ConstantValues.end()) {
+        if (const auto folded = EvaluateBinaryOp(op, l->second, r->second)) {
+            const ValueNumber number = Constant(*folded);
+            if (!assigns) {
+                Use({ Mark::Action::UseConstant, prefix, number, *folded }, node, start);
+            }
+            return { number, assigns };
+        }
+    }
+    const auto [kind, a, b] = Canonical(op, left.Number, right.Number);
+    return Compute({ kind, a, b }, assigns, node, prefix, start);
+}
+
+GlobalValueNumbering::Value GlobalValueNumbering::Compute(
+    const Key& key, bool assigns, void* node, size_t prefix, size_t start) {
+    ValueNumber number;
+    if (auto it = m_Values.find(key); it != m_Values.end()) {
+        number = it->second;
+        if (!assigns && Reuse(number, node, prefix, start)) {
+            return { number, false };
+        }
+    } else {
+        number = NewNumber();
+        m_Values.emplace(key, number);
+        m_UndoLog.push_back({ Undo::Kind::Value, key, number, nullptr, std::nullopt });
+    }
+    if (!m_Sites.contains(number)) {
+        m_Sites.emplace(number, Site{ node, prefix });
+        m_UndoLog.push_back({ Undo::Kind::Site, {}, number, nullptr, std::nullopt });
+    }
+    return { number, assigns };
+}
+
+// Replaces the computation of an available value, if anything still has it.
+bool GlobalValueNumbering::Reuse(ValueNumber number, void* node, size_t prefix, size_t start) {
+    if (const auto constant = m_ConstantValues.find(number); constant != m_ConstantValues.end()) {
+        Use({ Mark::Action::UseConstant, prefix, number, constant->second }, node, start);
+        return true;
+    }
+    if (const auto holders = m_Holders.find(number); holders != m_Holders.end()) {
+        for (auto it = holders->second.rbegin(); it != holders->second.rend(); ++it) {
+            if (Holds(*it, number)) {
+                Use({ Mark::Action::UseVariable, prefix, number, 0, *it }, node, start);
+                return true;
+            }
+        }
+    }
+    const auto site = m_Sites.find(number);
+    if (site == m_Sites.end()) {
+        return false;
+    }
+    std::vector<Mark>& marks = m_Marks[site->second.Node];
+    if (std::none_of(marks.begin(), marks.end(), [&](const Mark& mark) {
+            return mark.What == Mark::Action::Define && mark.Prefix == site->second.Prefix;
+        })) {
+        marks.push_back({ Mark::Action::Define, site->second.Prefix, number });
+    }
+    Use({ Mark::Action::UseTemporary, prefix, number }, node, start);
+    return true;
+}
+
+// A longer prefix replaces the shorter one, and what was computed inside is gone with it.
+void GlobalValueNumbering::Use(Mark mark, void* node, size_t start) {
+    std::vector<Mark>& marks = m_Marks[node];
+    std::erase_if(marks, [](const Mark& m) { return m.What != Mark::Action::Define; });
+    marks.push_back(mark);
+    Rollback(start);
+}
+
+void GlobalValueNumbering::CollectAssigned(Expression* expr, std::vector<const Declaration*>& assigned) {
+    // the variables unused-vars removed are in no block: nothing reads them or finds them visible, so
+    // their numbers do not matter, and leaving them out keeps them from piling up in every block around
+    VisitExpression(expr, overloaded{ [&](AssignmentExpression* assign) {
+                                         if (m_Declared.contains(assign->Decl)) {
+                                             assigned.push_back(assign->Decl);
+                                         }
+                                     },
+                              [](Primary*) {} });
+}
+
+// Adds what stmt assigns to `assigned`, and records it for each if and while in one walk, so that nested
+// statements are not walked again for every level around them.
+void GlobalValueNumbering::CollectAssigned(Statement* stmt, std::vector<const Declaration*>& assigned) {
+    auto record = [&](std::vector<const Declaration*> inner) {
+        std::sort(inner.begin(), inner.end());
+        inner.erase(std::unique(inner.begin(), inner.end()), inner.end());
+        assigned.insert(assigned.end(), inner.begin(), inner.end());
+        m_Assigned[stmt] = std::move(inner);
+    };
+    std::visit(overloaded{ [&](ExpressionStatement* exprStmt) { CollectAssigned(exprStmt->Expr, assigned); },
+                   [&](ReturnStatement* retStmt) {
+                       if (retStmt->Expr) {
+                           CollectAssigned(retStmt->Expr, assigned);
+                       }
+                   },
+                   [&](IfStatement* ifStmt) {
+                       CollectAssigned(ifStmt->Cond, assigned);
+                       std::vector<const Declaration*> inner;
+                       CollectAssigned(ifStmt->Then, inner);
+                       if (ifStmt->Else) {
+                           CollectAssigned(ifStmt->Else, inner);
+                       }
+                       record(std::move(inner));
+                   },
+                   [&](WhileStatement* whileStmt) {
+                       std::vector<const Declaration*> inner;
+                       CollectAssigned(whileStmt->Cond, inner);
+                       CollectAssigned(whileStmt->Loop, inner);
+                       record(std::move(inner));
+                   },
+                   [&](Block* block) { CollectAssigned(block, assigned); }, [](PrecomputedStatement*) {} },
+        stmt->Stmt);
+}
+
+void GlobalValueNumbering::CollectAssigned(Block* block, std::vector<const Declaration*>& assigned) {
+    const size_t start = assigned.size();
+    std::unordered_set<const Declaration*> declared;
+    for (const BlockItem* item : block->Items) {
+        std::visit(overloaded{ [&](Statement* stmt) { CollectAssigned(stmt, assigned); },
+                       [&](Declaration* decl) {
+                           declared.insert(decl);
+                           m_Declared.insert(decl);
+                       } },
+            item->Item);
+    }
+    // the variables of the block get fresh numbers when it ends anyway
+    const auto first = assigned.begin() + static_cast<ptrdiff_t>(start);
+    std::sort(first, assigned.end());
+    assigned.erase(std::unique(first, assigned.end()), assigned.end());
+    assigned.erase(
+        std::remove_if(first, assigned.end(), [&](const Declaration* decl) { return declared.contains(decl); }),
+        assigned.end());
+}
+
+void GlobalValueNumbering::Kill(const Statement* stmt) {
+    for (const Declaration* decl : m_Assigned.at(stmt)) {
+        SetCurrent(decl, NewNumber());
+    }
+}
+
+void GlobalValueNumbering::NumberStatement(Statement* stmt) {
+    std::visit(overloaded{ [&](ExpressionStatement* exprStmt) { Number(exprStmt->Expr.Get()); },
+                   [&](ReturnStatement* retStmt) {
+                       if (retStmt->Expr) {
+                           Number(retStmt->Expr.Get());
+                       }
+                   },
+                   [&](IfStatement* ifStmt) {
+                       Number(ifStmt->Cond.Get());
+                       const size_t start = m_UndoLog.size();
+                       NumberStatement(ifStmt->Then);
+                       Rollback(start);
+                       if (ifStmt->Else) {
+                           NumberStatement(ifStmt->Else);
+                           Rollback(start);
+                       }
+                       Kill(stmt);
+                   },
+                   [&](WhileStatement* whileStmt) {
+                       // every iteration starts from whatever the previous one left
+                       Kill(stmt);
+                       if (whileStmt->Vector) {
+                           return; // the vector code reads the loop as it is
+                       }
+                       Number(whileStmt->Cond.Get());
+                       const size_t start = m_UndoLog.size();
+                       NumberStatement(whileStmt->Loop);
+                       Rollback(start); // leaves what the last test of the condition computed
+                   },
+                   [&](Block* block) { NumberBlock(block); },
+                   [&](PrecomputedStatement* precomputed) {
+                       for (const PrecomputedStatement::Value& value : precomputed->Values) {
+                           SetCurrent(value.Decl, value.Decl->Size == 0 ? Constant(value.Elements[0]) : NewNumber());
+                       }
+                   } },
+        stmt->Stmt);
+}
+
+void GlobalValueNumbering::NumberBlock(Block* block) {
+    std::vector<const Declaration*> declared;
+    for (const BlockItem* item : block->Items) {
+        std::visit(overloaded{ [&](Statement* stmt) { NumberStatement(stmt); },
+                       [&](Declaration* decl) {
+                           SetCurrent(decl, NewNumber());
+                           m_Visible[decl->Ident].push_back(decl);
+                           declared.push_back(decl);
+                       } },
+            item->Item);
+    }
+    // the slots go to the variables of sibling blocks
+    for (const Declaration* decl : declared) {
+        m_Visible[decl->Ident].pop_back();
+        SetCurrent(decl, NewNumber());
+    }
+}
+
+bool GlobalValueNumbering::Applies(const Mark& mark) const {
+    if (mark.What == Mark::Action::Define || mark.What == Mark::Action::UseTemporary) {
+        return m_Defined.contains(mark.Number) && m_Used.contains(mark.Number);
+    }
+    return true;
+}
+
+// With apply false, only collects which temporaries survive the replacements (see EliminateRedundancies).
+template <typename Expr>
+void GlobalValueNumbering::Rewrite(Expr* expr, bool apply) {
+    if constexpr (std::is_same_v<Expr, Expression>) {
+        if (expr->Expr->Index) {
+            Rewrite(expr->Expr->Index.Get(), apply);
+        }
+        RewriteChain(expr->Expr->Expr.Get(), apply);
+    } else if constexpr (std::is_same_v<Expr, PostfixExpression>) {
+        Rewrite(expr->Prim.Get(), apply);
+    } else if constexpr (std::is_same_v<Expr, Primary>) {
+        if (auto* inner = std::get_if<Ref<Expression>>(&expr->Value)) {
+            Rewrite<Expression>(*inner, apply);
+            return;
+        }
+        const auto marks = m_Marks.find(expr);
+        const Mark* use = nullptr;
+        const Mark* define = nullptr;
+        if (marks != m_Marks.end()) {
+            for (const Mark& mark : marks->second) {
+                if (apply && !Applies(mark)) {
+                    continue;
+                }
+                (mark.What == Mark::Action::Define ? define : use) = &mark;
+            }
+        }
+
+        if (use) {
+            if (!apply) {
+                if (use->What == Mark::Action::UseTemporary) {
+                    m_Used.insert(use->Number);
+                }
+                return;
+            }
+            const Primary* replacement = Replacement(*use);
+            expr->Value = replacement->Value;
+            expr->Decl = replacement->Decl;
+            expr->Index = nullptr;
+            m_Replaced++;
+            return;
+        }
+        if (expr->Index) {
+            Rewrite<Expression>(expr->Index, apply);
+        }
+        if (define && !apply) {
+            m_Defined.insert(define->Number);
+        } else if (define) {
+            // the load moves into `(t = a[i])`
+            Primary* load = m_Allocator.alloc<Primary>(*expr);
+            auto* loaded = m_Allocator.alloc<MultiplicativeExpression>(Operand<MultiplicativeExpression>(load));
+            expr->Value = Assign(define->Number, Lift(loaded));
+            expr->Decl = nullptr;
+            expr->Index = nullptr;
+        }
+    } else {
+        RewriteChain(expr, apply);
+    }
+}
+
+template <typename Chain>
+void GlobalValueNumbering::RewriteChain(Chain* chain, bool apply) {
+    std::vector<Mark> marks;
+    if (const auto it = m_Marks.find(chain); it != m_Marks.end()) {
+        std::copy_if(it->second.begin(), it->second.end(), std::back_inserter(marks),
+            [&](const Mark& mark) { return !apply || Applies(mark); });
+    }
+    const auto use = std::find_if(marks.begin(), marks.end(), [](const Mark& m) { return m.What != Mark::Action::Define; });
+    const size_t replaced = use != marks.end() ? use->Prefix : 0; // operators of the prefix that goes
+
+    // the operands past the replaced prefix, with whatever they have to rewrite themselves
+    if (replaced == 0) {
+        Rewrite(chain->Left.Get(), apply);
+    }
+    for (size_t i = replaced; i < chain->Right.size(); ++i) {
+        Rewrite(chain->Right[i].second.Get(), apply);
+    }
+
+    std::vector<Mark> defines;
+    std::copy_if(marks.begin(), marks.end(), std::back_inserter(defines),
+        [&](const Mark& mark) { return mark.What == Mark::Action::Define && mark.Prefix > replaced; });
+    std::sort(defines.begin(), defines.end(), [](const Mark& a, const Mark& b) { return a.Prefix < b.Prefix; });
+    if (!apply) {
+        if (use != marks.end() && use->What == Mark::Action::UseTemporary) {
+            m_Used.insert(use->Number);
+        }
+        for (const Mark& define : defines) {
+            m_Defined.insert(define.Number);
+        }
+        return;
+    }
+    if (use == marks.end() && defines.empty()) {
+        return;
+    }
+
+    // rebuild `l op1 r1 op2 r2 ...` as `(t = l op1 r1) op2 r2 ...` for a value defined at prefix 1, and
+    // start it from the replacement of the prefix that goes
+    using Operands = decltype(chain->Right);
+    Chain* rebuilt =
+        m_Allocator.alloc<Chain>(use != marks.end() ? Operand<Chain>(Replacement(*use)) : chain->Left.Get());
+    if (use != marks.end()) {
+        m_Replaced++;
+    }
+    std::vector<typename Operands::value_type> right;
+    size_t next = replaced;
+    for (const Mark& define : defines) {
+        right.insert(right.end(), chain->Right.begin() + next, chain->Right.begin() + define.Prefix);
+        next = define.Prefix;
+        rebuilt->Right = m_Allocator.allocList<typename Operands::value_type>(right);
+        right.clear();
+        Primary* assigned = m_Allocator.alloc<Primary>(Assign(define.Number, Lift(rebuilt)));
+        rebuilt = m_Allocator.alloc<Chain>(Operand<Chain>(assigned));
+    }
+    right.insert(right.end(), chain->Right.begin() + next, chain->Right.end());
+    chain->Left = rebuilt->Left;
+    chain->Right = m_Allocator.allocList<typename Operands::value_type>(right);
+}
+
+Primary* GlobalValueNumbering::Replacement(const Mark& mark) {
+    if (mark.What == Mark::Action::UseConstant) {
+        return m_Allocator.alloc<Primary>(mark.Constant);
+    }
+    Declaration* decl = mark.What == Mark::Action::UseVariable ? mark.Variable : Temporary(mark.Number);
+    Primary* primary = m_Allocator.alloc<Primary>(decl->Ident, decl->Location);
+    primary->Decl = decl;
+    return primary;
+}
+
+// `t = value`, stored for the later uses but not printed
+Expression* GlobalValueNumbering::Assign(ValueNumber number, EqualityExpression* value) {
+    Declaration* temporary = Temporary(number);
+    auto* assign = m_Allocator.alloc<AssignmentExpression>(temporary->Ident, temporary->Location, value);
+    assign->Decl = temporary;
+    assign->Silent = true;
+    return m_Allocator.alloc<Expression>(assign);
+}
+
+// Temporaries are declared in the global block once the rewrite is done, so they are in scope wherever
+// their value is available. Their names cannot be written in a source file.
+Declaration* GlobalValueNumbering::Temporary(ValueNumber number) {
+    auto [it, added] = m_Temporaries.try_emplace(number, nullptr);
+    if (added) {
+        const std::string name = "gvn." + std::to_string(m_Temporaries.size() - 1);
+        const Name ident{ m_Allocator.allocList<char>(name) };
+        it->second = m_Allocator.alloc<Declaration>(ident, SourceLocation{});
+    }
+    return it->second;
+}
+
+// primary as the leftmost operand of a Chain
+template <typename Chain>
+auto GlobalValueNumbering::Operand(Primary* primary) {
+    if constexpr (std::is_same_v<Chain, MultiplicativeExpression>) {
+        return m_Allocator.alloc<PostfixExpression>(primary);
+    } else if constexpr (std::is_same_v<Chain, AdditiveExpression>) {
+        return m_Allocator.alloc<MultiplicativeExpression>(Operand<MultiplicativeExpression>(primary));
+    } else if constexpr (std::is_same_v<Chain, RelationalExpression>) {
+        return m_Allocator.alloc<AdditiveExpression>(Operand<AdditiveExpression>(primary));
+    } else {
+        return m_Allocator.alloc<RelationalExpression>(Operand<RelationalExpression>(primary));
+    }
+}
+
+// chain as a whole right-hand side
+template <typename Chain>
+EqualityExpression* GlobalValueNumbering::Lift(Chain* chain) {
+    if constexpr (std::is_same_v<Chain, MultiplicativeExpression>) {
+        return Lift(m_Allocator.alloc<AdditiveExpression>(chain));
+    } else if constexpr (std::is_same_v<Chain, AdditiveExpression>) {
+        return Lift(m_Allocator.alloc<RelationalExpression>(chain));
+    } else if constexpr (std::is_same_v<Chain, RelationalExpression>) {
+        return m_Allocator.alloc<EqualityExpression>(chain);
+    } else {
+        return chain;
+    }
+}
+
+} // namespace Compiler
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "ast.h"
+#include "utils.h"
+#include <map>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Compiler {
+
+// Global value numbering over the structured tree. Statements are numbered in dominance order: what
+// precedes a statement in its block, the condition of an if or while and everything dominating them.
+// Each computed value, the prefixes `a op b op c ...` of an operator chain and array element loads,
+// gets a number from its operator and the numbers of its operands. Variables stand for the number of
+// the value last assigned to them, so an assignment invalidates whatever was computed from the old
+// value, and a store to an array invalidates loads from it (but forwards the stored value to a load
+// from the same index). A computation whose number is already available, and that assigns nothing
+// itself, is replaced by
+//  - a literal, when its operands are known constants
+//  - a variable still in scope that holds the value, or
+//  - a compiler temporary, which the first computation then assigns without printing it
+// Values computed in a branch or a loop body are forgotten after it, and variables assigned anywhere
+// in a loop get fresh numbers at its head. Loops marked by LoopVectorizer are left alone.
+class GlobalValueNumbering {
+  public:
+    GlobalValueNumbering(Program* program, ArenaAllocator& allocator);
+    int EliminateRedundancies(); // returns the number of computations replaced
+
+  private:
+    using ValueNumber = uint32_t;
+
+    struct Value {
+        ValueNumber Number;
+        bool Assigns; // the computation has an assignment in it, so it must stay
+    };
+
+    // an operator with its operands, or an element load from a version of an array and an index
+    struct Key {
+        int Kind;
+        ValueNumber Left;
+        ValueNumber Right;
+        bool operator==(const Key&) const = default;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return (static_cast<size_t>(key.Kind) * 0x9E3779B97F4A7C15ull) ^ (size_t{ key.Left } << 32) ^ key.Right;
+        }
+    };
+
+    // what to do with a prefix of an operator chain (Prefix operators long), or with an element load (0)
+    struct Mark {
+        enum class Action { Define, UseConstant, UseVariable, UseTemporary };
+        Action What;
+        size_t Prefix;
+        ValueNumber Number;
+        int64_t Constant = 0;
+        Declaration* Variable = nullptr;
+    };
+
+    // the first computation of a value; it assigns the temporary when the value is reused through one
+    struct Site {
+        void* Node;
+        size_t Prefix;
+    };
+
+    struct Undo {
+        enum class Kind { Value, Site, Current };
+        Kind What;
+        Key Computation;
+        ValueNumber Number;
+        const Declaration* Decl;
+        std::optional<ValueNumber> Previous;
+    };
+
+    template <typename Expr>
+    Value Number(Expr* expr);
+    Value Combine(BinaryOp op, Value left, Value right, void* node, size_t prefix, size_t start);
+    Value Compute(const Key& key, bool assigns, void* node, size_t prefix, size_t start);
+    bool Reuse(ValueNumber number, void* node, size_t prefix, size_t start);
+    void Use(Mark mark, void* node, size_t start);
+    void NumberStatement(Statement* stmt);
+    void NumberBlock(Block* block);
+    void CollectAssigned(Expression* expr, std::vector<const Declaration*>& assigned);
+    void CollectAssigned(Statement* stmt, std::vector<const Declaration*>& assigned);
+    void CollectAssigned(Block* block, std::vector<const Declaration*>& assigned);
+    void Kill(const Statement* stmt); // what the branches of an if, or a loop, assign gets fresh numbers
+
+    ValueNumber NewNumber() { return m_NextNumber++; }
+    ValueNumber Constant(int64_t value);
+    ValueNumber Current(const Declaration* decl);
+    void SetCurrent(const Declaration* decl, ValueNumber number);
+    bool Holds(const Declaration* decl, ValueNumber number) const;
+    void Rollback(size_t start);
+
+    template <typename Expr>
+    void Rewrite(Expr* expr, bool apply);
+    template <typename Chain>
+    void RewriteChain(Chain* chain, bool apply);
+    bool Applies(const Mark& mark) const;
+    Primary* Replacement(const Mark& mark);
+    Expression* Assign(ValueNumber number, EqualityExpression* value);
+    Declaration* Temporary(ValueNumber number);
+
+    template <typename Chain>
+    auto Operand(Primary* primary);
+    template <typename Chain>
+    EqualityExpression* Lift(Chain* chain);
+
+    Program* m_Program;
+    ArenaAllocator& m_Allocator;
+
+    ValueNumber m_NextNumber = 0;
+    std::unordered_map<Key, ValueNumber, KeyHash> m_Values;
+    std::unordered_map<ValueNumber, Site> m_Sites;
+    std::unordered_map<const Declaration*, ValueNumber> m_Current; // scalars: value, arrays: version
+    std::unordered_map<int64_t, ValueNumber> m_Constants;
+    std::unordered_map<ValueNumber, int64_t> m_ConstantValues;
+    std::unordered_map<ValueNumber, std::vector<Declaration*>> m_Holders;
+    std::unordered_map<std::string_view, std::vector<const Declaration*>> m_Visible; // innermost last
+    std::vector<Undo> m_UndoLog;
+    // what the branches of each if and the condition and body of each while assign, declared outside them
+    std::unordered_map<const Statement*, std::vector<const Declaration*>> m_Assigned;
+    std::unordered_set<const Declaration*> m_Declared; // by the blocks CollectAssigned has entered
+
+    std::unordered_map<const void*, std::vector<Mark>> m_Marks;
+    std::unordered_set<ValueNumber> m_Defined; // temporaries whose first computation survives
+    std::unordered_set<ValueNumber> m_Used;    // and the ones actually read
+    std::map<ValueNumber, Declaration*> m_Temporaries; // ordered, for a deterministic frame layout
+    int m_Replaced = 0;
+};
+
+} // namespace Compiler
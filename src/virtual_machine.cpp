@@ -0,0 +1,212 @@
+#include "virtual_machine.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <unistd.h>
+
+namespace Compiler {
+
+VirtualMachine::VirtualMachine(const Bytecode& code) : m_Code(code), m_Buffer(BufferSize) {}
+
+int64_t VirtualMachine::Run() {
+    // Deserialize checks this, but not code built in memory
+    if (m_Code.RegisterCount() > Bytecode::MaxRegisters) {
+        Error(std::format("The program needs {} registers, more than the {} of the VM", m_Code.RegisterCount(),
+            Bytecode::MaxRegisters));
+    }
+    m_Registers.assign(m_Code.RegisterCount(), 0);
+    std::copy(m_Code.Constants.begin(), m_Code.Constants.end(), m_Registers.begin() + m_Code.ConstantBase);
+    m_Length = 0;
+
+    int64_t* const r = m_Registers.data();
+    const BytecodeArray* const arrays = m_Code.Arrays.data();
+    const Instruction* const code = m_Code.Code.data();
+    const Instruction* ip = code;
+
+    // wrap-around arithmetic, as in the generated code
+    auto wrap = [](uint64_t value) { return static_cast<int64_t>(value); };
+    auto u = [](int64_t value) { return static_cast<uint64_t>(value); };
+
+#if defined(__GNUC__)
+    static const void* const Handlers[] = { &&Move, &&Add, &&Sub, &&Mul, &&Div, &&Mod, &&Lt, &&Le, &&Gt, &&Ge, &&Eq,
+        &&Ne, &&LoadElement, &&StoreElement, &&StoreConstants, &&Print, &&PrintText, &&Exit, &&Jump, &&JumpIfZero,
+        &&JumpIfNotZero, &&JumpIfLt, &&JumpIfLe, &&JumpIfGt, &&JumpIfGe, &&JumpIfEq, &&JumpIfNe,
+        &&IncrementJumpIfNotZero, &&DecrementJumpIfNotZero };
+    static_assert(std::size(Handlers) == static_cast<size_t>(Opcode::Count));
+#define VM_DISPATCH() goto* Handlers[static_cast<size_t>(ip->Op)]
+#define VM_CASE(op) op:
+    VM_DISPATCH();
+#else
+#define VM_DISPATCH() continue
+#define VM_CASE(op) case Opcode::op:
+    while (true) {
+        switch (ip->Op) {
+#endif
+
+#define VM_NEXT() \
+    ++ip;         \
+    VM_DISPATCH()
+#define VM_BINARY(op, expr)       \
+    VM_CASE(op) {                 \
+        const int64_t b = r[ip->B]; \
+        const int64_t c = r[ip->C]; \
+        r[ip->A] = (expr);        \
+        VM_NEXT();                \
+    }
+#define VM_BRANCH(op, cond)                                    \
+    VM_CASE(op) {                                              \
+        ip = (cond) ? code + ip->C : ip + 1;                   \
+        VM_DISPATCH();                                         \
+    }
+
+    VM_CASE(Move) {
+        r[ip->A] = r[ip->B];
+        VM_NEXT();
+    }
+    VM_BINARY(Add, wrap(u(b) + u(c)))
+    VM_BINARY(Sub, wrap(u(b) - u(c)))
+    VM_BINARY(Mul, wrap(u(b) * u(c)))
+    VM_CASE(Div) {
+        const int64_t b = r[ip->B];
+        const int64_t c = r[ip->C];
+        if (c == 0 || (b == INT64_MIN && c == -1)) {
+            Fault(SIGFPE);
+        }
+        r[ip->A] = b / c;
+        VM_NEXT();
+    }
+    VM_CASE(Mod) {
+        const int64_t b = r[ip->B];
+        const int64_t c = r[ip->C];
+        if (c == 0 || (b == INT64_MIN && c == -1)) {
+            Fault(SIGFPE);
+        }
+        r[ip->A] = b % c;
+        VM_NEXT();
+    }
+    VM_BINARY(Lt, b < c)
+    VM_BINARY(Le, b <= c)
+    VM_BINARY(Gt, b > c)
+    VM_BINARY(Ge, b >= c)
+    VM_BINARY(Eq, b == c)
+    VM_BINARY(Ne, b != c)
+    VM_CASE(LoadElement) {
+        r[ip->A] = r[Element(arrays[ip->B], r[ip->C])];
+        VM_NEXT();
+    }
+    VM_CASE(StoreElement) {
+        r[Element(arrays[ip->A], r[ip->B])] = r[ip->C];
+        VM_NEXT();
+    }
+    VM_CASE(StoreConstants) {
+        const BytecodeArray& array = arrays[ip->A];
+        for (uint32_t index = 0; index < array.Size; ++index) {
+            r[array.Base - index] = r[ip->B + index];
+        }
+        VM_NEXT();
+    }
+    VM_CASE(Print) {
+        PrintNumber(r[ip->A]);
+        VM_NEXT();
+    }
+    VM_CASE(PrintText) {
+        PrintText(m_Code.Strings[ip->A]);
+        VM_NEXT();
+    }
+    VM_CASE(Exit) {
+        Flush();
+        return r[ip->A];
+    }
+    VM_CASE(Jump) {
+        ip = code + ip->C;
+        VM_DISPATCH();
+    }
+    VM_BRANCH(JumpIfZero, r[ip->A] == 0)
+    VM_BRANCH(JumpIfNotZero, r[ip->A] != 0)
+    VM_BRANCH(JumpIfLt, r[ip->A] < r[ip->B])
+    VM_BRANCH(JumpIfLe, r[ip->A] <= r[ip->B])
+    VM_BRANCH(JumpIfGt, r[ip->A] > r[ip->B])
+    VM_BRANCH(JumpIfGe, r[ip->A] >= r[ip->B])
+    VM_BRANCH(JumpIfEq, r[ip->A] == r[ip->B])
+    VM_BRANCH(JumpIfNe, r[ip->A] != r[ip->B])
+    VM_BRANCH(IncrementJumpIfNotZero, (r[ip->A] = wrap(u(r[ip->A]) + u(r[ip->B]))) != 0)
+    VM_BRANCH(DecrementJumpIfNotZero, (r[ip->A] = wrap(u(r[ip->A]) - u(r[ip->B]))) != 0)
+
+#if !defined(__GNUC__)
+            case Opcode::Count: break;
+        }
+    }
+#endif
+#undef VM_BRANCH
+#undef VM_BINARY
+#undef VM_NEXT
+#undef VM_CASE
+#undef VM_DISPATCH
+    return 0;
+}
+
+// Like the generated code, an index out of bounds reaches whatever else is in the frame there; only
+// beyond the frame, where the native program would hit return addresses and saved registers, it faults.
+size_t VirtualMachine::Element(const BytecodeArray& array, int64_t index) {
+    const uint64_t slot = array.Base - static_cast<uint64_t>(index);
+    if (slot - 1 >= m_Code.FrameSlots - 1) {
+        Fault(SIGSEGV);
+    }
+    return static_cast<size_t>(slot);
+}
+
+// the same policy as print in src/runtime.asm, so output stops at the same point when the program faults
+void VirtualMachine::PrintNumber(int64_t value) {
+    if (m_Length > BufferSize - 32) {
+        Flush();
+    }
+    char* end = std::to_chars(m_Buffer.data() + m_Length, m_Buffer.data() + BufferSize, value).ptr;
+    *end++ = '\n';
+    m_Length = static_cast<size_t>(end - m_Buffer.data());
+}
+
+// and as print_text
+void VirtualMachine::PrintText(const std::string& text) {
+    if (m_Length + text.size() > BufferSize) {
+        Flush();
+        if (text.size() > BufferSize) {
+            Write(text.data(), text.size());
+            return;
+        }
+    }
+    std::memcpy(m_Buffer.data() + m_Length, text.data(), text.size());
+    m_Length += text.size();
+}
+
+void VirtualMachine::Flush() {
+    Write(m_Buffer.data(), m_Length);
+    m_Length = 0;
+}
+
+void VirtualMachine::Write(const char* data, size_t size) {
+    while (size != 0) {
+        const ssize_t written = write(STDOUT_FILENO, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+// dies the way the native program would; what is still buffered is lost there as well
+void VirtualMachine::Fault(int signal) {
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+    std::abort();
+}
+
+} // namespace Compiler
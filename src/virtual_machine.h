@@ -0,0 +1,36 @@
+#pragma once
+
+#include "bytecode.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Compiler {
+
+// Runs Bytecode. Dispatch is threaded through a table of label addresses where the compiler supports
+// them (GCC and Clang), with a switch otherwise. The program behaves like its native build: output
+// goes through a buffer of the same size that is flushed at the same points, a division that faults
+// kills the process with SIGFPE, and array elements out of bounds alias the same frame slots (or,
+// beyond the frame, kill it with SIGSEGV).
+class VirtualMachine {
+  public:
+    explicit VirtualMachine(const Bytecode& code);
+    int64_t Run(); // returns the exit status
+
+  private:
+    size_t Element(const BytecodeArray& array, int64_t index);
+    void PrintNumber(int64_t value);
+    void PrintText(const std::string& text);
+    void Flush();
+    static void Write(const char* data, size_t size);
+    [[noreturn]] void Fault(int signal);
+
+    const Bytecode& m_Code;
+    std::vector<int64_t> m_Registers;
+
+    static constexpr size_t BufferSize = 65536; // PRINT_BUFFER_SIZE of src/runtime.asm
+    std::vector<char> m_Buffer;
+    size_t m_Length = 0;
+};
+
+} // namespace Compiler
@@ -1,5 +1,5 @@
-# nasm -felf64 print.asm -o print.o
+# the runtime is part of the generated assembly, there is nothing else to link
 nasm -felf64 "$1.asm" -o "$1.o"
-ld "$1.o" print.o -o "$1"
+ld "$1.o" -o "$1"
 ./"$1"; echo "Exit code:" $?
 rm "$1" "$1.o"
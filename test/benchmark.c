@@ -0,0 +1,44 @@
+
+{
+    int n;
+    int i;
+    int j;
+    int primes;
+    int sum;
+    int round;
+    int sieve[4096];
+
+    // sieve of Eratosthenes, repeated to give the loops some weight
+    n = 4096;
+    round = 2000;
+    while (round) {
+        i = 0;
+        while (i < n) {
+            sieve[i] = 1;
+            i = i + 1;
+        }
+        primes = 0;
+        i = 2;
+        while (i < n) {
+            if (sieve[i]) {
+                primes = primes + 1;
+                j = i * i;
+                while (j < n) {
+                    sieve[j] = 0;
+                    j = j + i;
+                }
+            }
+            i = i + 1;
+        }
+        round = round - 1;
+    }
+
+    sum = 0;
+    i = 0;
+    while (i < 3000000) {
+        sum = (sum + i * i % 7) % 1000003;
+        i = i + 1;
+    }
+
+    return (primes + sum) % 256;
+}
@@ -0,0 +1,35 @@
+# compares the native build of a program with the bytecode VM and with a native build that leaves its loops
+# scalar, e.g. ./test/benchmark.sh test/benchmark.c, or ./test/benchmark.sh test/saxpy.c ./build/Compiler -mavx2
+# usage: benchmark.sh [source] [compiler] [flags]; traced programs measure mostly printing, so it runs --no-trace
+source="${1:-test/benchmark.c}"
+compiler="${2:-./build/Compiler}"
+flags="--no-trace --eval-budget=0 $3"
+scalar="--passes=evaluate,dce,dse,unused-vars,gvn,slp,layout" # -O3 without the loop vectorizer
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+build() {
+    local name="$1"
+    shift
+    "$compiler" $flags "$@" "$source" "$work/$name.asm" > /dev/null || exit 1
+    nasm -felf64 "$work/$name.asm" -o "$work/$name.o" && ld "$work/$name.o" -o "$work/$name" || exit 1
+}
+build program
+build scalar $scalar
+"$compiler" $flags --emit-bytecode "$source" "$work/program.bc" > /dev/null || exit 1
+
+run() {
+    local start end status
+    start=$(date +%s%N)
+    "$@" > "$work/output"
+    status=$?
+    end=$(date +%s%N)
+    echo "$(( (end - start) / 1000000 )) ms, exit code $status"
+}
+
+echo "native: $(run "$work/program")"
+cp "$work/output" "$work/native"
+echo "scalar: $(run "$work/scalar")"
+cmp -s "$work/native" "$work/output" || echo "output differs"
+echo "vm:     $(run "$compiler" --vm "$work/program.bc")"
+cmp -s "$work/native" "$work/output" || echo "output differs"
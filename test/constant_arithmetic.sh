@@ -0,0 +1,74 @@
+# checks division, remainder and multiplication by constants, which the native build does without idiv
+# and imul, against the bytecode VM, which does them with both; e.g. ./test/constant_arithmetic.sh
+# usage: constant_arithmetic.sh [compiler]; each dividend is an edge value plus an offset in [-64, 64]
+compiler="${1:-./build/Compiler}"
+flags="--passes=gvn --eval-budget=0" # gvn folds the negated constants, and nothing else is known
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# a constant as the language spells it, which has no negative literals
+literal() {
+    if [ "$1" = -9223372036854775808 ]; then
+        echo "(0 - 9223372036854775807 - 1)"
+    elif [ "$1" -lt 0 ]; then
+        echo "(0 - ${1#-})"
+    else
+        echo "$1"
+    fi
+}
+
+divisors=(1 10 100 1000 641 6700417 1000000007 4294967295 4294967297 4052555153018976267 9223372036854775807
+    -9223372036854775808 9223372036854775806 3037000499 1152921504606846975 1317624576693539401)
+for d in $(seq 2 40); do divisors+=("$d"); done
+for k in $(seq 2 63); do
+    divisors+=($((1 << k)) $(((1 << k) - 1)) $(((1 << k) + 1)))
+done
+factors=(0 1 -1 6 10 12 15 18 24 25 27 36 40 45 72 81 75 100 255 257 1023 4097 65535 1099511627775
+    1099511627777 -3 -5 -9 -16 -45 9223372036854775807 -9223372036854775808)
+
+bases=(0 9223372036854775807 -9223372036854775808 4294967296 2147483648 4611686018427387904
+    -4611686018427387904 1000000000000000000 -1000000000000000000 3037000499)
+
+{
+    echo "{"
+    echo "int v[${#bases[@]}]; int i; int k; int x; int y;"
+    for i in "${!bases[@]}"; do
+        echo "v[$i] = $(literal "${bases[$i]}");"
+    done
+    echo "i = 0;"
+    echo "while (i < ${#bases[@]}) {"
+    echo "k = 0 - 64;"
+    echo "while (k <= 64) {"
+    echo "x = v[i] + k;"
+    declare -A seen
+    for d in "${divisors[@]}"; do
+        for c in "$d" $((-d)); do # -INT64_MIN wraps to itself
+            # idiv faults on INT64_MIN / -1, which the dividends include
+            [ "$c" = -1 ] || [ -n "${seen[$c]}" ] && continue
+            seen[$c]=1
+            echo "y = x / $(literal "$c"); y = x % $(literal "$c");"
+        done
+    done
+    for f in "${factors[@]}"; do
+        echo "y = x * $(literal "$f");"
+    done
+    echo "k = k + 1;"
+    echo "}"
+    echo "i = i + 1;"
+    echo "}"
+    echo "return 0;"
+    echo "}"
+} > "$work/constants.c"
+
+"$compiler" $flags "$work/constants.c" "$work/constants.asm" > /dev/null || exit 1
+nasm -felf64 "$work/constants.asm" -o "$work/constants.o" && ld "$work/constants.o" -o "$work/constants" || exit 1
+"$compiler" $flags --emit-bytecode "$work/constants.c" "$work/constants.bc" > /dev/null || exit 1
+
+"$work/constants" > "$work/native" || { echo "native build failed"; exit 1; }
+"$compiler" --vm "$work/constants.bc" > "$work/vm" || { echo "vm failed"; exit 1; }
+if ! cmp -s "$work/native" "$work/vm"; then
+    echo "native and vm differ:"
+    diff "$work/native" "$work/vm" | head -20
+    exit 1
+fi
+echo "$(wc -l < "$work/native") results agree"
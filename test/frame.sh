@@ -0,0 +1,48 @@
+# runs a program whose stack frame takes every slot MaxFrameSlots (src/ast.h) allows, while its deepest
+# expression pushes an operand per level, natively on the default 8 MB stack and in the VM, and checks
+# that a frame one slot larger is rejected; e.g. ./test/frame.sh
+# usage: frame.sh [compiler] [slots] [nesting]; the defaults are MaxFrameSlots and --max-nesting
+compiler="${1:-./build/Compiler}"
+slots="${2:-917504}"
+nesting="${3:-65536}"
+flags="-O0 --no-trace"
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+exec < /dev/null # the compiler waits for a key after an error
+
+# an array filling the frame but for the scalars, every element written; the global block, the
+# statement around the expression and the index innermost take three levels of nesting, and the
+# parentheses the rest, each of which pushes i * i while it computes the inside
+program() {
+    local size=$(($1 - 2)) depth=$((nesting - 3))
+    echo "{ int a[$size]; int i; int x; i = 0; while (i < $size) { a[i] = i; i = i + 1; }"
+    echo "x = $(printf -- "(i * i - %.0s" $(seq "$depth"))a[i - 1]$(printf -- ")%.0s" $(seq "$depth"));"
+    echo "return x % 251; }"
+}
+
+program "$slots" > "$work/frame.c"
+size=$((slots - 2))
+expected=$(((nesting - 3) % 2 ? (size * size - (size - 1)) % 251 : (size - 1) % 251))
+"$compiler" $flags "$work/frame.c" "$work/frame.asm" > /dev/null || exit 1
+nasm -felf64 "$work/frame.asm" -o "$work/frame.o" && ld "$work/frame.o" -o "$work/frame" || exit 1
+failed=0
+(ulimit -s 8192 && "$work/frame")
+status=$?
+if [ "$status" != "$expected" ]; then
+    echo "native: exit code $status instead of $expected"
+    failed=1
+fi
+"$compiler" $flags --vm "$work/frame.c" > /dev/null
+status=$?
+if [ "$status" != "$expected" ]; then
+    echo "vm: exit code $status instead of $expected"
+    failed=1
+fi
+
+program $((slots + 1)) > "$work/frame.c"
+if "$compiler" $flags "$work/frame.c" "$work/frame.asm" > "$work/log" 2>&1 || ! grep -q "Stack frame too large" "$work/log"; then
+    echo "a frame of $((slots + 1)) slots: $(head -c 300 "$work/log")"
+    failed=1
+fi
+[ "$failed" = 0 ] && echo "a frame of $slots slots runs on the default stack"
+exit "$failed"
@@ -0,0 +1,73 @@
+# compiles programs nested as deep as --max-nesting allows, one level too deep, and runs them in the VM:
+# the passes recurse once per level on a stack sized for the depth (RunAtDepth in src/driver.cpp), so run
+# it against a debug build, whose frames are the largest, e.g. ./test/nesting.sh build-debug/Compiler
+# usage: nesting.sh [compiler] [limit]; the limit is the compiler's --max-nesting (65536 by default)
+compiler="${1:-./build/Compiler}"
+limit="${2:-65536}"
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+exec < /dev/null # the compiler waits for a key after an error
+
+# TEXT repeated N times
+repeat() {
+    [ "$2" -gt 0 ] && printf -- "$1%.0s" $(seq "$2")
+}
+
+# Each shape prints a program nested as deep as the levels it is given allow, and the global block and
+# the statement around the nest take two more. Every block declares the variables it tests, so that
+# names resolve in the innermost scopes.
+parentheses() {
+    echo "{ int x; x = 1; x = $(repeat "(" "$1")x + 1$(repeat ")" "$1"); return x; }"
+}
+blocks() {
+    echo "{ int x; x = 1; $(repeat "{ int x; x = 2; " "$1")x = x + 1; $(repeat "} " "$1")return x; }"
+}
+branches() {
+    echo "{ int x; x = 1; $(repeat "if (x == 0) x = 3; else " "$1")x = x + 1; return x; }"
+}
+ifs() { # a statement and a block per level
+    echo "{ int x; x = 1; $(repeat "if (x) { int x; x = 2; " $(($1 / 2)))x = x + 1; $(repeat "} " $(($1 / 2)))return x; }"
+}
+loops() { # each loop runs once: the one inside ends it, so its variable is not live all the way down
+    awk -v n=$(($1 / 2)) 'BEGIN {
+        printf "{ int x; x = 1; "
+        for (i = 0; i < n; i++) {
+            printf i % 2 ? "while (y) { int x; x = 1; " : "while (x) { int y; y = 1; "
+        }
+        for (i = n - 1; i >= 0; i--) {
+            printf i % 2 ? "y = 0; } " : "x = 0; } "
+        }
+        print "return x; }"
+    }'
+}
+
+failed=0
+check() { # shape exit-code levels-per-nesting
+    "$1" $((limit - 2)) > "$work/$1.c"
+    for flags in -O0 -O3 "-O3 --eval-budget=0"; do
+        if ! "$compiler" $flags "$work/$1.c" "$work/$1.asm" > "$work/log" 2>&1; then
+            echo "$1 ($flags): $(head -c 300 "$work/log")"
+            failed=1
+        fi
+    done
+    "$compiler" --vm "$work/$1.c" > "$work/log" 2>&1
+    local status=$?
+    if [ "$status" != "$2" ]; then
+        echo "$1 (--vm): exit code $status instead of $2: $(tail -c 300 "$work/log")"
+        failed=1
+    fi
+
+    "$1" $((limit - 2 + $3)) > "$work/$1.c"
+    if "$compiler" -O0 "$work/$1.c" "$work/$1.asm" > "$work/log" 2>&1 || ! grep -q "Nesting exceeds" "$work/log"; then
+        echo "$1: deeper than the limit: $(head -c 300 "$work/log")"
+        failed=1
+    fi
+}
+
+check parentheses 2 1
+check blocks 1 1
+check branches 2 1
+check ifs 1 2
+check loops 0 2
+[ "$failed" = 0 ] && echo "programs nested $limit levels deep compile"
+exit "$failed"
@@ -0,0 +1,32 @@
+{
+    int n;
+    int i;
+    int a;
+    int s;
+    int round;
+    int x[1024];
+    int y[1024];
+
+    // y = a * x + y over 1024 elements with a running sum, the kernel the loop vectorizer targets
+    n = 1024;
+    i = 0;
+    while (i < n) {
+        x[i] = i % 17;
+        y[i] = i % 5;
+        i = i + 1;
+    }
+    a = 3;
+    s = 0;
+    round = 30000;
+    while (round) {
+        i = 0;
+        while (i < n) {
+            y[i] = a * x[i] + y[i];
+            s = s + y[i];
+            i = i + 1;
+        }
+        round = round - 1;
+    }
+
+    return s % 256;
+}